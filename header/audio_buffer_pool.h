@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+class audio_buffer_pool;
+
+// A buffer of doubles borrowed from an audio_buffer_pool, returned to the pool when destroyed or reset.
+// The contents are not initialized.
+class pooled_buffer
+{
+public:
+	pooled_buffer() {}
+	pooled_buffer(const pooled_buffer&) = delete;
+	pooled_buffer& operator=(const pooled_buffer&) = delete;
+	pooled_buffer(pooled_buffer&& other) noexcept { *this = std::move(other); }
+	pooled_buffer& operator=(pooled_buffer&& other) noexcept;
+	~pooled_buffer() { reset(); }
+	double* data() const noexcept { return m_data; }
+	size_t size() const noexcept { return m_size; }
+	size_t capacity() const noexcept { return m_capacity; }
+	bool empty() const noexcept { return m_size == 0; }
+	double& operator[](size_t index) const noexcept { return m_data[index]; }
+	double* begin() const noexcept { return m_data; }
+	double* end() const noexcept { return m_data + m_size; }
+	// Makes the buffer hold at least size doubles, keeping the memory when it's large enough.
+	// The contents are not kept when a larger buffer is needed.
+	void resize(size_t size);
+	// Returns the memory to the pool
+	void reset();
+private:
+	friend class audio_buffer_pool;
+	audio_buffer_pool* m_pool = nullptr;
+	double* m_data = nullptr;
+	size_t m_size = 0;
+	size_t m_capacity = 0;
+	int m_size_class = -1;
+};
+
+struct audio_buffer_pool_stats
+{
+	// Buffers handed out
+	int64_t m_num_acquires = 0;
+	// Buffers that had to be allocated from the system, the rest were reused
+	int64_t m_num_allocations = 0;
+	// Buffers given back to the system, because the cache was full or they were too large to cache
+	int64_t m_num_frees = 0;
+	int64_t m_bytes_in_use = 0;
+	int64_t m_peak_bytes_in_use = 0;
+	int64_t m_bytes_cached = 0;
+};
+
+// Pool of 64-byte aligned buffers of doubles for render temporaries, so that renders and other repeated
+// operations reuse the memory of earlier ones instead of allocating and zeroing it each time.
+// Sizes are rounded up to size classes spaced a quarter octave apart, so at most 25% is wasted. Each size
+// class has its own lock, so threads asking for different sizes don't contend.
+// Returned buffers are cached until the cached total would exceed the cache limit, then they are freed.
+class audio_buffer_pool
+{
+public:
+	static const size_t alignment = 64;
+	audio_buffer_pool(size_t maxcachedbytes = 256 * 1024 * 1024);
+	~audio_buffer_pool();
+	audio_buffer_pool(const audio_buffer_pool&) = delete;
+	audio_buffer_pool& operator=(const audio_buffer_pool&) = delete;
+	// Can be called from any thread
+	pooled_buffer acquire(size_t size);
+	audio_buffer_pool_stats get_stats() const;
+	// Frees all cached buffers. Buffers in use are not affected.
+	void trim();
+private:
+	friend class pooled_buffer;
+	struct size_class
+	{
+		std::mutex m_mutex;
+		std::vector<double*> m_free;
+	};
+	// Buffers larger than the largest class are allocated and freed directly
+	static const int num_size_classes = 4 * 25;
+	std::unique_ptr<size_class[]> m_classes;
+	size_t m_max_cached_bytes = 0;
+	std::atomic<int64_t> m_num_acquires{ 0 };
+	std::atomic<int64_t> m_num_allocations{ 0 };
+	std::atomic<int64_t> m_num_frees{ 0 };
+	std::atomic<int64_t> m_bytes_in_use{ 0 };
+	std::atomic<int64_t> m_peak_bytes_in_use{ 0 };
+	std::atomic<int64_t> m_bytes_cached{ 0 };
+	void release(double* data, size_t capacity, int sizeclass);
+};
+
+// The pool used by the render code
+audio_buffer_pool& get_audio_buffer_pool();
+
+// Hands out aligned memory for the temporaries of one task from a few large pool buffers. Allocating is just
+// advancing an offset, and everything is released at once by reset() or when the arena is destroyed.
+// An arena is meant to be used by one thread at a time.
+class audio_arena
+{
+public:
+	// blocksize is the minimum number of doubles requested from the pool at a time
+	audio_arena(audio_buffer_pool& pool, size_t blocksize = 65536) : m_pool(pool), m_block_size(blocksize) {}
+	audio_arena(size_t blocksize = 65536) : m_pool(get_audio_buffer_pool()), m_block_size(blocksize) {}
+	audio_arena(const audio_arena&) = delete;
+	audio_arena& operator=(const audio_arena&) = delete;
+	// Returns uninitialized memory for count objects of T, aligned to 64 bytes.
+	// T must be trivially constructible and destructible, like samples and pointers.
+	template<typename T>
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(allocate_bytes(count * sizeof(T)));
+	}
+	// Allocates nch channels of frames doubles and returns the array of channel pointers, as PCM_sink wants them
+	double** allocate_channels(int nch, size_t frames);
+	// Makes all the memory available again. The blocks are kept for the next allocations.
+	void reset();
+	// Returns the blocks to the pool
+	void release();
+	size_t get_bytes_allocated() const { return m_bytes_allocated; }
+private:
+	audio_buffer_pool& m_pool;
+	size_t m_block_size = 65536;
+	std::vector<pooled_buffer> m_blocks;
+	size_t m_current_block = 0;
+	size_t m_offset = 0;
+	size_t m_bytes_allocated = 0;
+	void* allocate_bytes(size_t bytes);
+};
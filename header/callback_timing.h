@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+// Summary of the recorded audio callbacks. Load is the wall clock time the callback took
+// as a percentage of the duration of the audio it produced.
+struct callback_timing_stats
+{
+	static const int num_histogram_bins = 21;
+	int num_callbacks = 0;
+	double mean_load = 0.0;
+	double worst_load = 0.0;
+	double worst_ms = 0.0;
+	int num_overruns = 0;
+	// 5% wide load bins, the last one counts the callbacks with at least 100% load, which are the overruns
+	int histogram[num_histogram_bins] = { 0 };
+};
+
+// Ring of the timings of the latest audio callbacks. Recording doesn't lock or allocate, so it can be done
+// in the audio thread, and several threads can record into the same ring.
+// Each entry is packed into a single atomic 64 bit value so that readers never see half written entries.
+class callback_timing_ring
+{
+public:
+	static const int ring_size = 4096;
+	callback_timing_ring();
+	// Audio thread
+	void record(double elapsed_seconds, int nframes, double samplerate) noexcept;
+	// Any thread. Summarizes at most the maxcallbacks latest callbacks since the last reset.
+	callback_timing_stats get_stats(int maxcallbacks = ring_size) const;
+	void reset() { m_reset_position = m_write_position.load(); }
+private:
+	std::atomic<uint64_t> m_entries[ring_size];
+	std::atomic<uint64_t> m_write_position{ 0 };
+	std::atomic<uint64_t> m_reset_position{ 0 };
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "WDL/WDL/lice/lice.h"
+#include "reaper_plugin/reaper_plugin_functions.h"
+#include "envelope_model.h"
+#include "WDL/WDL/fnv64.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Values of an envelope point that take part in the change detection hashes
+struct envelope_point_hash_data
+{
+	double time = 0.0;
+	double value = 0.0;
+	double tension = 0.0;
+	int shape = 0;
+};
+
+inline uint64_t hash_envelope_point(uint64_t h, const envelope_point_hash_data& pt)
+{
+	h = WDL_FNV64(h, (const unsigned char*)&pt.time, sizeof(double));
+	h = WDL_FNV64(h, (const unsigned char*)&pt.value, sizeof(double));
+	h = WDL_FNV64(h, (const unsigned char*)&pt.tension, sizeof(double));
+	h = WDL_FNV64(h, (const unsigned char*)&pt.shape, sizeof(int));
+	return h;
+}
+
+// 64 bit FNV hash of a breakpoint_envelope (or soa_breakpoint_envelope). Same on all architectures.
+// Pass the state of a hash in progress as h to chain the points into it.
+template<typename EnvelopeType>
+inline uint64_t hash_envelope_points(const EnvelopeType& env, uint64_t h = WDL_FNV64_IV)
+{
+	for (int i = 0; i < env.get_num_points(); ++i)
+	{
+		envbreakpoint pt = env.get_point(i);
+		envelope_point_hash_data data;
+		data.time = pt.get_x();
+		data.value = pt.get_y();
+		data.tension = pt.get_param1();
+		data.shape = pt.get_shape();
+		h = hash_envelope_point(h, data);
+	}
+	return h;
+}
+
+// Keeps per envelope hashes of Reaper TrackEnvelopes and MRP breakpoint_envelopes so that
+// changes can be polled for often without rehashing everything on every poll.
+// The points of each envelope are hashed in fixed size ranges. A poll first compares the point counts,
+// which is cheap and catches added and removed points immediately. The point ranges are then revalidated
+// round robin, as many whole ranges per poll as fit in the "points budget", so that a poll of very large
+// envelopes stays cheap and a full revalidation is spread over several polls. A poll always checks at least
+// one range, so a budget smaller than the range size still hashes a whole range, up to points_per_range
+// points. A budget of 0 revalidates everything on each poll.
+// Tokens are change generation numbers : each poll that finds changes increments the generation and stamps
+// the changed envelopes with it, so an envelope has changed since token t if its stamp is greater than t.
+// All methods must be called from the main thread.
+class envelope_change_tracker
+{
+public:
+	envelope_change_tracker(int points_per_range = 1024)
+		: m_points_per_range(points_per_range < 1 ? 1 : points_per_range) {}
+	// Returns the index of the envelope in the tracker
+	int add_envelope(TrackEnvelope* env);
+	int add_envelope(std::shared_ptr<breakpoint_envelope> env);
+	int get_num_envelopes() const { return (int)m_entries.size(); }
+	void clear() { m_entries.clear(); }
+	// Revalidates the envelopes and returns the current token
+	int poll(int points_budget = 0);
+	int get_token() const { return m_generation; }
+	bool has_changed_since(int index, int token) const;
+	uint64_t get_hash(int index) const;
+private:
+	struct entry
+	{
+		TrackEnvelope* m_reaper_env = nullptr;
+		std::weak_ptr<breakpoint_envelope> m_mrp_env;
+		bool m_is_mrp_env = false;
+		int m_num_points = -1;
+		std::vector<uint64_t> m_range_hashes;
+		int m_next_range = 0;
+		int m_changed_at = 0;
+	};
+	std::vector<entry> m_entries;
+	int m_points_per_range = 1024;
+	int m_generation = 0;
+	// Round robin position for budgeted range revalidation
+	int m_next_entry = 0;
+	bool is_alive(entry& e) const;
+	int count_points(entry& e) const;
+	uint64_t hash_range(entry& e, int range) const;
+	// Returns true if the range hash had changed
+	bool revalidate_range(entry& e, int range);
+	void rehash_all(entry& e);
+};
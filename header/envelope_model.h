@@ -60,6 +60,18 @@ inline double get_shaped_value(double x, envbreakpoint::PointShape sh, double p1
 	return x;
 }
 
+// Value at time t on the segment that starts at (x0,y0) and ends at (x1,y1), shaped by the start point
+inline double interpolate_segment(double t, double x0, double y0, double x1, double y1,
+	envbreakpoint::PointShape shape, double p1, double p2)
+{
+	double valdiff = y1 - y0;
+	double timediff = x1 - x0;
+	if (timediff < 0.0001)
+		timediff = 0.0001;
+	double offset_x = t - x0;
+	return y0 + valdiff*get_shaped_value((1.0 / timediff)*offset_x, shape, p1, p2);
+}
+
 class breakpoint_envelope
 {
 public:
@@ -129,12 +141,41 @@ public:
 			x1 = x0;
 			y1 = y0;
 		}
-		double valdiff = y1 - y0;
-		double timediff = x1 - x0;
-		if (timediff < 0.0001)
-			timediff = 0.0001;
-		double offset_x = t-x0;
-		return y0+valdiff*get_shaped_value((1.0/timediff)*offset_x,shape,p0,p1);
+		return interpolate_segment(t, x0, y0, x1, y1, shape, p0, p1);
+	}
+	// Evaluates the envelope at times t0, t0+dt, t0+2*dt... into out. dt must not be negative.
+	// Cheaper than calling interpolate for each sample, because the segment is only searched once.
+	void interpolate_block(double t0, double dt, double* out, int n) const noexcept
+	{
+		int numpts = (int)m_points.size();
+		if (numpts == 0)
+		{
+			for (int i = 0; i < n; ++i)
+				out[i] = 0.0;
+			return;
+		}
+		envbreakpoint pt(t0, 0.0);
+		int seg = (int)(std::lower_bound(m_points.begin(), m_points.end(), pt, [](const envbreakpoint& a, const envbreakpoint& b)
+		{
+			return a.get_x() < b.get_x();
+		}) - m_points.begin()) - 1;
+		for (int i = 0; i < n; ++i)
+		{
+			double t = t0 + dt*i;
+			while (seg + 1 < numpts && m_points[seg + 1].get_x() < t)
+				++seg;
+			if (seg < 0)
+				out[i] = m_points.front().get_y();
+			else if (seg + 1 >= numpts)
+				out[i] = m_points.back().get_y();
+			else
+			{
+				const envbreakpoint& a = m_points[seg];
+				const envbreakpoint& b = m_points[seg + 1];
+				out[i] = interpolate_segment(t, a.get_x(), a.get_y(), b.get_x(), b.get_y(),
+					a.get_shape(), a.get_param1(), a.get_param2());
+			}
+		}
 	}
 	auto begin() { return m_points.begin(); }
 	auto end() { return m_points.end(); }
@@ -148,4 +189,459 @@ private:
 	int m_color = 0;
 };
 
+// Breakpoint envelope with the same interface as breakpoint_envelope, but storing the point fields
+// in separate contiguous arrays. Searches and block evaluation then only touch the dense time and value
+// arrays, and a point takes 37 bytes instead of the 56 of an envbreakpoint, which matters for the very
+// large envelopes produced by analysis code.
+// Because there are no envbreakpoint objects stored, the non-const get_point returns a small proxy object
+// which has the same accessors as envbreakpoint, so use auto instead of envbreakpoint& to hold it.
+class soa_breakpoint_envelope
+{
+public:
+	class point_ref
+	{
+	public:
+		point_ref(soa_breakpoint_envelope* env, int index) : m_env(env), m_index(index) {}
+		double get_x() const noexcept { return m_env->m_x[m_index]; }
+		double get_y() const noexcept { return m_env->m_y[m_index]; }
+		void set_x(double x) noexcept { m_env->m_x[m_index] = x; }
+		void set_y(double y) noexcept { m_env->m_y[m_index] = y; }
+		int get_status() const { return m_env->m_status[m_index]; }
+		void set_status(int x) { m_env->m_status[m_index] = x; }
+		double get_param1() const { return m_env->m_p1[m_index]; }
+		double get_param2() const { return m_env->m_p2[m_index]; }
+		void set_param1(double v) { m_env->m_p1[m_index] = v; }
+		void set_param2(double v) { m_env->m_p2[m_index] = v; }
+		envbreakpoint::PointShape get_shape() const { return (envbreakpoint::PointShape)m_env->m_shape[m_index]; }
+		void set_shape(envbreakpoint::PointShape sh) { m_env->m_shape[m_index] = (unsigned char)sh; }
+		operator envbreakpoint() const { return static_cast<const soa_breakpoint_envelope*>(m_env)->get_point(m_index); }
+	private:
+		soa_breakpoint_envelope* m_env = nullptr;
+		int m_index = 0;
+	};
+	class iterator
+	{
+	public:
+		iterator(soa_breakpoint_envelope* env, int index) : m_env(env), m_index(index) {}
+		point_ref operator*() const { return point_ref(m_env, m_index); }
+		iterator& operator++() { ++m_index; return *this; }
+		bool operator==(const iterator& rhs) const { return m_env == rhs.m_env && m_index == rhs.m_index; }
+		bool operator!=(const iterator& rhs) const { return !((*this) == rhs); }
+	private:
+		soa_breakpoint_envelope* m_env = nullptr;
+		int m_index = 0;
+	};
+	soa_breakpoint_envelope() {}
+	soa_breakpoint_envelope(std::string name, int color = 0) : m_name(name), m_color(color) {}
+	int get_num_points() const noexcept { return (int)m_x.size(); }
+	envbreakpoint get_point(int index) const noexcept
+	{
+		envbreakpoint pt(m_x[index], m_y[index], (envbreakpoint::PointShape)m_shape[index], m_p1[index], m_p2[index]);
+		pt.set_status(m_status[index]);
+		return pt;
+	}
+	point_ref get_point(int index) noexcept { return point_ref(this, index); }
+	// Direct access to the dense arrays, for code that wants to process them in bulk
+	const double* get_x_data() const noexcept { return m_x.data(); }
+	const double* get_y_data() const noexcept { return m_y.data(); }
+	void reserve(int numpoints)
+	{
+		m_x.reserve(numpoints);
+		m_y.reserve(numpoints);
+		m_p1.reserve(numpoints);
+		m_p2.reserve(numpoints);
+		m_shape.reserve(numpoints);
+		m_status.reserve(numpoints);
+	}
+	void add_point(envbreakpoint pt, bool dosortnow)
+	{
+		m_x.push_back(pt.get_x());
+		m_y.push_back(pt.get_y());
+		m_p1.push_back(pt.get_param1());
+		m_p2.push_back(pt.get_param2());
+		m_shape.push_back((unsigned char)pt.get_shape());
+		m_status.push_back(pt.get_status());
+		if (dosortnow == true)
+			sort_points();
+	}
+	void remove_all_points()
+	{
+		m_x.clear();
+		m_y.clear();
+		m_p1.clear();
+		m_p2.clear();
+		m_shape.clear();
+		m_status.clear();
+	}
+	void remove_point(int index)
+	{
+		if (index >= 0 && index < m_x.size())
+		{
+			m_x.erase(m_x.begin() + index);
+			m_y.erase(m_y.begin() + index);
+			m_p1.erase(m_p1.begin() + index);
+			m_p2.erase(m_p2.begin() + index);
+			m_shape.erase(m_shape.begin() + index);
+			m_status.erase(m_status.begin() + index);
+		}
+	}
+	// The condition function is passed an envbreakpoint copy of each point
+	template<typename F>
+	inline void remove_points_conditionally(F&& f)
+	{
+		const soa_breakpoint_envelope* constthis = this;
+		int numpts = get_num_points();
+		int dest = 0;
+		for (int i = 0; i < numpts; ++i)
+		{
+			envbreakpoint pt = constthis->get_point(i);
+			if (f(pt) == true)
+				continue;
+			if (dest != i)
+			{
+				m_x[dest] = m_x[i];
+				m_y[dest] = m_y[i];
+				m_p1[dest] = m_p1[i];
+				m_p2[dest] = m_p2[i];
+				m_shape[dest] = m_shape[i];
+				m_status[dest] = m_status[i];
+			}
+			++dest;
+		}
+		m_x.resize(dest);
+		m_y.resize(dest);
+		m_p1.resize(dest);
+		m_p2.resize(dest);
+		m_shape.resize(dest);
+		m_status.resize(dest);
+	}
+	void sort_points()
+	{
+		if (std::is_sorted(m_x.begin(), m_x.end()) == true)
+			return;
+		std::vector<int> order(m_x.size());
+		for (int i = 0; i < order.size(); ++i)
+			order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return m_x[a] < m_x[b]; });
+		apply_order(m_x, order);
+		apply_order(m_y, order);
+		apply_order(m_p1, order);
+		apply_order(m_p2, order);
+		apply_order(m_shape, order);
+		apply_order(m_status, order);
+	}
+	double interpolate(double t) const noexcept
+	{
+		if (m_x.empty() == true)
+			return 0.0;
+		if (t <= m_x.front())
+			return m_y.front();
+		if (t >= m_x.back())
+			return m_y.back();
+		int i = (int)(std::lower_bound(m_x.begin(), m_x.end(), t) - m_x.begin()) - 1;
+		return interpolate_segment(t, m_x[i], m_y[i], m_x[i + 1], m_y[i + 1],
+			(envbreakpoint::PointShape)m_shape[i], m_p1[i], m_p2[i]);
+	}
+	// Evaluates the envelope at times t0, t0+dt, t0+2*dt... into out. dt must not be negative.
+	void interpolate_block(double t0, double dt, double* out, int n) const noexcept
+	{
+		int numpts = get_num_points();
+		if (numpts == 0)
+		{
+			for (int i = 0; i < n; ++i)
+				out[i] = 0.0;
+			return;
+		}
+		int seg = (int)(std::lower_bound(m_x.begin(), m_x.end(), t0) - m_x.begin()) - 1;
+		for (int i = 0; i < n; ++i)
+		{
+			double t = t0 + dt*i;
+			while (seg + 1 < numpts && m_x[seg + 1] < t)
+				++seg;
+			if (seg < 0)
+				out[i] = m_y.front();
+			else if (seg + 1 >= numpts)
+				out[i] = m_y.back();
+			else
+				out[i] = interpolate_segment(t, m_x[seg], m_y[seg], m_x[seg + 1], m_y[seg + 1],
+					(envbreakpoint::PointShape)m_shape[seg], m_p1[seg], m_p2[seg]);
+		}
+	}
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, get_num_points()); }
+	void setName(std::string name) { m_name = name; }
+	std::string getName() const { return m_name; }
+	void setColor(int c) { m_color = c; }
+	int getColor() const { return m_color; }
+private:
+	std::vector<double> m_x;
+	std::vector<double> m_y;
+	std::vector<double> m_p1;
+	std::vector<double> m_p2;
+	std::vector<unsigned char> m_shape;
+	std::vector<int> m_status;
+	std::string m_name;
+	int m_color = 0;
+	template<typename T>
+	static void apply_order(std::vector<T>& v, const std::vector<int>& order)
+	{
+		std::vector<T> temp(v.size());
+		for (int i = 0; i < order.size(); ++i)
+			temp[i] = v[order[i]];
+		v.swap(temp);
+	}
+};
+
+// Integral over the first u (0..1) of the normalized shaping curve of a segment, ie the closed form
+// integral of get_shaped_value
+inline double integrate_shaped_value(double u, envbreakpoint::PointShape sh, double p1)
+{
+	if (sh == envbreakpoint::Power)
+	{
+		const double max_exponent = 5.0;
+		if (p1 < 0.5)
+		{
+			double exponent = (max_exponent + 1.0) - p1 * (max_exponent*2.0);
+			return pow(u, exponent + 1.0) / (exponent + 1.0);
+		}
+		double exponent = 1.0 + ((p1 - 0.5)*(max_exponent*2.0));
+		return u - (1.0 - pow(1.0 - u, exponent + 1.0)) / (exponent + 1.0);
+	}
+	return 0.5*u*u;
+}
+
+// Solves the offset into a segment where the running integral of the segment reaches area.
+// integral and value are the running integral and the envelope value as functions of the offset,
+// the integral being increasing over [0, width].
+template<typename IntegralF, typename ValueF>
+inline double solve_segment_integral(double area, double width, IntegralF&& integral, ValueF&& value)
+{
+	double lo = 0.0;
+	double hi = width;
+	double d = width*0.5;
+	for (int i = 0; i < 50; ++i)
+	{
+		double err = integral(d) - area;
+		if (fabs(err) < 1e-12)
+			break;
+		if (err > 0.0)
+			hi = d;
+		else lo = d;
+		double v = value(d);
+		double next = d - err / v;
+		// Newton step if it stays within the bracket, otherwise bisect
+		if (v <= 0.0 || next <= lo || next >= hi)
+			next = 0.5*(lo + hi);
+		d = next;
+		if (hi - lo < 1e-15)
+			break;
+	}
+	return d;
+}
+
+// Cumulative integral of a breakpoint envelope, evaluated with the closed form integrals of the segments
+// over a table of the integrals at the breakpoints.
+// integral(t) is the area under the envelope from time 0 to time t, inverse_integral finds the time
+// where the area reaches the given value. Before the first and after the last point the envelope is
+// considered to continue with the value of that point, like interpolate() does.
+// The inverse only makes sense for envelopes that stay above zero.
+// This is a snapshot : changes to the envelope afterwards are not seen.
+class breakpoint_envelope_integral
+{
+public:
+	breakpoint_envelope_integral() {}
+	template<typename EnvelopeType>
+	explicit breakpoint_envelope_integral(const EnvelopeType& env)
+	{
+		int numpts = env.get_num_points();
+		m_x.resize(numpts);
+		m_y.resize(numpts);
+		m_p1.resize(numpts);
+		m_shape.resize(numpts);
+		m_cumulative.resize(numpts);
+		for (int i = 0; i < numpts; ++i)
+		{
+			envbreakpoint pt = env.get_point(i);
+			m_x[i] = pt.get_x();
+			m_y[i] = pt.get_y();
+			m_p1[i] = pt.get_param1();
+			m_shape[i] = pt.get_shape();
+		}
+		double acc = 0.0;
+		for (int i = 0; i < numpts; ++i)
+		{
+			m_cumulative[i] = acc;
+			if (i + 1 < numpts)
+				acc += segment_integral(i, m_x[i + 1] - m_x[i]);
+		}
+		m_origin = 0.0;
+		m_origin = integral_from_first_point(0.0);
+	}
+	double integral(double t) const noexcept
+	{
+		return integral_from_first_point(t) - m_origin;
+	}
+	double inverse_integral(double area) const noexcept
+	{
+		if (m_x.empty() == true)
+			return 0.0;
+		double a = area + m_origin;
+		if (a <= 0.0)
+		{
+			if (m_y.front() <= 0.0)
+				return m_x.front();
+			return m_x.front() + a / m_y.front();
+		}
+		if (a >= m_cumulative.back())
+		{
+			if (m_y.back() <= 0.0)
+				return m_x.back();
+			return m_x.back() + (a - m_cumulative.back()) / m_y.back();
+		}
+		int i = (int)(std::upper_bound(m_cumulative.begin(), m_cumulative.end(), a) - m_cumulative.begin()) - 1;
+		double width = m_x[i + 1] - m_x[i];
+		double remain = a - m_cumulative[i];
+		if (m_shape[i] != envbreakpoint::Power)
+		{
+			// Linear segment, the integral is a quadratic so solve directly
+			double slope = (m_y[i + 1] - m_y[i]) / width;
+			if (fabs(slope) < 1e-12)
+				return m_x[i] + remain / m_y[i];
+			double disc = m_y[i] * m_y[i] + 2.0*slope*remain;
+			if (disc < 0.0)
+				disc = 0.0;
+			return m_x[i] + (sqrt(disc) - m_y[i]) / slope;
+		}
+		double d = solve_segment_integral(remain, width,
+			[this, i](double d) { return segment_integral(i, d); },
+			[this, i, width](double d) { return interpolate_segment(m_x[i] + d, m_x[i], m_y[i], m_x[i] + width, m_y[i + 1],
+				(envbreakpoint::PointShape)m_shape[i], m_p1[i], 0.0); });
+		return m_x[i] + d;
+	}
+private:
+	std::vector<double> m_x;
+	std::vector<double> m_y;
+	std::vector<double> m_p1;
+	std::vector<unsigned char> m_shape;
+	// Integral from the first point to each point
+	std::vector<double> m_cumulative;
+	// Integral from the first point to time 0
+	double m_origin = 0.0;
+	// Integral over the first d seconds of segment i
+	double segment_integral(int i, double d) const noexcept
+	{
+		double width = m_x[i + 1] - m_x[i];
+		if (width <= 0.0)
+			return 0.0;
+		double u = d / width;
+		return m_y[i] * d + (m_y[i + 1] - m_y[i])*width*integrate_shaped_value(u, (envbreakpoint::PointShape)m_shape[i], m_p1[i]);
+	}
+	double integral_from_first_point(double t) const noexcept
+	{
+		if (m_x.empty() == true)
+			return 0.0;
+		if (t <= m_x.front())
+			return m_y.front()*(t - m_x.front());
+		if (t >= m_x.back())
+			return m_cumulative.back() + m_y.back()*(t - m_x.back());
+		int i = (int)(std::lower_bound(m_x.begin(), m_x.end(), t) - m_x.begin()) - 1;
+		return m_cumulative[i] + segment_integral(i, t - m_x[i]);
+	}
+};
+
+// Cumulative integral of a function of an envelope's value, like a playback rate derived from a pitch envelope,
+// precomputed into a table with a fixed time step between t0 and t1. Between the table entries the function is
+// treated as linear, so integral lookups are O(1) and the inverse is a binary search followed by solving a quadratic.
+// Outside [t0, t1] the function is held at its value at the end.
+class envelope_integral_table
+{
+public:
+	envelope_integral_table() {}
+	template<typename EnvelopeType, typename F>
+	envelope_integral_table(const EnvelopeType& env, double t0, double t1, int numsteps, F&& mapping)
+	{
+		if (numsteps < 1)
+			numsteps = 1;
+		if (t1 <= t0)
+			t1 = t0 + 1.0;
+		m_t0 = t0;
+		m_step = (t1 - t0) / numsteps;
+		m_values.resize(numsteps + 1);
+		env.interpolate_block(t0, m_step, m_values.data(), numsteps + 1);
+		for (auto& e : m_values)
+			e = mapping(e);
+		m_cumulative.resize(numsteps + 1);
+		double acc = 0.0;
+		for (int i = 0; i < numsteps + 1; ++i)
+		{
+			m_cumulative[i] = acc;
+			if (i < numsteps)
+				acc += 0.5*(m_values[i] + m_values[i + 1])*m_step;
+		}
+	}
+	bool isValid() const noexcept { return m_values.empty() == false; }
+	// Value of the mapped function at time t
+	double value(double t) const noexcept
+	{
+		if (m_values.empty() == true)
+			return 0.0;
+		double pos = (t - m_t0) / m_step;
+		if (pos <= 0.0)
+			return m_values.front();
+		int i = (int)pos;
+		if (i >= (int)m_values.size() - 1)
+			return m_values.back();
+		double frac = pos - i;
+		return m_values[i] + (m_values[i + 1] - m_values[i])*frac;
+	}
+	// Integral of the mapped function from t0 to t
+	double integral(double t) const noexcept
+	{
+		if (m_values.empty() == true)
+			return 0.0;
+		double pos = (t - m_t0) / m_step;
+		if (pos <= 0.0)
+			return m_values.front()*(t - m_t0);
+		int i = (int)pos;
+		int last = (int)m_values.size() - 1;
+		if (i >= last)
+			return m_cumulative.back() + m_values.back()*(t - (m_t0 + m_step*last));
+		double d = t - (m_t0 + m_step*i);
+		double slope = (m_values[i + 1] - m_values[i]) / m_step;
+		return m_cumulative[i] + m_values[i] * d + 0.5*slope*d*d;
+	}
+	// Time t for which integral(t) equals area. The mapped function must be positive.
+	double inverse_integral(double area) const noexcept
+	{
+		if (m_values.empty() == true)
+			return m_t0;
+		if (area <= 0.0)
+			return m_t0 + area / m_values.front();
+		int last = (int)m_values.size() - 1;
+		if (area >= m_cumulative.back())
+			return m_t0 + m_step*last + (area - m_cumulative.back()) / m_values.back();
+		int i = (int)(std::upper_bound(m_cumulative.begin(), m_cumulative.end(), area) - m_cumulative.begin()) - 1;
+		double remain = area - m_cumulative[i];
+		double slope = (m_values[i + 1] - m_values[i]) / m_step;
+		double d = 0.0;
+		if (fabs(slope) < 1e-12)
+			d = remain / m_values[i];
+		else
+		{
+			double disc = m_values[i] * m_values[i] + 2.0*slope*remain;
+			if (disc < 0.0)
+				disc = 0.0;
+			d = (sqrt(disc) - m_values[i]) / slope;
+		}
+		return m_t0 + m_step*i + d;
+	}
+	double getStartTime() const noexcept { return m_t0; }
+	double getEndTime() const noexcept { return m_t0 + m_step*((int)m_values.size() - 1); }
+private:
+	double m_t0 = 0.0;
+	double m_step = 1.0;
+	std::vector<double> m_values;
+	std::vector<double> m_cumulative;
+};
+
 //using breakpoint_envelope = basic_breakpoint_envelope<simple_aux_data>;
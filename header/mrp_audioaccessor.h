@@ -3,6 +3,8 @@
 #include "WDL/WDL/lice/lice.h"
 #include "reaper_plugin/reaper_plugin_functions.h"
 #include "utilfuncs.h"
+#include "work_stealing_pool.h"
+#include "audio_buffer_pool.h"
 #include <memory>
 #include <vector>
 
@@ -236,26 +238,38 @@ private:
 	}
 };
 
+// Evaluates the samples of a range into separate channel buffers. The views only read their sources,
+// so different parts of the range can be evaluated in parallel.
 template<typename RangeType>
-inline void save_range_to_file(const RangeType& acc, std::string fn)
+inline void render_range(const RangeType& acc, double* const* channels, bool multithreaded = true)
 {
-	char cfg[] = { 'e','v','a','w', 32, 0 };
-	PCM_sink* sink = PCM_Sink_Create(fn.c_str(),
-		cfg, sizeof(cfg), acc.numberOfChannels(), acc.sampleRate(), false);
-	if (sink != nullptr)
+	auto render_frames = [&acc, channels](int64_t start, int64_t end)
 	{
-		std::vector<double> sinkbuf(acc.numberOfChannels()*acc.numberOfFrames());
-		std::vector<double*> sinkbufptrs(acc.numberOfChannels());
-		for (int i = 0; i < acc.numberOfChannels(); ++i)
-			sinkbufptrs[i] = &sinkbuf[i*acc.numberOfFrames()];
-		for (int i = 0; i < acc.numberOfFrames(); ++i)
+		for (int64_t i = start; i < end; ++i)
 		{
 			for (int j = 0; j < acc.numberOfChannels(); ++j)
 			{
-				sinkbufptrs[j][i] = acc.getSample(j, i);
+				channels[j][i] = acc.getSample(j, i);
 			}
 		}
-		sink->WriteDoubles(sinkbufptrs.data(), acc.numberOfFrames(), acc.numberOfChannels(), 0, 1);
+	};
+	if (multithreaded == true)
+		parallel_for(0, acc.numberOfFrames(), 0, render_frames);
+	else render_frames(0, acc.numberOfFrames());
+}
+
+template<typename RangeType>
+inline void save_range_to_file(const RangeType& acc, std::string fn, bool multithreaded = true)
+{
+	char cfg[] = { 'e','v','a','w', 32, 0 };
+	PCM_sink* sink = PCM_Sink_Create(fn.c_str(),
+		cfg, sizeof(cfg), acc.numberOfChannels(), acc.sampleRate(), false);
+	if (sink != nullptr)
+	{
+		audio_arena arena;
+		double** sinkbufptrs = arena.allocate_channels(acc.numberOfChannels(), acc.numberOfFrames());
+		render_range(acc, sinkbufptrs, multithreaded);
+		sink->WriteDoubles(sinkbufptrs, acc.numberOfFrames(), acc.numberOfChannels(), 0, 1);
 		delete sink;
 	}
 }
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "mrp_pcm_source.h"
+#include <vector>
+#include <memory>
+
+enum class MRP_PortType { Audio, Control };
+
+// A processing node of MRP_DSPGraph. Audio ports carry interleaved audio with the channel count of the graph,
+// control ports carry one value per frame.
+class MRP_DSPNode
+{
+public:
+	virtual ~MRP_DSPNode() {}
+	virtual int get_num_inputs() = 0;
+	virtual int get_num_outputs() = 0;
+	virtual MRP_PortType get_input_type(int index) { return MRP_PortType::Audio; }
+	virtual MRP_PortType get_output_type(int index) { return MRP_PortType::Audio; }
+	// Called outside the audio thread, before the node is first processed and when the graph is prepared
+	virtual void prepare(int nch, double sr, int maxblocksize) {}
+	virtual void seek(double seconds) {}
+	// Inputs that aren't connected get silence. The output buffers are scratch buffers with undefined contents
+	// and are never the same as the input buffers.
+	// The same realtime rules as in MRP_AudioDSP::process_audio apply.
+	virtual void process(const double* const* inputs, double* const* outputs, int nch, double sr, int nframes) = 0;
+};
+
+// MRP_AudioDSP made of connected MRP_DSPNodes.
+// The graph is edited in the GUI thread and then committed, which checks it, works out the order the nodes are
+// processed in and which scratch buffers each port uses, and publishes the result to the audio thread.
+// prepare_audio only records the format, commit_format then commits the graph for it. Until a schedule for
+// the format of the processed blocks has been committed, process_audio outputs silence.
+// Scratch buffers are reused once the ports that used them have been read for the last time, so
+// long chains of nodes only need a few buffers. The audio thread only runs the committed schedule, it doesn't
+// allocate or lock.
+class MRP_DSPGraph : public MRP_AudioDSP
+{
+public:
+	// GUI thread. Returns the id of the node.
+	int add_node(std::shared_ptr<MRP_DSPNode> node);
+	void remove_node(int id);
+	// GUI thread. An input can have one connection, an output can be connected to any number of inputs.
+	// Returns false if the nodes or ports don't exist or the port types don't match.
+	bool connect(int srcnode, int srcport, int destnode, int destport);
+	void disconnect(int destnode, int destport);
+	// GUI thread. Sets the audio output port that is the output of the graph.
+	bool set_output(int node, int port);
+	// GUI thread, or the thread that prepares the graph. Publishes the edited graph for the prepared format,
+	// or the format set with set_format before the graph is prepared. Returns false if the graph has a cycle,
+	// in which case the previously committed graph remains in use.
+	// The nodes are prepared again when the format changes, which must not happen while the audio thread
+	// is processing the graph. MRP_PCMSource prepares a new graph for a new format instead.
+	bool commit();
+	int get_num_scratch_buffers() const { return m_num_scratch_buffers; }
+	void set_format(int nch, double sr, double len)
+	{
+		m_num_channels = nch;
+		m_samplerate = sr;
+		m_length = len;
+	}
+
+	bool is_prepared() override { return m_is_prepared; }
+	void prepare_audio(int numchans, double sr, int expected_max_bufsize) override;
+	void commit_format() override { commit(); }
+	void process_audio(double* buf, int nch, double sr, int nframes) override;
+	void release_audio() override;
+	void seek(double seconds) override;
+	int get_num_channels() override { return m_num_channels; }
+	double get_sample_rate() override { return m_samplerate; }
+	double get_length() override { return m_length; }
+private:
+	struct connection
+	{
+		int m_node = -1;
+		int m_port = -1;
+	};
+	struct node_entry
+	{
+		std::shared_ptr<MRP_DSPNode> m_node;
+		// Source of each input
+		std::vector<connection> m_inputs;
+		// Format the node was prepared with, 0 channels if it hasn't been prepared
+		int m_prepared_nch = 0;
+		double m_prepared_sr = 0.0;
+		int m_prepared_maxframes = 0;
+	};
+	std::vector<node_entry> m_nodes;
+	connection m_output;
+	// Compiled graph used by the audio thread
+	struct schedule
+	{
+		struct step
+		{
+			MRP_DSPNode* m_node = nullptr;
+			int m_first_input = 0;
+			int m_first_output = 0;
+		};
+		std::vector<step> m_steps;
+		// Keeps the nodes alive while the schedule is in use
+		std::vector<std::shared_ptr<MRP_DSPNode>> m_nodes;
+		// Buffer pointers of the ports of the steps, the inputs and outputs of each step are consecutive
+		std::vector<double*> m_ports;
+		std::vector<std::vector<double>> m_buffers;
+		std::vector<double> m_silence;
+		double* m_output = nullptr;
+		int m_nch = 0;
+		double m_sr = 0.0;
+		int m_maxframes = 0;
+	};
+	published_object<schedule> m_schedule;
+	int m_num_scratch_buffers = 0;
+	// Format recorded by prepare_audio for commit
+	std::atomic<bool> m_is_prepared{ false };
+	int m_prepared_nch = 0;
+	double m_prepared_sr = 0.0;
+	int m_prepared_bufsize = 0;
+	int m_num_channels = 2;
+	double m_samplerate = 44100.0;
+	double m_length = 3.0;
+	bool node_exists(int id) const;
+};
+
+// Sine oscillator with an audio output
+class MRP_SineNode : public MRP_DSPNode
+{
+public:
+	MRP_SineNode(double hz) : m_hz(hz) {}
+	int get_num_inputs() override { return 0; }
+	int get_num_outputs() override { return 1; }
+	void seek(double seconds) override { m_pos = seconds; }
+	void process(const double* const* inputs, double* const* outputs, int nch, double sr, int nframes) override;
+private:
+	double m_hz = 440.0;
+	double m_pos = 0.0;
+};
+
+// Outputs the values of a breakpoint envelope as a control signal
+class MRP_EnvelopeNode : public MRP_DSPNode
+{
+public:
+	MRP_EnvelopeNode(const breakpoint_envelope& env) : m_env(env) {}
+	int get_num_inputs() override { return 0; }
+	int get_num_outputs() override { return 1; }
+	MRP_PortType get_output_type(int index) override { return MRP_PortType::Control; }
+	void seek(double seconds) override { m_pos = seconds; }
+	void process(const double* const* inputs, double* const* outputs, int nch, double sr, int nframes) override;
+private:
+	breakpoint_envelope m_env;
+	double m_pos = 0.0;
+};
+
+// Multiplies the audio input with the control input
+class MRP_GainNode : public MRP_DSPNode
+{
+public:
+	int get_num_inputs() override { return 2; }
+	int get_num_outputs() override { return 1; }
+	MRP_PortType get_input_type(int index) override { return index == 1 ? MRP_PortType::Control : MRP_PortType::Audio; }
+	void process(const double* const* inputs, double* const* outputs, int nch, double sr, int nframes) override;
+};
+
+// Sine with an envelope controlled gain
+std::shared_ptr<MRP_DSPGraph> make_test_dsp_graph(double hz = 440.0);
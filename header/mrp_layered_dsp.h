@@ -0,0 +1,55 @@
+#pragma once
+
+#include "mrp_pcm_source.h"
+#include "realtime_worker_pool.h"
+#include <vector>
+#include <memory>
+
+// Sums the outputs of several independent dsp objects, rendering them concurrently on a realtime_worker_pool.
+// If a block takes more than the deadline fraction of its duration to render in parallel, for example
+// because the worker threads are kept from running by other work, the following blocks are rendered
+// serially in the audio thread and parallel rendering is retried later.
+// The layers can't be changed after construction, set a new MRP_LayeredDSP into the MRP_PCMSource instead.
+class MRP_LayeredDSP : public MRP_AudioDSP
+{
+public:
+	// Call from the main thread
+	MRP_LayeredDSP(std::vector<std::shared_ptr<MRP_AudioDSP>> layers,
+		std::shared_ptr<realtime_worker_pool> pool = get_shared_realtime_worker_pool());
+	void set_gain(double gain) { m_gain = gain; }
+	void set_deadline_fraction(double fraction) { m_deadline_fraction = fraction; }
+	int get_num_layers() const { return (int)m_layers.size(); }
+	// Number of blocks that were rendered serially because parallel rendering missed the deadline
+	int get_num_serial_blocks() const { return m_num_serial_blocks; }
+
+	bool is_prepared() override { return m_is_prepared; }
+	void prepare_audio(int numchans, double sr, int expected_max_bufsize) override;
+	void commit_format() override;
+	void process_audio(double* buf, int nch, double sr, int nframes) override;
+	void release_audio() override;
+	void seek(double seconds) override;
+	int get_num_channels() override;
+	double get_sample_rate() override;
+	double get_length() override;
+	uint64_t get_state_hash() override;
+private:
+	struct layer
+	{
+		std::shared_ptr<MRP_AudioDSP> m_dsp;
+		std::vector<double> m_buffer;
+	};
+	std::vector<layer> m_layers;
+	std::shared_ptr<realtime_worker_pool> m_pool;
+	bool m_is_prepared = false;
+	int m_nch = 0;
+	int m_maxframes = 0;
+	double m_gain = 1.0;
+	double m_deadline_fraction = 0.5;
+	// Blocks left to render serially after a missed deadline
+	int m_serial_countdown = 0;
+	std::atomic<int> m_num_serial_blocks{ 0 };
+	// Parameters of the block being rendered, for the job function
+	double m_block_sr = 0.0;
+	int m_block_frames = 0;
+	static void render_layer(void* context, int index);
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "mrp_pcm_source.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Single cycle waveform stored at several bandwidths, so that oscillators at any frequency can read
+// a table that doesn't contain harmonics above the Nyquist frequency.
+// Level 0 has max_harmonics harmonics, each following level half of the previous one.
+class band_limited_wavetable
+{
+public:
+	static const int table_bits = 11;
+	static const int table_size = 1 << table_bits;
+	// Keeps the highest harmonic of a table at 4 or more samples per cycle, so that linear interpolation stays accurate
+	static const int max_harmonics = table_size / 4;
+	static const int num_levels = 10;
+	// harmonic_amplitudes[0] is the amplitude of the fundamental. The harmonics are sine phase.
+	band_limited_wavetable(const std::vector<double>& harmonic_amplitudes);
+	// Table to use for an oscillator at frequency hz / sr cycles per sample
+	int get_level(double cycles_per_sample) const;
+	// table_size + 1 values, the last one repeats the first one for the interpolation
+	const float* get_table(int level) const { return &m_tables[level*(table_size + 1)]; }
+	uint64_t get_hash() const { return m_hash; }
+	static std::shared_ptr<band_limited_wavetable> make_sine();
+	static std::shared_ptr<band_limited_wavetable> make_sawtooth();
+	static std::shared_ptr<band_limited_wavetable> make_square();
+private:
+	std::vector<float> m_tables;
+	uint64_t m_hash = 0;
+};
+
+// Bank of wavetable oscillators, meant for additive synthesis and other uses that need thousands of partials.
+// The voice state is kept in arrays per field, padded to groups of 4 voices that are rendered together with SSE2
+// (or with plain loops the compiler can vectorize on other processors). The phases are 32 bit fixed point so
+// they wrap around without branches and seeking can compute them exactly.
+// The gains are updated every sub_block_size frames from the voice envelopes and ramped linearly in between.
+// Voices that use the same envelope object share its evaluation.
+// The voices can't be changed after the object is set into a source.
+class MRP_OscillatorBankDSP : public MRP_AudioDSP
+{
+public:
+	static const int sub_block_size = 64;
+	MRP_OscillatorBankDSP(std::shared_ptr<band_limited_wavetable> table, double length = 3.0);
+	// pan is from -1.0 (left) to 1.0 (right). The envelope, if any, multiplies the gain.
+	int add_voice(double hz, double gain, double pan, std::shared_ptr<const breakpoint_envelope> env = nullptr);
+	int get_num_voices() const { return m_num_voices; }
+
+	bool is_prepared() override { return m_is_prepared; }
+	void prepare_audio(int numchans, double sr, int expected_max_bufsize) override;
+	void process_audio(double* buf, int nch, double sr, int nframes) override;
+	void release_audio() override { m_is_prepared = false; }
+	void seek(double seconds) override;
+	double get_length() override { return m_length; }
+	uint64_t get_state_hash() override;
+private:
+	std::shared_ptr<band_limited_wavetable> m_table;
+	double m_length = 3.0;
+	bool m_is_prepared = false;
+	double m_sr = 0.0;
+	int m_num_voices = 0;
+	// Frame position for the envelopes and phases
+	int64_t m_position = 0;
+	// Voice parameters
+	std::vector<double> m_hz;
+	std::vector<double> m_amp;
+	std::vector<double> m_pan;
+	std::vector<int> m_env_index;
+	std::vector<std::shared_ptr<const breakpoint_envelope>> m_envelopes;
+	// Voice state, with the sizes rounded up to multiples of 4. The padding voices have zero gains.
+	std::vector<uint32_t> m_phase;
+	std::vector<uint32_t> m_start_phase;
+	std::vector<uint32_t> m_increment;
+	std::vector<const float*> m_tables;
+	// Gain and pan combined, zero for voices above the Nyquist frequency
+	std::vector<float> m_amp_left;
+	std::vector<float> m_amp_right;
+	std::vector<float> m_gain_left;
+	std::vector<float> m_gain_right;
+	std::vector<float> m_delta_left;
+	std::vector<float> m_delta_right;
+	std::vector<double> m_env_values;
+	// Sums of the voice lanes, 4 values per frame
+	std::vector<float> m_mix_left;
+	std::vector<float> m_mix_right;
+	void update_gains(int nframes);
+};
+
+// Bell-like additive sound with numpartials inharmonic partials, for testing and benchmarking
+std::shared_ptr<MRP_OscillatorBankDSP> make_test_oscillator_bank(int numpartials);
+
+// Renders oscillator banks of increasing sizes and shows in the console how many voices one core can render in real time
+void benchmark_oscillator_bank();
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "mrp_pcm_source.h"
+#include <vector>
+#include <memory>
+
+// 2x up and downsampling of one channel with a linear phase half-band FIR filter.
+// Every other coefficient of a half-band filter is zero except the center one, so each output
+// sample only needs the nonzero half of the taps (the polyphase branch) and the other branch is a plain delay.
+class halfband_resampler
+{
+public:
+	// Number of coefficients in the FIR branch
+	static const int branch_taps = 24;
+	// Delay of the filter in samples at the higher rate
+	static const int latency = branch_taps - 1;
+	halfband_resampler();
+	void prepare(int maxframes);
+	void reset();
+	// n samples in, 2n samples out. n must not be greater than the maxframes passed to prepare.
+	void upsample(const double* in, double* out, int n);
+	// 2n samples in, n samples out
+	void downsample(const double* in, double* out, int n);
+private:
+	// FIR branch coefficients in reverse order, so that they can be used in dot products with the input
+	double m_coeffs[branch_taps];
+	// Input history followed by the new input
+	std::vector<double> m_upbuf;
+	// Even and odd samples of the downsampler input, also following their histories
+	std::vector<double> m_even;
+	std::vector<double> m_odd;
+};
+
+// Runs a dsp object at 2, 4 or 8 times the samplerate, so that nonlinear processing aliases less.
+// The buffer contents are upsampled for the processed object and its output is downsampled with cascaded half-band
+// stages. Everything is allocated in prepare_audio.
+// The filters delay the buffer contents by get_latency_frames(). The audio generated by the processed object
+// only goes through the downsampling filters and is delayed by get_generated_latency_frames(), which is compensated
+// by seeking the processed object ahead by that much.
+class MRP_OversamplingDSP : public MRP_AudioDSP
+{
+public:
+	MRP_OversamplingDSP(std::shared_ptr<MRP_AudioDSP> dsp, int factor);
+	// Latencies at the samplerate of the wrapper
+	double get_latency_frames() const;
+	double get_generated_latency_frames() const;
+	int get_factor() const { return 1 << m_num_stages; }
+
+	bool is_prepared() override { return m_dsp->is_prepared(); }
+	void prepare_audio(int numchans, double sr, int expected_max_bufsize) override;
+	void commit_format() override { m_dsp->commit_format(); }
+	void process_audio(double* buf, int nch, double sr, int nframes) override;
+	void release_audio() override { m_dsp->release_audio(); }
+	void seek(double seconds) override;
+	int get_num_channels() override { return m_dsp->get_num_channels(); }
+	double get_sample_rate() override { return m_dsp->get_sample_rate(); }
+	double get_length() override { return m_dsp->get_length(); }
+	uint64_t get_state_hash() override;
+private:
+	std::shared_ptr<MRP_AudioDSP> m_dsp;
+	int m_num_stages = 1;
+	int m_nch = 0;
+	int m_maxframes = 0;
+	double m_sr = 0.0;
+	// Up and down stages of each channel
+	std::vector<std::vector<halfband_resampler>> m_up;
+	std::vector<std::vector<halfband_resampler>> m_down;
+	// Interleaved audio at the oversampled rate
+	std::vector<double> m_oversampled;
+	// Single channel work buffers for the stages
+	std::vector<double> m_work0;
+	std::vector<double> m_work1;
+};
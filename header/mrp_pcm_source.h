@@ -3,8 +3,13 @@
 #include "WDL/WDL/lice/lice.h"
 #include "reaper_plugin/reaper_plugin_functions.h"
 #include "envelope_model.h"
+#include "envelope_change_tracker.h"
+#include "utilfuncs.h"
+#include "callback_timing.h"
 #include <memory>
-#include <mutex>
+#include <functional>
+#include <atomic>
+#include <vector>
 #include <cmath>
 /*
 Reaper provides a way for extension plugins to play sound independent of Reaper's tracks.
@@ -21,8 +26,11 @@ class MRP_AudioDSP
 public:
 	virtual ~MRP_AudioDSP() {}
 	virtual bool is_prepared() { return false; }
-	// Called before calls to process_audio begin
+	// Called outside the audio thread before calls to process_audio begin, so it may allocate
 	virtual void prepare_audio(int numchans, double sr, int expected_max_bufsize) {}
+	// Called after prepare_audio, in the same thread. Objects that publish state to the audio thread for the
+	// prepared format, like MRP_DSPGraph, do it here, and prepare_audio only records the format.
+	virtual void commit_format() {}
 	// Called when new audio is needed.
 	// The usual realtime audio coding rules apply here : don't do anything too time consuming, try to avoid
 	// doing anything that can take a "random" amount of time, like allocating memory or
@@ -31,11 +39,103 @@ public:
 	// Called when audio is stopped and more call calls to process_audio
 	virtual void release_audio() {}
 	virtual void seek(double seconds) {}
+	// Format of the produced audio, reported to Reaper by MRP_PCMSource. 
+	// Called from the GUI thread when the object is set into the source.
+	virtual int get_num_channels() { return 2; }
+	virtual double get_sample_rate() { return 44100.0; }
+	// Length in seconds
+	virtual double get_length() { return 3.0; }
+	// Hash of everything that affects the produced audio, used to find previously built peaks.
+	// 0 means the audio can't be identified and its peaks are not saved.
+	virtual uint64_t get_state_hash() { return 0; }
+	// Block size process_audio must always be called with, for example for FFT based processing. 0 means any size.
+	// MRP_PCMSource adapts Reaper's block sizes to it with MRP_FixedBlockSizeAdapter.
+	virtual int get_preferred_block_size() { return 0; }
+};
+
+// Creates new independent instances of a dsp object. Called from whatever thread Reaper duplicates the
+// source in, so it should only capture data that is safe to access from any thread.
+using MRP_AudioDSPFactory = std::function<std::shared_ptr<MRP_AudioDSP>(void)>;
+
+// Calls process_audio of another dsp object with blocks of its preferred size.
+// As the dsp objects produce audio without input, whole blocks can be rendered ahead and
+// the extra audio kept for the following calls, so this doesn't add latency. Seeking drops
+// the audio rendered ahead and seeks the processed object to the exact seek position.
+class MRP_FixedBlockSizeAdapter : public MRP_AudioDSP
+{
+public:
+	MRP_FixedBlockSizeAdapter(std::shared_ptr<MRP_AudioDSP> dsp) : m_dsp(dsp) 
+	{
+		m_blocksize = m_dsp->get_preferred_block_size();
+	}
+	std::shared_ptr<MRP_AudioDSP> get_processed_dsp() { return m_dsp; }
+	bool is_prepared() override { return m_dsp->is_prepared(); }
+	void prepare_audio(int numchans, double sr, int expected_max_bufsize) override
+	{
+		m_block.resize(m_blocksize*numchans);
+		m_nch = numchans;
+		m_readpos = 0;
+		m_available = 0;
+		m_dsp->prepare_audio(numchans, sr, m_blocksize);
+	}
+	void commit_format() override { m_dsp->commit_format(); }
+	void process_audio(double* buf, int nch, double sr, int nframes) override
+	{
+		if (nch != m_nch)
+			return;
+		int done = 0;
+		while (done < nframes)
+		{
+			if (m_available == 0)
+			{
+				for (auto& e : m_block)
+					e = 0.0;
+				m_dsp->process_audio(m_block.data(), nch, sr, m_blocksize);
+				m_readpos = 0;
+				m_available = m_blocksize;
+			}
+			int n = std::min(m_available, nframes - done);
+			const double* src = &m_block[m_readpos*nch];
+			double* dest = &buf[done*nch];
+			for (int i = 0; i < n*nch; ++i)
+				dest[i] = src[i];
+			m_readpos += n;
+			m_available -= n;
+			done += n;
+		}
+	}
+	void release_audio() override { m_dsp->release_audio(); }
+	void seek(double seconds) override
+	{
+		m_available = 0;
+		m_dsp->seek(seconds);
+	}
+	int get_num_channels() override { return m_dsp->get_num_channels(); }
+	double get_sample_rate() override { return m_dsp->get_sample_rate(); }
+	double get_length() override { return m_dsp->get_length(); }
+	uint64_t get_state_hash() override { return m_dsp->get_state_hash(); }
+private:
+	std::shared_ptr<MRP_AudioDSP> m_dsp;
+	int m_blocksize = 0;
+	int m_nch = 0;
+	// Audio rendered ahead
+	std::vector<double> m_block;
+	int m_readpos = 0;
+	int m_available = 0;
 };
 
 class MyTestAudioDSP : public MRP_AudioDSP
 {
 public:
+	// The envelope is published before the object is set into a source, so the audio thread never publishes
+	MyTestAudioDSP()
+	{
+		breakpoint_envelope env;
+		env.add_point({ 0.0,1.0 }, false);
+		env.add_point({ 2.0,0.0 }, false);
+		env.sort_points();
+		set_envelope(env);
+	}
 	~MyTestAudioDSP()
 	{
 		//OutputDebugString("MyTestAudioDSP dtor");
@@ -45,7 +145,21 @@ public:
 	int m_nch = 0;
 	double m_sr = 0;
 	bool is_prepared() { return m_is_prepared; }
-	breakpoint_envelope m_env;
+	// Call from the GUI thread. The audio thread picks up the new envelope at its next processing block.
+	void set_envelope(const breakpoint_envelope& env)
+	{
+		m_env.publish(std::make_shared<const breakpoint_envelope>(env));
+	}
+	published_object<const breakpoint_envelope> m_env;
+	uint64_t get_state_hash()
+	{
+		uint64_t h = WDL_FNV64_IV;
+		h = WDL_FNV64(h, (const unsigned char*)"MyTestAudioDSP", 14);
+		auto env = m_env.latest();
+		if (env != nullptr)
+			h = hash_envelope_points(*env, h);
+		return h;
+	}
 	void seek(double seconds)
 	{
 		m_osc_phase = 0.0;
@@ -54,10 +168,6 @@ public:
 	void prepare_audio(int numchans, double sr, int expected)
 	{
 		//OutputDebugString("MRP prepare_audio");
-		m_env.remove_all_points();
-		m_env.add_point({ 0.0,1.0 }, false);
-		m_env.add_point({ 2.0,0.0 }, false);
-		m_env.sort_points();
 		m_osc_phase = 0;
 		m_nch = numchans;
 		m_sr = sr;
@@ -65,10 +175,13 @@ public:
 	}
 	void process_audio(double* buf, int nch, double sr, int nframes)
 	{
+		const breakpoint_envelope* env = m_env.acquire();
 		for (int i = 0; i < nframes; ++i)
 		{
 			double sample = sin(2 * 3.141592653 / sr *440.0*m_osc_phase);
-			double gain = m_env.interpolate(m_osc_phase / sr);
+			double gain = 1.0;
+			if (env != nullptr)
+				gain = env->interpolate(m_osc_phase / sr);
 			for (int j = 0; j < m_nch; ++j)
 				buf[i*m_nch + j] = sample*0.2*gain;
 			m_osc_phase += 1.0;
@@ -81,30 +194,51 @@ public:
 	}
 };
 
+class MRP_PeakBuilder;
+
 class MRP_PCMSource : public PCM_source
 {
 public:
-	MRP_PCMSource(std::shared_ptr<MRP_AudioDSP> dsp) : m_dsp(dsp) {}
-	~MRP_PCMSource()
+	// The owner of the dsp object prepares and releases it
+	MRP_PCMSource(std::shared_ptr<MRP_AudioDSP> dsp)
 	{
-		//OutputDebugString("MRP_PCMSource dtor");
+		update_format(dsp.get());
+		m_dsp.publish(std::make_shared<prepared_dsp>(adapt_block_size(dsp)));
 	}
-	
+	// The source creates and owns its dsp object. Duplicate() creates a new source with a new dsp object,
+	// which allows Reaper to play and render the source like file based sources, for example 
+	// in items on tracks and in parallel render threads.
+	// The dsp object is prepared outside the audio thread, first with the format it reports itself, or in a
+	// duplicate with the format of the duplicated source. When Reaper requests another format, the audio
+	// thread outputs silence until the main thread has prepared a new dsp object for that format, see
+	// start_or_stop_pcm_source_preparation. The dsp object stays prepared when playback stops.
+	MRP_PCMSource(MRP_AudioDSPFactory factory);
+	~MRP_PCMSource();
+	// Call from the GUI thread, not for factory created sources. The audio thread switches to the new dsp
+	// object at its next GetSamples call without locking. The old object is never destroyed in the audio
+	// thread, it is released by a later set_dsp or collect_garbage call, or when the source is destroyed.
 	void set_dsp(std::shared_ptr<MRP_AudioDSP> dsp)
 	{
-		// take pointer copy so that if we are currently the only owner, the switch doesn't block
-		// while the old object is being destroyed
-		auto old = m_dsp;
-		m_mutex.lock();
-		m_dsp = dsp;
-		m_mutex.unlock();
-		// if old was the only owner, it is now destroyed at end of scope, outside the mutex lock
+		update_format(dsp.get());
+		m_dsp.publish(std::make_shared<prepared_dsp>(adapt_block_size(dsp)));
+	}
+	// Call from the GUI thread. Releases the dsp object the audio thread has switched away from.
+	// Calling this isn't required but otherwise the old object is kept alive until the next set_dsp call.
+	void collect_garbage()
+	{
+		m_dsp.collect_retired();
 	}
-	
+	// Call from the GUI thread. Returns the most recently set dsp object, which is a MRP_FixedBlockSizeAdapter
+	// if the set object has a preferred block size.
 	std::shared_ptr<MRP_AudioDSP> get_dsp()
 	{
-		return m_dsp;
+		auto latest = m_dsp.latest();
+		if (latest != nullptr)
+			return latest->m_dsp;
+		return nullptr;
 	}
+	// Timings of the GetSamples calls of this source and its duplicates
+	std::shared_ptr<callback_timing_ring> get_timing() { return m_timing; }
 
 	// Inherited via PCM_source
 	PCM_source * Duplicate() override;
@@ -140,11 +274,64 @@ public:
 	void PeaksBuild_Finish() override;
 
 	int Extended(int call, void *parm1, void *parm2, void *parm3) override;
+	// Main thread. Prepares a new dsp object if the audio thread has requested a format the current one
+	// isn't prepared for.
+	void prepare_requested_format();
 private:
-	std::shared_ptr<MRP_AudioDSP> m_dsp;
-	// mutex guards changing the dsp object while playing back
-	std::mutex m_mutex;
-	double m_lastpos = 0.0;
+	struct prepared_dsp
+	{
+		prepared_dsp(std::shared_ptr<MRP_AudioDSP> dsp) : m_dsp(dsp) {}
+		std::shared_ptr<MRP_AudioDSP> m_dsp;
+		// Format a factory created dsp object was prepared with, 0 channels if its owner prepares it
+		int m_nch = 0;
+		double m_sr = 0.0;
+		int m_bufsize = 0;
+	};
+	published_object<prepared_dsp> m_dsp;
+	MRP_AudioDSPFactory m_dsp_factory;
+	// Only factory created sources have peaks, shared with the duplicates of the source
+	std::shared_ptr<MRP_PeakBuilder> m_peaks;
+	std::shared_ptr<callback_timing_ring> m_timing = std::make_shared<callback_timing_ring>();
+	// Format of the current dsp object, can be read from any thread
+	std::atomic<int> m_num_channels{ 2 };
+	std::atomic<double> m_samplerate{ 44100.0 };
+	std::atomic<double> m_length{ 3.0 };
+	// Set by the end of playback notification, the audio thread releases the dsp object
+	std::atomic<bool> m_release_pending{ false };
+	// Format requested by the audio thread for a factory created source, written before m_format_requested
+	std::atomic<int> m_requested_nch{ 0 };
+	std::atomic<double> m_requested_sr{ 0.0 };
+	std::atomic<bool> m_format_requested{ false };
+	// The dsp object the audio thread processed last, a new one is seeked before it's processed
+	MRP_AudioDSP* m_processed_dsp = nullptr;
+	void update_format(MRP_AudioDSP* dsp);
+	static std::shared_ptr<MRP_AudioDSP> adapt_block_size(std::shared_ptr<MRP_AudioDSP> dsp)
+	{
+		if (dsp != nullptr && dsp->get_preferred_block_size() > 0)
+			return std::make_shared<MRP_FixedBlockSizeAdapter>(dsp);
+		return dsp;
+	}
+	// Format the dsp object of a factory created source was last prepared with, for Duplicate
+	std::atomic<int> m_prepared_nch{ 0 };
+	std::atomic<double> m_prepared_sr{ 0.0 };
+	// nch 0 : the format the dsp object reports
+	MRP_PCMSource(MRP_AudioDSPFactory factory, int nch, double sr);
+	// Not called in the audio thread
+	std::shared_ptr<prepared_dsp> prepare_dsp(std::shared_ptr<MRP_AudioDSP> dsp, int nch, double sr, int bufsize);
+	playback_position_tracker m_position;
 };
 
-void test_pcm_source(int op);
\ No newline at end of file
+// Starts or stops the main thread timer that prepares the dsp objects of the factory created sources
+// for the formats their audio threads request
+void start_or_stop_pcm_source_preparation(bool stop);
+
+void test_pcm_source(int op);
+
+// Inserts an item with a factory based MRP_PCMSource into the first selected track at the edit cursor
+void insert_generated_source_item(MRP_AudioDSPFactory factory);
+
+// The source played by test_pcm_source, nullptr if it hasn't been played yet
+MRP_PCMSource* get_test_pcm_source();
+
+// The MRP_PCMSource of a take, nullptr if the take has some other kind of source
+MRP_PCMSource* get_take_mrp_pcm_source(MediaItem_Take* take);
\ No newline at end of file
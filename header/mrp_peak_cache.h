@@ -0,0 +1,82 @@
+#pragma once
+
+#include "mrp_pcm_source.h"
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Multi resolution min/max peaks of audio, built incrementally as the audio is added.
+// Level 0 has one min/max pair per channel for every 16 frames and each following level
+// combines 16 peaks of the previous level.
+class MRP_PeakCache
+{
+public:
+	static const int num_levels = 4;
+	void init(int nch, double sr, int64_t numframes);
+	void clear();
+	// Interleaved audio with the channel count given in init
+	void add_samples(const double* buf, int nframes);
+	int64_t get_num_frames() const { return m_num_frames; }
+	int64_t get_num_frames_done() const { return m_frames_done; }
+	bool is_complete() const { return m_nch > 0 && m_frames_done >= m_num_frames; }
+	// Answers from the level closest to the requested peak rate. Peaks that haven't been built yet are not output.
+	void get_peaks(PCM_source_peaktransfer_t* block) const;
+	bool save_to_file(const std::string& fn, uint64_t hash) const;
+	// Fails if the file is not complete or was written for another hash
+	bool load_from_file(const std::string& fn, uint64_t hash);
+private:
+	struct level
+	{
+		int64_t m_frames_per_peak = 0;
+		// min and max of each channel for each peak
+		std::vector<float> m_minmax;
+		// Peak being accumulated
+		std::vector<float> m_acc;
+		int m_acc_count = 0;
+		int64_t num_peaks(int nch) const { return (int64_t)m_minmax.size() / (nch * 2); }
+	};
+	level m_levels[num_levels];
+	int m_nch = 0;
+	double m_sr = 0.0;
+	int64_t m_num_frames = 0;
+	int64_t m_frames_done = 0;
+	void reset_accumulator(level& lev);
+	void accumulate(int levindex, const float* minmax);
+	void flush(int levindex);
+};
+
+// Builds the peaks of a factory created dsp object in a background thread. The peaks are saved into
+// a file in the project directory, named after the dsp state hash, so that they are not rendered again
+// later. Dsp objects that return a hash of 0 don't get their peaks saved.
+class MRP_PeakBuilder
+{
+public:
+	MRP_PeakBuilder(MRP_AudioDSPFactory factory) : m_factory(factory) {}
+	~MRP_PeakBuilder();
+	// Main thread. Returns true if building was started, false if the peaks are already available
+	// or are being built.
+	bool start();
+	bool is_building() const { return m_building; }
+	// Main thread. Waits for the build to progress for at most timeoutms milliseconds, returns true if still building.
+	bool wait(int timeoutms);
+	// Main thread. Waits for the building thread to end.
+	void finish();
+	// Main thread. Stops building and removes the peaks.
+	void clear(bool deletefile);
+	void get_peaks(PCM_source_peaktransfer_t* block);
+	double get_progress();
+private:
+	MRP_AudioDSPFactory m_factory;
+	// Guards the cache between the building thread and get_peaks
+	std::mutex m_mutex;
+	MRP_PeakCache m_cache;
+	std::thread m_thread;
+	std::atomic<bool> m_building{ false };
+	std::atomic<bool> m_cancel{ false };
+	std::string m_filename;
+	uint64_t m_hash = 0;
+	void build(std::shared_ptr<MRP_AudioDSP> dsp);
+};
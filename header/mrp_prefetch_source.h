@@ -0,0 +1,79 @@
+#pragma once
+
+#include "WDL/WDL/lice/lice.h"
+#include "reaper_plugin/reaper_plugin_functions.h"
+#include "utilfuncs.h"
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+// Plays another PCM_source through a ring buffer that a reader thread keeps filled ahead of the play position,
+// so that slow reads, like decoding compressed files on network storage, don't happen in the audio thread.
+// GetSamples only copies from the ring. When it detects a seek, it asks the reader thread to restart
+// from the new position and outputs silence until the reader has caught up.
+class MRP_PrefetchSource : public PCM_source
+{
+public:
+	// Takes ownership of the source. ringseconds is how far ahead of the play position the reader thread reads.
+	MRP_PrefetchSource(PCM_source* src, double ringseconds = 4.0);
+	~MRP_PrefetchSource();
+	PCM_source* get_source() { return m_src.get(); }
+	// Number of GetSamples calls that didn't get all their audio from the ring
+	int get_num_underruns() const { return m_num_underruns; }
+
+	PCM_source * Duplicate() override;
+	bool IsAvailable() override { return m_src->IsAvailable(); }
+	const char * GetType() override { return "MRP_PREFETCHSOURCE"; }
+	bool SetFileName(const char * newfn) override { return false; }
+	int GetNumChannels() override { return m_src_nch; }
+	double GetSampleRate() override { return m_src->GetSampleRate(); }
+	double GetLength() override { return m_src->GetLength(); }
+	int PropertiesWindow(HWND hwndParent) override { return 0; }
+	void GetSamples(PCM_source_transfer_t * block) override;
+	void GetPeakInfo(PCM_source_peaktransfer_t * block) override { m_src->GetPeakInfo(block); }
+	void SaveState(ProjectStateContext * ctx) override { m_src->SaveState(ctx); }
+	int LoadState(const char * firstline, ProjectStateContext * ctx) override { return -1; }
+	void Peaks_Clear(bool deleteFile) override { m_src->Peaks_Clear(deleteFile); }
+	int PeaksBuild_Begin() override { return m_src->PeaksBuild_Begin(); }
+	int PeaksBuild_Run() override { return m_src->PeaksBuild_Run(); }
+	void PeaksBuild_Finish() override { m_src->PeaksBuild_Finish(); }
+	int Extended(int call, void *parm1, void *parm2, void *parm3) override { return m_src->Extended(call, parm1, parm2, parm3); }
+private:
+	std::unique_ptr<PCM_source> m_src;
+	int m_src_nch = 0;
+	double m_ringseconds = 4.0;
+	// Ring of interleaved frames. The indices only grow, the position in the ring is the index modulo the capacity.
+	std::vector<ReaSample> m_ring;
+	int64_t m_capacity = 0;
+	std::atomic<int64_t> m_write_index{ 0 };
+	std::atomic<int64_t> m_read_index{ 0 };
+	// Seek requests from the audio thread : the source frame to start from, the samplerate and a generation number
+	std::atomic<int64_t> m_seek_frame{ 0 };
+	std::atomic<double> m_seek_samplerate{ 0.0 };
+	std::atomic<int> m_seek_generation{ 0 };
+	// The reader thread acknowledges a request by telling from which write index the new position starts
+	std::atomic<int64_t> m_ack_index{ 0 };
+	std::atomic<int> m_ack_generation{ 0 };
+	// Audio thread state
+	playback_position_tracker m_position;
+	int m_requested_generation = 0;
+	bool m_ring_ready = false;
+	// Source frame at the read index
+	int64_t m_ring_frame = 0;
+	std::atomic<int> m_num_underruns{ 0 };
+
+	std::thread m_thread;
+	std::atomic<bool> m_quit{ false };
+	std::mutex m_wake_mutex;
+	std::condition_variable m_wake_cv;
+	void reader_proc();
+};
+
+// Starts previewing the active take of the first selected item through a MRP_PrefetchSource, or stops the preview
+// if one is playing
+void toggle_prefetched_take_preview();
+void stop_prefetched_take_preview();
@@ -78,6 +78,20 @@ private:
 	PopupMenu::CheckState m_menuitem3state = PopupMenu::Checked;
 };
 
+// Shows the audio callback timings of the MRP source of the first selected item, or of the preview source
+class CallbackTimingWindow : public MRPWindow
+{
+public:
+	CallbackTimingWindow(HWND parent);
+	void resized() override;
+	void onRefreshTimer() override;
+private:
+	std::shared_ptr<CallbackTimingControl> m_timingcontrol;
+	std::shared_ptr<WinButton> m_resetbutton;
+};
+
+HWND toggle_callback_timing_window(HWND parent);
+
 void show_modal_dialog(HWND parent);
 
 HWND toggle_sliderbank_window(HWND parent);
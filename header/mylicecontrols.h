@@ -2,6 +2,8 @@
 
 #include "lice_control.h"
 #include "envelope_model.h"
+#include "reaper_envelope_writer.h"
+#include "callback_timing.h"
 
 class MRPWindow;
 
@@ -254,6 +256,8 @@ protected:
 	bool m_notify_on_point_move = true;
 };
 
+class pitch_bend_renderer;
+
 class PitchBenderEnvelopeControl : public EnvelopeControl
 {
 public:
@@ -261,21 +265,28 @@ public:
 	{
 
 	}
+	~PitchBenderEnvelopeControl();
 	bool keyPressed(const ModifierKeys& modkeys, int keycode) override;
 	void mousePressed(const MouseEvent& ev) override;
 	std::string getType() const override { return "PitchBenderEnvelopeControl"; }
 private:
 	int m_resampler_mode = -1;
+	// The render started with R, pressing R again while it runs cancels it
+	std::shared_ptr<pitch_bend_renderer> m_renderer;
 };
 
-std::string pitch_bend_selected_item(std::shared_ptr<breakpoint_envelope> pchenv,
-	std::shared_ptr<breakpoint_envelope> volenv,int mode);
-
 class EnvelopeGeneratorEnvelopeControl : public EnvelopeControl
 {
 public:
 	EnvelopeGeneratorEnvelopeControl(MRPWindow* parent);
-	
+private:
+	reaper_envelope_writer m_writer;
+	// While dragging, the Reaper envelope is only written at the rate of this timer
+	Timer m_write_timer;
+	bool m_write_pending = false;
+	// The timed writes don't add undo points, so the write at the end of the drag adds one if any of them changed something
+	bool m_written_since_undo = false;
+	void write_to_reaper_envelope(bool addundo);
 };
 
 class ZoomScrollBar : public LiceControl
@@ -323,3 +334,18 @@ private:
 	Timer m_timer;
 	LICE_CachedFont m_font;
 };
+
+// Shows the load histogram and statistics of the audio callbacks recorded into a callback_timing_ring
+class CallbackTimingControl : public LiceControl
+{
+public:
+	CallbackTimingControl(MRPWindow* parent);
+	void paint(PaintEvent& ev) override;
+	void setTimingRing(std::shared_ptr<callback_timing_ring> ring);
+	std::shared_ptr<callback_timing_ring> getTimingRing() { return m_ring; }
+	std::string getType() const override { return "CallbackTimingControl"; }
+private:
+	std::shared_ptr<callback_timing_ring> m_ring;
+	Timer m_timer;
+	LICE_CachedFont m_font;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "WDL/WDL/lice/lice.h"
+#include "reaper_plugin/reaper_plugin_functions.h"
+#include "utilfuncs.h"
+#include "envelope_model.h"
+#include "work_stealing_pool.h"
+#include "render_io_scheduler.h"
+#include "audio_buffer_pool.h"
+#include <vector>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <functional>
+
+// Renders the active takes of items through a resampler whose rate follows a pitch envelope, and applies
+// a volume envelope. Both envelopes span the take's source section with times 0..1, the pitch envelope
+// maps 0..1 to -12..12 semitones, like in PitchBenderEnvelopeControl.
+// The source positions of the output frames come from an envelope_integral_table of the playback rate, so
+// they don't drift however long the item is. The resampler takes one rate per call, so the rate is ramped in
+// steps of ramp_size frames, each with the exact average rate of its frames. The gain is computed into a
+// buffer per block.
+// The items are processed in parallel in a work_stealing_pool and the output files are written by a
+// render_io_scheduler. Like pitch_render_engine, the Reaper objects are created and destroyed in the main
+// thread, and results are inserted and callbacks called in the main thread.
+class pitch_bend_renderer : public std::enable_shared_from_this<pitch_bend_renderer>
+{
+public:
+	// The envelopes are copied, so they can be edited while the render runs.
+	// resamplermode is the Reaper resampler mode, -1 for the project default.
+	// maxinflight 0 : as many jobs as there are pool threads
+	pitch_bend_renderer(const breakpoint_envelope& pitchenv, const breakpoint_envelope& volenv, int resamplermode,
+		int maxinflight = 0, work_stealing_pool& pool = get_shared_work_stealing_pool(),
+		std::shared_ptr<render_io_scheduler> io = get_shared_render_io_scheduler());
+	~pitch_bend_renderer();
+	// Call these from the main thread before start(). Returns the job index or -1 if the item can't be rendered.
+	int add_item(MediaItem* item);
+	// Called with the job index, whether the render succeeded and the output file name
+	void set_job_callback(std::function<void(int, bool, const std::string&)> f) { m_job_callback = f; }
+	void set_completion_callback(std::function<void(pitch_bend_renderer&)> f) { m_completion_callback = f; }
+	void start();
+
+	// These can be called from any thread
+	void cancel() { m_cancel.cancel(); }
+	bool is_cancelled() const { return m_cancel.is_cancelled(); }
+	int get_num_jobs() const { return (int)m_jobs.size(); }
+	int get_num_finished() const { return m_num_finished; }
+	int get_num_failed() const { return m_num_failed; }
+	bool is_finished() const { return m_num_finished == (int)m_jobs.size(); }
+	double get_progress() const;
+	// Output frames processed per block
+	static const int block_size = 8192;
+	// Output frames processed with one resampler rate
+	static const int ramp_size = 32;
+	// Length of the output relative to the source section, from the pitch envelope
+	double get_length_ratio() const { return m_rate_table.integral(1.0); }
+private:
+	struct buffer_set
+	{
+		// Reset for each job, so after the first jobs the memory comes from the blocks of earlier ones
+		audio_arena m_arena;
+		// Source audio read ahead in large blocks and consumed by the resampler
+		ReaSample* m_source = nullptr;
+		int m_source_pos = 0;
+		int m_source_avail = 0;
+		ReaSample* m_resampled = nullptr;
+		double* m_gain = nullptr;
+		double** m_planar_pointers = nullptr;
+		bool m_in_use = false;
+	};
+	struct job
+	{
+		MediaItem* m_item = nullptr;
+		std::string m_outfn;
+		double m_src_start = 0.0;
+		double m_src_length = 0.0;
+		PCM_source* m_src = nullptr;
+		REAPER_Resample_Interface* m_resampler = nullptr;
+		PCM_sink* m_sink = nullptr;
+		render_io_scheduler::stream* m_stream = nullptr;
+		buffer_set* m_buffers = nullptr;
+		int m_nch = 0;
+		double m_sr = 0.0;
+		// Next source frame to read, relative to the start of the section
+		int64_t m_read_pos = 0;
+		std::atomic<double> m_progress{ 0.0 };
+		bool m_ok = false;
+	};
+	breakpoint_envelope m_pitch_env;
+	breakpoint_envelope m_vol_env;
+	// Integral of 1/playback rate over the normalized source section, so it maps source positions to output times
+	envelope_integral_table m_rate_table;
+	int m_resampler_mode = -1;
+	std::vector<std::unique_ptr<job>> m_jobs;
+	std::vector<std::unique_ptr<buffer_set>> m_buffers;
+	work_stealing_pool& m_pool;
+	std::shared_ptr<render_io_scheduler> m_io;
+	int m_max_in_flight = 1;
+	int m_next_job = 0;
+	int m_in_flight = 0;
+	bool m_started = false;
+	bool m_waiting_for_stream = false;
+	std::atomic<int> m_num_finished{ 0 };
+	std::atomic<int> m_num_failed{ 0 };
+	cancellation_token m_cancel;
+	std::function<void(int, bool, const std::string&)> m_job_callback;
+	std::function<void(pitch_bend_renderer&)> m_completion_callback;
+	std::shared_ptr<pitch_bend_renderer> m_self;
+	// Main thread
+	void launch_jobs();
+	bool open_job(job& j);
+	void finish_job(int index);
+	void release_job(job& j);
+	void insert_result(job& j);
+	// Worker thread
+	bool render_job(job& j);
+	void read_source(job& j, int frames, ReaSample* dest);
+};
+
+// Adds all selected items to a new renderer, which isn't started yet so that the callbacks can be set first.
+// Returns an empty pointer and sets err if none of the items can be rendered.
+std::shared_ptr<pitch_bend_renderer> pitch_bend_selected_items(const breakpoint_envelope& pitchenv,
+	const breakpoint_envelope& volenv, int resamplermode, std::string& err);
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "WDL/WDL/lice/lice.h"
+#include "reaper_plugin/reaper_plugin_functions.h"
+#include "utilfuncs.h"
+#include "work_stealing_pool.h"
+#include "render_io_scheduler.h"
+#include "audio_buffer_pool.h"
+#include <vector>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <functional>
+
+struct pitch_render_params
+{
+	// Speed of the result relative to the original, 0.5 makes it twice as long
+	double tempo = 1.0;
+	// Pitch shift as a frequency ratio
+	double pitch = 1.0;
+	// IReaperPitchShift quality, (mode<<16)+submode or -1 for the project default
+	int quality = -1;
+	// Add the result as a new active take of the item. Otherwise only the file is written.
+	bool insert_take = true;
+};
+
+// Renders the active takes of items through IReaperPitchShift in the background.
+// The Reaper objects of a job (source copy, pitch shifter, sink) are created and destroyed in the main
+// thread, the audio is processed in a work_stealing_pool and written by a render_io_scheduler. At most a limited
+// number of jobs is in flight at once, which bounds the memory, and the jobs reuse the buffers of earlier jobs.
+// Each job in flight has its file open, so the scheduler's open sink limit also limits the jobs in flight.
+// The scheduler is shared by default, so that limit holds across all the renders running at once.
+// start() returns immediately. Results are inserted into the project and the callbacks are called in the main
+// thread as the jobs finish. The engine keeps itself alive until the completion callback has been called.
+class pitch_render_engine : public std::enable_shared_from_this<pitch_render_engine>
+{
+public:
+	// maxinflight 0 : as many jobs as there are pool threads
+	pitch_render_engine(int maxinflight = 0, work_stealing_pool& pool = get_shared_work_stealing_pool(),
+		std::shared_ptr<render_io_scheduler> io = get_shared_render_io_scheduler());
+	~pitch_render_engine();
+	// Call these from the main thread before start(). Returns the job index or -1 if the item can't be rendered.
+	int add_item(MediaItem* item, const pitch_render_params& renderparams);
+	// Called with the job index, whether the render succeeded and the output file name
+	void set_job_callback(std::function<void(int, bool, const std::string&)> f) { m_job_callback = f; }
+	void set_completion_callback(std::function<void(pitch_render_engine&)> f) { m_completion_callback = f; }
+	void start();
+
+	// These can be called from any thread
+	void cancel() { m_cancel.cancel(); }
+	bool is_cancelled() const { return m_cancel.is_cancelled(); }
+	int get_num_jobs() const { return (int)m_jobs.size(); }
+	int get_num_finished() const { return m_num_finished; }
+	int get_num_failed() const { return m_num_failed; }
+	bool is_finished() const { return m_num_finished == (int)m_jobs.size(); }
+	double get_progress() const;
+	// Frames processed per block
+	static const int block_size = 8192;
+private:
+	struct buffer_set
+	{
+		// Reset for each job, so after the first jobs the memory comes from the blocks of earlier ones
+		audio_arena m_arena;
+		ReaSample* m_interleaved = nullptr;
+		double** m_planar_pointers = nullptr;
+		bool m_in_use = false;
+	};
+	struct job
+	{
+		MediaItem* m_item = nullptr;
+		pitch_render_params m_params;
+		std::string m_outfn;
+		double m_src_start = 0.0;
+		double m_src_length = 0.0;
+		PCM_source* m_src = nullptr;
+		IReaperPitchShift* m_shifter = nullptr;
+		PCM_sink* m_sink = nullptr;
+		render_io_scheduler::stream* m_stream = nullptr;
+		buffer_set* m_buffers = nullptr;
+		int m_nch = 0;
+		double m_sr = 0.0;
+		std::atomic<double> m_progress{ 0.0 };
+		bool m_ok = false;
+		bool m_done = false;
+	};
+	std::vector<std::unique_ptr<job>> m_jobs;
+	std::vector<std::unique_ptr<buffer_set>> m_buffers;
+	work_stealing_pool& m_pool;
+	std::shared_ptr<render_io_scheduler> m_io;
+	int m_max_in_flight = 1;
+	int m_next_job = 0;
+	int m_in_flight = 0;
+	bool m_started = false;
+	bool m_waiting_for_stream = false;
+	std::atomic<int> m_num_finished{ 0 };
+	std::atomic<int> m_num_failed{ 0 };
+	cancellation_token m_cancel;
+	std::function<void(int, bool, const std::string&)> m_job_callback;
+	std::function<void(pitch_render_engine&)> m_completion_callback;
+	std::shared_ptr<pitch_render_engine> m_self;
+	// Main thread
+	void launch_jobs();
+	bool open_job(job& j);
+	void finish_job(int index);
+	void release_job(job& j);
+	void insert_result(job& j);
+	// Worker thread
+	static bool render_job(job& j, const cancellation_token& cancel, render_io_scheduler& io);
+};
+
+// Renders the selected items with the given tempo, calling done with the elapsed time when all have finished
+void render_selected_items_with_pitch_shifter(double tempo, double pitch, int maxinflight,
+	std::function<void(double)> done = nullptr);
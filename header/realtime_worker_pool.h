@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <cstdint>
+
+// Threads that help the audio thread with work that has to be finished within the same audio callback.
+// The threads are pinned to their own cores where the OS allows it and run at high priority. After a job batch
+// they spin for a while waiting for the next one, since audio callbacks follow each other quickly, and then
+// sleep until the next batch. The calling thread only signals the workers when some of them are asleep,
+// which happens after a pause in the batches, so steady playback doesn't make system calls.
+// The calling thread takes part in running the jobs, so a batch always completes even if the workers
+// are slow to wake up. Running a batch doesn't lock or allocate memory.
+class realtime_worker_pool
+{
+public:
+	using job_function = void(*)(void* context, int index);
+	// numthreads -1 : one less than the number of cores, as the calling thread also does work
+	realtime_worker_pool(int numthreads = -1);
+	~realtime_worker_pool();
+	realtime_worker_pool(const realtime_worker_pool&) = delete;
+	realtime_worker_pool& operator=(const realtime_worker_pool&) = delete;
+	int get_num_workers() const { return (int)m_threads.size(); }
+	// Runs fn(context, index) for each index from 0 to numjobs-1 and returns when all have finished.
+	// Can be called from several threads. While one batch is running, other calls run their jobs serially
+	// in the calling thread.
+	void run(int numjobs, job_function fn, void* context);
+private:
+	std::vector<std::thread> m_threads;
+	// Generation in the upper 32 bits, index of the next unclaimed job in the lower 32 bits.
+	// 0xffffffff in the lower bits while a batch is being set up.
+	std::atomic<uint64_t> m_claim{ 0 };
+	std::atomic<int> m_jobs_done{ 0 };
+	std::atomic<bool> m_quit{ false };
+	std::atomic_flag m_busy = ATOMIC_FLAG_INIT;
+	std::atomic<int> m_num_sleeping{ 0 };
+	uint32_t m_generation = 0;
+	std::atomic<int> m_num_jobs{ 0 };
+	job_function m_function = nullptr;
+	void* m_context = nullptr;
+	std::mutex m_wake_mutex;
+	std::condition_variable m_wake_cv;
+	void worker_proc(int index);
+	// Returns false when there are no more jobs in the generation
+	bool run_one_job(uint32_t generation);
+};
+
+// Pool shared by all users that exist at the same time, created when first needed
+std::shared_ptr<realtime_worker_pool> get_shared_realtime_worker_pool();
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "WDL/WDL/lice/lice.h"
+#include "reaper_plugin/reaper_plugin_functions.h"
+#include <vector>
+
+struct reaper_envelope_point
+{
+	reaper_envelope_point() {}
+	reaper_envelope_point(double t, double v, int sh = 0, double tens = 0.0)
+		: time(t), value(v), shape(sh), tension(tens) {}
+	double time = 0.0;
+	double value = 0.0;
+	int shape = 0;
+	double tension = 0.0;
+	bool operator==(const reaper_envelope_point& rhs) const
+	{
+		return time == rhs.time && value == rhs.value && shape == rhs.shape && tension == rhs.tension;
+	}
+	bool operator!=(const reaper_envelope_point& rhs) const { return !((*this) == rhs); }
+};
+
+// Writes generated points into a time range of a Reaper envelope, remembering what was written
+// the previous time. When the number of points stays the same (as when dragging points around),
+// only the points that differ from the last write are updated with SetEnvelopePoint and no sorting is done.
+// Otherwise the range is deleted and the points reinserted unsorted, followed by a single sort.
+// The points passed in must be sorted by time and lie within [starttime, endtime).
+class reaper_envelope_writer
+{
+public:
+	// Returns true if the Reaper envelope was modified
+	bool write(TrackEnvelope* env, double starttime, double endtime, const std::vector<reaper_envelope_point>& points);
+	// Forget what was written, so that the next write replaces the whole range
+	void invalidate() { m_env = nullptr; m_written.clear(); }
+	int getNumPointsUpdatedInLastWrite() const { return m_last_num_updated; }
+private:
+	TrackEnvelope* m_env = nullptr;
+	double m_start_time = 0.0;
+	double m_end_time = 0.0;
+	std::vector<reaper_envelope_point> m_written;
+	// Index of the first written point in the Reaper envelope and the envelope's total point count after our write.
+	// Used to detect if the envelope was changed by something else since.
+	int m_first_index = 0;
+	int m_expected_count = 0;
+	int m_last_num_updated = 0;
+	bool can_update_in_place(TrackEnvelope* env, double starttime, double endtime, const std::vector<reaper_envelope_point>& points);
+	void rewrite_range(TrackEnvelope* env, double starttime, double endtime, const std::vector<reaper_envelope_point>& points);
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "WDL/WDL/lice/lice.h"
+#include "reaper_plugin/reaper_plugin_functions.h"
+#include "audio_buffer_pool.h"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Disk settings of the background renders, stored in the ExtState section "MRP_render_io"
+struct render_io_settings
+{
+	// Threads doing the file writes. 1 is best for spinning disks and network shares, SSDs may like more.
+	int m_writer_threads = 1;
+	// Files a render has open and is writing at once
+	int m_max_open_sinks = 4;
+	// Frames gathered per file before they are written, larger writes mean less seeking between the files
+	int m_write_chunk_frames = 65536;
+	static render_io_settings load();
+	void save() const;
+};
+
+// Schedules the output file writes of renders whose audio is computed on worker threads.
+// The computing threads copy their output into a chunk per file, and only full chunks are handed to a small
+// number of writer threads, so the disk sees few large writes instead of many small ones from every
+// thread at once. The writes of a file are always done by the same writer thread, in order.
+// The number of chunks is limited, so when the disk can't keep up the computing threads wait in write().
+class render_io_scheduler
+{
+public:
+	class stream;
+	render_io_scheduler(const render_io_settings& settings = render_io_settings::load());
+	// Writes everything that was queued before returning
+	~render_io_scheduler();
+	const render_io_settings& get_settings() const { return m_settings; }
+
+	// Main thread
+	// Whether there are fewer open streams than the settings allow
+	bool can_open_stream() const { return m_num_open < m_settings.m_max_open_sinks; }
+	// The caller keeps owning the sink and must keep it alive until close_stream
+	stream* open_stream(PCM_sink* sink, int nch);
+	// Call after the written callback of finish_stream has been called
+	void close_stream(stream* s);
+	// For a render that has no stream open and can't open one. f is called in the main thread after a
+	// stream of another render has been closed, each closed stream calls one waiting f.
+	void wait_for_stream(std::function<void()> f);
+	int get_num_open_streams() const { return m_num_open; }
+
+	// The thread producing the audio of the stream
+	// Copies frames of planar audio to the stream's chunk, queuing the chunk for writing when it's full
+	void write(stream* s, double* const* data, int frames);
+	// Queues what remains in the stream's chunk and calls written in a writer thread when all of the
+	// stream's audio has been written
+	void finish_stream(stream* s, std::function<void()> written);
+private:
+	struct chunk
+	{
+		pooled_buffer m_data;
+		std::vector<double*> m_pointers;
+		int m_nch = 0;
+		int m_frames = 0;
+	};
+	struct entry
+	{
+		stream* m_stream = nullptr;
+		std::unique_ptr<chunk> m_chunk;
+		std::function<void()> m_func;
+	};
+	struct writer
+	{
+		std::thread m_thread;
+		std::deque<entry> m_queue;
+	};
+	render_io_settings m_settings;
+	std::vector<std::unique_ptr<writer>> m_writers;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::vector<std::unique_ptr<chunk>> m_free_chunks;
+	int m_max_chunks = 0;
+	int m_num_chunks = 0;
+	bool m_quit = false;
+	int m_num_open = 0;
+	int m_next_writer = 0;
+	std::deque<std::function<void()>> m_stream_waiters;
+	std::unique_ptr<chunk> get_chunk(int nch);
+	void queue(int writerindex, entry e);
+	void writer_proc(int index);
+};
+
+class render_io_scheduler::stream
+{
+	friend class render_io_scheduler;
+	PCM_sink* m_sink = nullptr;
+	int m_nch = 0;
+	int m_writer = 0;
+	std::unique_ptr<chunk> m_chunk;
+};
+
+// Scheduler shared by all the background renders, so that the open file limit and the writer threads are
+// global rather than per render. Created when first needed with the saved settings. Main thread only.
+std::shared_ptr<render_io_scheduler> get_shared_render_io_scheduler();
+// Call when the extension is unloaded, and after the settings are changed. The renders keep the scheduler
+// they got alive, so the running ones finish with the old scheduler and the later ones use the new settings.
+void shutdown_shared_render_io_scheduler();
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "WDL/WDL/lice/lice.h"
+#include "reaper_plugin/reaper_plugin_functions.h"
+#include "WDL/WDL/shm_connection.h"
+#include "render_worker_jobs.h"
+#include <memory>
+#include <string>
+#ifndef WIN32
+#include <sys/types.h>
+#endif
+
+// Settings of the out-of-process renders, stored in the ExtState section "MRP_render_worker"
+struct render_worker_settings
+{
+	// Run the renders that support it in the worker process, so that a crash or a hang doesn't take Reaper down
+	bool m_enabled = false;
+	// Times the worker is restarted during one render before the rest of it is done in Reaper's process
+	int m_max_restarts = 3;
+	// Seconds without an answer from the worker after which it's considered hung
+	int m_timeout_seconds = 10;
+	// Empty : mrp_render_worker (.exe on Windows) in the UserPlugins folder of the Reaper resource path
+	std::string m_worker_path;
+	static render_worker_settings load();
+	void save() const;
+};
+
+// Runs render jobs in the worker process built from render_worker/mrp_render_worker.cpp.
+// The worker is started when first needed and connected with a WDL_SHM_Connection. The audio is sent to it
+// in blocks, a few blocks at a time, and the processed blocks come back in the same order.
+// When the worker crashes, hangs or loses the connection, it's killed and a new one continues from the first
+// block that hadn't come back. When the worker can't be started or the restarts run out, the rest of the
+// audio is processed in Reaper's process, so a render always completes.
+// Main thread only.
+class render_worker_client
+{
+public:
+	render_worker_client(const render_worker_settings& settings = render_worker_settings::load());
+	~render_worker_client();
+	render_worker_client(const render_worker_client&) = delete;
+	render_worker_client& operator=(const render_worker_client&) = delete;
+	const render_worker_settings& get_settings() const { return m_settings; }
+	// Stops the worker when the settings disable it
+	void set_settings(const render_worker_settings& settings);
+	// Processes frames of interleaved audio with the job and waits for the result.
+	// Returns true if it was all processed by the worker. Otherwise get_last_error() tells why not.
+	bool process(const render_worker_job& job, const double* input, double* output, int64_t frames,
+		render_worker_block_stats& stats);
+	bool is_worker_running() const { return m_connection != nullptr; }
+	// Restarts after failures since this object was created
+	int get_num_restarts() const { return m_num_restarts; }
+	const std::string& get_last_error() const { return m_last_error; }
+	std::string get_worker_path() const;
+private:
+	enum class job_result { completed, failed, rejected };
+	render_worker_settings m_settings;
+	std::unique_ptr<WDL_SHM_Connection> m_connection;
+#ifdef WIN32
+	HANDLE m_process = nullptr;
+#else
+	pid_t m_process = 0;
+#endif
+	int m_next_job_id = 0;
+	int m_num_restarts = 0;
+	std::string m_last_error;
+	bool start_worker();
+	// graceful asks the worker to quit and waits a moment for it, otherwise it's killed right away
+	void stop_worker(bool graceful);
+	bool is_process_alive();
+	void wait_for_connection();
+	// Advances done as the processed blocks arrive
+	job_result run_job(const render_worker_job& job, const double* input, double* output, int64_t frames,
+		int64_t& done, render_worker_block_stats& stats);
+};
+
+// The client used by the renders, created when first used
+render_worker_client& get_render_worker_client();
+// Stops the worker, call when the plugin is unloaded
+void shutdown_render_worker_client();
+// Processes a minute of noise in the worker and in Reaper's process and prints whether the results match
+void test_render_worker();
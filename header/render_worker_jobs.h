@@ -0,0 +1,34 @@
+#pragma once
+
+// The processing of the render worker jobs, compiled into both the plugin and the worker process,
+// so the results are the same wherever a job runs. This must not depend on the Reaper API.
+
+#include "render_worker_protocol.h"
+#include "envelope_model.h"
+#include <string>
+
+struct render_worker_job
+{
+	render_worker_job_kind m_kind = render_worker_job_kind::envelope_gain;
+	int m_nch = 0;
+	double m_sr = 44100.0;
+	double m_clip_level = 1.0;
+	// Sorted by time
+	breakpoint_envelope m_envelope;
+	// The begin_job message payload
+	int get_header_size() const;
+	void write_header(void* dest) const;
+	// Returns false and sets err when the payload isn't a job that can be done
+	bool read_header(const char* payload, int size, std::string& err);
+};
+
+struct render_worker_block_stats
+{
+	// Samples that went over the clip level, and the largest absolute value of them
+	int64_t m_num_clipped = 0;
+	double m_max_clipped = 0.0;
+};
+
+// Processes frames of interleaved audio that start at startframe of the job's audio
+void process_render_worker_block(const render_worker_job& job, int64_t startframe,
+	const double* input, double* output, int frames, render_worker_block_stats& stats);
@@ -0,0 +1,108 @@
+#pragma once
+
+// Shared by the plugin and the render worker process, so this must not depend on the Reaper API
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include "WDL/WDL/queue.h"
+
+const int32_t render_worker_protocol_version = 1;
+
+// Size of the WDL_SHM_Connection buffer in each direction
+const int render_worker_shm_size = 1 << 20;
+
+enum class render_worker_message : int32_t
+{
+	// Either way, sent when WDL_SHM_Connection::WantSendKeepAlive() says so
+	keep_alive,
+	// Worker to plugin after connecting, payload is the protocol version as int32_t
+	hello,
+	// Plugin to worker, payload is a render_worker_job_header followed by the envelope points
+	begin_job,
+	// Plugin to worker : render_worker_block_header followed by the interleaved input frames.
+	// Worker to plugin : the same with the output frames, in the order the input blocks were sent.
+	block,
+	// Plugin to worker after the last block of the job, the worker answers with end_job after the last output block
+	end_job,
+	// Worker to plugin, payload is an error text. The job can't be done by the worker.
+	error,
+	// Plugin to worker, the worker exits
+	quit
+};
+
+enum class render_worker_job_kind : int32_t
+{
+	// Multiplies the audio by a breakpoint envelope over time in seconds, then clips it to +/- m_clip_level.
+	// Used by the dynamics processor renders.
+	envelope_gain
+};
+
+// The payloads are padded to multiples of 8 bytes, so that the samples stay aligned in the queues
+struct render_worker_message_header
+{
+	int32_t m_type = 0;
+	int32_t m_job = 0;
+	int32_t m_size = 0;
+	int32_t m_reserved = 0;
+};
+
+struct render_worker_job_header
+{
+	int32_t m_kind = 0;
+	int32_t m_nch = 0;
+	double m_sr = 0.0;
+	double m_clip_level = 1.0;
+	int32_t m_num_points = 0;
+	int32_t m_reserved = 0;
+};
+
+struct render_worker_point
+{
+	double m_x = 0.0;
+	double m_y = 0.0;
+	double m_p1 = 0.0;
+	double m_p2 = 0.0;
+	int32_t m_shape = 0;
+	int32_t m_reserved = 0;
+};
+
+struct render_worker_block_header
+{
+	int64_t m_start_frame = 0;
+	int32_t m_frames = 0;
+	// Output blocks : samples that were clipped, and the largest absolute value before clipping
+	int32_t m_num_clipped = 0;
+	double m_max_clipped = 0.0;
+};
+
+inline int render_worker_padded_size(int size)
+{
+	return (size + 7) & ~7;
+}
+
+// Appends a message to the queue and returns the space for its payload, which the caller fills in place
+inline void* render_worker_add_message(WDL_Queue& q, render_worker_message type, int job, int payloadsize)
+{
+	render_worker_message_header hdr;
+	hdr.m_type = (int32_t)type;
+	hdr.m_job = job;
+	hdr.m_size = render_worker_padded_size(payloadsize);
+	q.Add(&hdr, sizeof(hdr));
+	return q.Add(nullptr, hdr.m_size);
+}
+
+// Returns the header of the next complete message in the queue and sets payload to point into the queue,
+// or returns nullptr if the whole message hasn't been received yet. The caller advances the queue by
+// sizeof(render_worker_message_header) + m_size when done with the payload.
+inline const render_worker_message_header* render_worker_peek_message(const WDL_Queue& q, const char*& payload)
+{
+	if (q.Available() < (int)sizeof(render_worker_message_header))
+		return nullptr;
+	auto hdr = (const render_worker_message_header*)q.Get();
+	if (hdr->m_size < 0 || q.Available() < (int)sizeof(render_worker_message_header) + hdr->m_size)
+		return nullptr;
+	payload = (const char*)q.Get() + sizeof(render_worker_message_header);
+	return hdr;
+}
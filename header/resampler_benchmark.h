@@ -0,0 +1,44 @@
+#pragma once
+
+#include "WDL/WDL/lice/lice.h"
+#include "reaper_plugin/reaper_plugin_functions.h"
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+
+// A resampler to measure, Reaper's resampler modes and WDL_Resampler configurations
+// are both used through REAPER_Resample_Interface
+struct resampler_config
+{
+	std::string m_name;
+	std::function<std::unique_ptr<REAPER_Resample_Interface>()> m_create;
+};
+
+// Reaper's resampler modes as listed by Resample_EnumModes, followed by some WDL_Resampler configurations
+std::vector<resampler_config> get_resampler_benchmark_configs();
+
+struct resampler_benchmark_result
+{
+	std::string m_name;
+	double m_in_sr = 0.0;
+	double m_out_sr = 0.0;
+	int m_nch = 0;
+	// Seconds of output produced per second of processing on one core
+	double m_realtime = 0.0;
+	// Output samples (frames * channels) per second on one core, in millions
+	double m_msamples_per_second = 0.0;
+	// Residual after removing a 997 Hz tone, relative to the tone
+	double m_thdn_db = 0.0;
+	// Residual for a tone at 90% of the input Nyquist frequency. When the tone is above the output Nyquist
+	// frequency everything is residual, so this is the aliasing rejection, otherwise the imaging and passband error.
+	double m_hf_residual_db = 0.0;
+};
+
+// Runs a fixed synthetic signal through each configuration at several rate pairs and channel counts.
+// Runs in the calling thread, seconds is the length of the output measured for each case.
+std::vector<resampler_benchmark_result> benchmark_resamplers(const std::vector<resampler_config>& configs,
+	double seconds = 2.0);
+
+// Prints the results as a table to the console
+void print_resampler_benchmark(const std::vector<resampler_benchmark_result>& results);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "utilfuncs.h"
+#include "work_stealing_pool.h"
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+
+// Wraps a function into an IParallelTask. The function gets the task so it can report progress and check
+// for cancellation.
+class function_task : public IParallelTask
+{
+public:
+	function_task(std::function<void(IParallelTask&)> f) : m_f(f) {}
+	void run() override { m_f(*this); }
+private:
+	std::function<void(IParallelTask&)> m_f;
+};
+
+// Runs IParallelTasks in a work_stealing_pool in an order given by dependencies between them, for example
+// "decode -> analyze -> transform -> write" for each of many items, so that the I/O of some items overlaps
+// the computations of others.
+// start() returns immediately. The completion callbacks are called in the main thread, and the graph
+// and its tasks are released in the main thread after the last callback, like tasks that use Reaper objects need.
+// Cancelling stops tasks that haven't started yet from starting. Running tasks see it from is_cancelled().
+// Tasks that depend on a task that was skipped are skipped too.
+class task_graph : public std::enable_shared_from_this<task_graph>
+{
+public:
+	enum class task_state { Waiting, Running, Finished, Skipped };
+	// Call these from the main thread before start()
+	// The dependencies must be indices of tasks added earlier, which keeps the graph free of cycles.
+	// Returns the index of the task or -1 if a dependency is invalid.
+	int add_task(std::shared_ptr<IParallelTask> task, const std::vector<int>& dependencies = {});
+	int add_task(std::function<void(IParallelTask&)> f, const std::vector<int>& dependencies = {});
+	// Called with the task index and whether the task ran
+	void set_task_completion_callback(std::function<void(int, bool)> f) { m_task_callback = f; }
+	// Called once after all tasks have finished or have been skipped
+	void set_completion_callback(std::function<void(task_graph&)> f) { m_completion_callback = f; }
+	void start(work_stealing_pool& pool = get_shared_work_stealing_pool());
+
+	// These can be called from any thread
+	void cancel() { m_cancel.cancel(); }
+	bool is_cancelled() const { return m_cancel.is_cancelled(); }
+	cancellation_token get_cancellation_token() const { return m_cancel; }
+	bool is_finished() const { return m_num_done == (int)m_nodes.size(); }
+	int get_num_tasks() const { return (int)m_nodes.size(); }
+	int get_num_done() const { return m_num_done; }
+	task_state get_task_state(int index) const { return m_nodes[index]->m_state; }
+	IParallelTask* get_task(int index) const { return m_nodes[index]->m_task.get(); }
+	// Average progress of the tasks, finished and skipped tasks count as complete
+	double get_progress() const;
+private:
+	struct node
+	{
+		std::shared_ptr<IParallelTask> m_task;
+		std::vector<int> m_dependents;
+		int m_num_dependencies = 0;
+		std::atomic<int> m_waiting_for{ 0 };
+		// Whether some dependency was skipped
+		std::atomic<bool> m_skip{ false };
+		std::atomic<task_state> m_state{ task_state::Waiting };
+	};
+	std::vector<std::unique_ptr<node>> m_nodes;
+	cancellation_token m_cancel;
+	std::atomic<int> m_num_done{ 0 };
+	bool m_started = false;
+	work_stealing_pool* m_pool = nullptr;
+	std::function<void(int, bool)> m_task_callback;
+	std::function<void(task_graph&)> m_completion_callback;
+	// Keeps the graph alive while it runs, released by the main thread after the completion callback
+	std::shared_ptr<task_graph> m_self;
+	void submit_node(int index);
+	void run_node(int index);
+};
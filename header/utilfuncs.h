@@ -4,17 +4,14 @@
 #include <ostream>
 #include <functional>
 #include <memory>
+#include <atomic>
 #include <cmath>
 #include <type_traits>
 #include <string>
 #include <vector>
+#include <future>
 #include "WDL/WDL/lice/lice.h"
 #include "reaper_plugin/reaper_plugin_functions.h"
-#ifdef WIN32
-#include "ppl.h"
-#else
-#include <dispatch/dispatch.h>
-#endif
 
 #undef min
 #undef max
@@ -149,7 +146,27 @@ public:
 void set_readbg_decimals(int decims);
 
 void start_or_stop_main_thread_executor(bool stop);
+// Queues f to be called in the main thread. Can be called from any thread, including from functions
+// already running in the main thread, and doesn't lock.
 void execute_in_main_thread(std::function<void(void)> f);
+// Runs the queued functions. The executor calls this from a timer, but it can also be called from
+// other main thread hooks, like the Run() of a control surface, to run the functions sooner.
+void run_main_thread_tasks();
+bool is_main_thread();
+
+// Calls f in the main thread and returns a future for its result, so that worker threads can wait for
+// Reaper API calls that are only allowed in the main thread. Called in the main thread, f is called immediately,
+// as waiting for the future there would never finish.
+template<typename F>
+inline auto call_in_main_thread(F f) -> std::future<decltype(f())>
+{
+	auto task = std::make_shared<std::packaged_task<decltype(f())()>>(f);
+	auto result = task->get_future();
+	if (is_main_thread() == true)
+		(*task)();
+	else execute_in_main_thread([task]() { (*task)(); });
+	return result;
+}
 
 class IValueConverter
 {
@@ -219,6 +236,76 @@ private:
 	}
 };
 
+// Thread safe relative of copy_on_write, for handing immutable objects from a GUI thread to
+// the audio thread. The GUI thread publishes new versions, the audio thread picks up the latest one
+// with acquire() at the start of its processing block. acquire() is wait free and never allocates
+// or frees memory : the version the audio thread stops using is parked in a retire slot and only
+// destroyed later from a non-audio thread by publish() or collect_retired().
+// There may be only one thread calling acquire() and one (other) thread publishing/collecting.
+template<typename T>
+class published_object
+{
+public:
+	using pointer_type = std::shared_ptr<T>;
+	published_object() {}
+	published_object(const published_object&) = delete;
+	published_object& operator=(const published_object&) = delete;
+	explicit published_object(pointer_type initial)
+	{
+		publish(initial);
+	}
+	~published_object()
+	{
+		delete m_pending.exchange(nullptr);
+		delete m_retired.exchange(nullptr);
+		delete m_current;
+	}
+	// Non-audio thread
+	void publish(pointer_type x)
+	{
+		collect_retired();
+		m_has_latest.store(x != nullptr, std::memory_order_release);
+		m_latest = x;
+		// If the audio thread didn't yet see the previous pending version, it's ours to destroy
+		delete m_pending.exchange(new pointer_type(std::move(x)));
+	}
+	// Non-audio thread. Destroys the version the audio thread has stopped using, if any.
+	void collect_retired()
+	{
+		delete m_retired.exchange(nullptr);
+	}
+	// Non-audio thread. The most recently published version, which the audio thread may not have picked up yet.
+	pointer_type latest() const { return m_latest; }
+	// Any thread. Whether the most recently published version is non-null.
+	bool has_latest() const noexcept { return m_has_latest.load(std::memory_order_acquire); }
+	// Audio thread
+	T* acquire() noexcept
+	{
+		// A new version is only taken if the retire slot is free, so the audio thread never has to
+		// destroy anything itself. If the other thread hasn't collected yet, we keep using the current
+		// version for one more block.
+		if (m_retired.load(std::memory_order_acquire) == nullptr)
+		{
+			pointer_type* incoming = m_pending.exchange(nullptr, std::memory_order_acq_rel);
+			if (incoming != nullptr)
+			{
+				m_retired.store(m_current, std::memory_order_release);
+				m_current = incoming;
+			}
+		}
+		if (m_current != nullptr)
+			return m_current->get();
+		return nullptr;
+	}
+private:
+	std::atomic<pointer_type*> m_pending{ nullptr };
+	std::atomic<pointer_type*> m_retired{ nullptr };
+	// Only touched by the audio thread (and the destructor)
+	pointer_type* m_current = nullptr;
+	pointer_type m_latest;
+	std::atomic<bool> m_has_latest{ false };
+};
+
 class reaper_track_range
 {
 public:
@@ -283,6 +370,29 @@ inline bool fuzzy_compare(double p1, double p2)
 	return (fabs(p1 - p2) * 1000000000000. <= std::min(fabs(p1), fabs(p2)));
 }
 
+// PCM_source doesn't have a seek method, so seeks have to be detected from the block times passed to GetSamples.
+// A block that doesn't start within half a sample of where the previous block ended is a seek, as is a samplerate change.
+class playback_position_tracker
+{
+public:
+	// Returns true if the block is not a continuation of the previous one
+	bool update(double time_s, int length, double samplerate) noexcept
+	{
+		bool result = m_valid == false || samplerate != m_samplerate
+			|| fabs(time_s - m_next_time)*samplerate > 0.5;
+		m_next_time = time_s + length / samplerate;
+		m_samplerate = samplerate;
+		m_valid = true;
+		return result;
+	}
+	// The next update will be treated as a seek
+	void invalidate() noexcept { m_valid = false; }
+private:
+	double m_next_time = 0.0;
+	double m_samplerate = 0.0;
+	bool m_valid = false;
+};
+
 namespace MRP
 {
 	enum class Anchor
@@ -462,36 +572,32 @@ public:
 	NoCopyNoMove& operator=(NoCopyNoMove&&) = delete;
 };
 
+// Shared flag for asking running work to stop. Copies refer to the same flag.
+class cancellation_token
+{
+public:
+	cancellation_token() : m_flag(std::make_shared<std::atomic<bool>>(false)) {}
+	void cancel() { m_flag->store(true); }
+	bool is_cancelled() const { return m_flag->load(); }
+private:
+	std::shared_ptr<std::atomic<bool>> m_flag;
+};
+
 class IParallelTask : public NoCopyNoMove
 {
 public:
 	virtual ~IParallelTask() {}
 	virtual void run() = 0;
+	// Long running tasks should update their progress (0.0 to 1.0) and return early when cancelled
+	void set_progress(double progress) { m_progress = progress; }
+	double get_progress() const { return m_progress; }
+	bool is_cancelled() const { return m_cancel.is_cancelled(); }
+	void set_cancellation_token(cancellation_token token) { m_cancel = token; }
+private:
+	std::atomic<double> m_progress{ 0.0 };
+	cancellation_token m_cancel;
 };
 
-inline void execute_parallel_tasks(std::vector<std::shared_ptr<IParallelTask>> tasks, bool multithreaded = true)
-{
-	// No use in firing up the concurrency stuff if only one task
-	if (tasks.size() < 2)
-		multithreaded = false;
-	if (multithreaded == true)
-	{
-#ifdef WIN32
-		Concurrency::parallel_for_each(tasks.begin(), tasks.end(), [](auto t) { t->run(); });
-#else
-		dispatch_queue_t the_queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-		void* ctx=(void*)&tasks;
-		dispatch_apply_f(tasks.size(),the_queue,ctx,[](void* thectx,size_t index)
-		{
-			auto ptrtasks=(std::vector<std::shared_ptr<IParallelTask>>*)thectx;
-			(*ptrtasks)[index]->run();
-		});
-#endif
-	}
-	else
-	{
-		for (auto& e : tasks)
-			e->run();
-	}
-}
+// Runs the tasks in the shared work_stealing_pool and returns when they have all finished
+void execute_parallel_tasks(std::vector<std::shared_ptr<IParallelTask>> tasks, bool multithreaded = true);
 
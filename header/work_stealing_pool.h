@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <cstdint>
+
+// General purpose thread pool for background work like offline renders, using the same code on all platforms.
+// Each worker has its own task queue. Tasks submitted from a worker go to the back of its own queue and the
+// worker takes them from the back, so related work stays on the same core. Idle workers steal from the front
+// of the other queues. Tasks submitted from other threads are spread over the queues.
+// Workers waiting in run_and_wait run queued tasks meanwhile, so tasks can themselves submit
+// tasks and wait for them without running out of threads.
+// Not for the audio thread, submitting allocates and locks. See realtime_worker_pool for that.
+class work_stealing_pool
+{
+public:
+	using task = std::function<void(void)>;
+	// numthreads -1 : as many threads as there are cores
+	work_stealing_pool(int numthreads = -1);
+	// Waits for the running tasks. The tasks still queued are dropped without being run, so owners of long
+	// work cancel it and wait for it before the pool is destroyed.
+	~work_stealing_pool();
+	work_stealing_pool(const work_stealing_pool&) = delete;
+	work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+	int get_num_workers() const { return (int)m_workers.size(); }
+	void submit(task t);
+	// Runs the tasks and returns when they have all finished. The calling thread runs tasks of the batch too.
+	// A worker of the pool also runs other queued tasks while it waits, other threads only run the batch's
+	// tasks, so for example the GUI thread isn't held up by long background tasks queued before the batch.
+	void run_and_wait(std::vector<task>& tasks);
+	// Calls fn(chunkbegin, chunkend) for contiguous chunks covering begin to end, in parallel, and returns when
+	// all have finished. grain is the chunk size, 0 picks one that gives each thread a few chunks to balance
+	// the load. The automatic chunks are multiples of 64 elements so they start at cache line and SIMD alignment
+	// boundaries when the data does. Ranges of a single chunk are run directly in the calling thread.
+	// Safe to call from the GUI thread while long background tasks are queued : a thread outside the pool
+	// runs only the chunks of this call and then waits only for the chunks workers have already started.
+	void parallel_for(int64_t begin, int64_t end, int64_t grain, const std::function<void(int64_t, int64_t)>& fn);
+	// Counts of tasks taken from the worker's own queue and from other queues, for diagnostics
+	int64_t get_num_local_tasks() const { return m_num_local; }
+	int64_t get_num_stolen_tasks() const { return m_num_stolen; }
+private:
+	struct worker
+	{
+		std::mutex m_mutex;
+		std::deque<task> m_queue;
+	};
+	std::vector<std::unique_ptr<worker>> m_workers;
+	std::vector<std::thread> m_threads;
+	std::atomic<int> m_num_queued{ 0 };
+	std::atomic<unsigned int> m_next_queue{ 0 };
+	std::atomic<bool> m_quit{ false };
+	std::atomic<int64_t> m_num_local{ 0 };
+	std::atomic<int64_t> m_num_stolen{ 0 };
+	std::mutex m_wake_mutex;
+	std::condition_variable m_wake_cv;
+	void worker_proc(int index);
+	// Pops from the back of the own queue (index -1 if the calling thread isn't a worker) or steals
+	// from the front of another one. Returns false if all queues were empty.
+	bool run_one_task(int ownindex);
+};
+
+// Pool shared by the whole extension, created when first needed. Call shutdown_shared_work_stealing_pool
+// when the extension is unloaded, the threads can't be safely joined from static destructors.
+work_stealing_pool& get_shared_work_stealing_pool();
+void shutdown_shared_work_stealing_pool();
+
+// parallel_for in the shared pool
+inline void parallel_for(int64_t begin, int64_t end, int64_t grain, const std::function<void(int64_t, int64_t)>& fn)
+{
+	get_shared_work_stealing_pool().parallel_for(begin, end, grain, fn);
+}
@@ -97,128 +97,160 @@ void test_track_range()
 	}
 }
 
-class irp_task : public IParallelTask
+// Renders the selected items one at a time and then in parallel, without inserting the results
+void benchmark_irp_render()
 {
-public:
-	// Have to initialize stuff in GUI thread
-	irp_task(MediaItem* item, int id) : m_item(item), m_id(id)
+	if (CountSelectedMediaItems(nullptr) < 2)
 	{
-		MediaItem_Take* take = GetActiveTake(m_item);
-		if (take != nullptr)
-		{
-			PCM_source* src = GetMediaItemTake_Source(take);
-			if (src != nullptr)
-			{
-				m_src = src->Duplicate();
-				m_shifter = ReaperGetPitchShiftAPI(REAPER_PITCHSHIFT_API_VER);
-				char cfg[] = { 'e','v','a','w', 32, 0 };
-				int nch = src->GetNumChannels();
-				int sr = src->GetSampleRate();
-				char buf[2048];
-				GetProjectPath(buf, 2048);
-				std::string outfn = std::string(buf)+"out_" + std::to_string(id) + ".wav";
-				readbg() << "sink fn : " << outfn << "\n";
-				m_sink = PCM_Sink_Create(outfn.c_str(), cfg, sizeof(cfg), nch, sr, false);
-				if (m_sink == nullptr)
-				{
-					readbg() << "failed to create sink\n";
-					return;
-				}
-				m_shifteroutbuf.resize(nch*m_bufsize);
-				m_sinkbuf.resize(nch*m_bufsize);
-				m_sinkbufpointers.resize(nch);
-				for (int i = 0; i < nch; ++i)
-					m_sinkbufpointers[i] = &m_sinkbuf[i*m_bufsize];
-			}
-		}
+		readbg() << "Select at least 2 items for the benchmark\n";
+		return;
 	}
-	// Have to destroy stuff in GUI thread
-	~irp_task()
+	auto run = [](int maxinflight, std::function<void(double)> done)
+	{
+		auto engine = std::make_shared<pitch_render_engine>(maxinflight);
+		pitch_render_params renderparams;
+		renderparams.tempo = 0.5;
+		renderparams.insert_take = false;
+		for (int i = 0; i < CountSelectedMediaItems(nullptr); ++i)
+			engine->add_item(GetSelectedMediaItem(nullptr, i), renderparams);
+		engine->set_job_callback([](int, bool, const std::string& fn) { remove(fn.c_str()); });
+		double t0 = time_precise();
+		engine->set_completion_callback([t0, done](pitch_render_engine&) { done(time_precise() - t0); });
+		engine->start();
+	};
+	run(1, [run](double serial)
+	{
+		run(0, [serial](double parallel)
+		{
+			// Each job in flight has a file open, so the scheduler's open file limit caps the parallelism too
+			int jobs = std::min(get_shared_work_stealing_pool().get_num_workers(),
+				get_shared_render_io_scheduler()->get_settings().m_max_open_sinks);
+			readbg() << "serial " << serial << " s, " << jobs
+				<< " jobs in parallel " << parallel << " s, speedup " << (parallel > 0.0 ? serial / parallel : 0.0) << "x\n";
+		});
+	});
+}
+
+// Decodes, analyzes, normalizes and writes each selected item into a file in a task graph,
+// one pipeline of 4 tasks per item
+struct normalize_job
+{
+	~normalize_job()
 	{
 		delete m_sink;
-		delete m_shifter;
 		delete m_src;
-		//readbg() << "irp task dtor " << m_id << "\n";
 	}
-	// Multithreading compatible code put in this method
-	// Stuff like ShowConsoleMsg, Main_OnCommand, Reaper object creation functions etc can't be used here
-	void run() override
+	PCM_source* m_src = nullptr;
+	PCM_sink* m_sink = nullptr;
+	int m_nch = 0;
+	double m_sr = 0.0;
+	std::vector<double> m_audio;
+	double m_peak = 0.0;
+};
+
+std::weak_ptr<task_graph> g_normalize_graph;
+
+void test_task_graph_normalize()
+{
+	if (g_normalize_graph.expired() == false)
+	{
+		readbg() << "Normalize task graph is still running\n";
+		return;
+	}
+	auto graph = std::make_shared<task_graph>();
+	char projpath[2048];
+	GetProjectPath(projpath, 2048);
+	for (int i = 0; i < CountSelectedMediaItems(nullptr); ++i)
 	{
-		if (m_shifter == nullptr || m_src == nullptr || m_sink == nullptr)
-			return;
-		double prate = 0.5;
-		m_shifter->SetQualityParameter(-1);
-		m_shifter->set_nch(m_src->GetNumChannels());
-		m_shifter->set_srate(m_src->GetSampleRate());
-		m_shifter->set_tempo(prate);
-		m_shifter->set_shift(1.0);
-		
-		int64_t srclenframes = m_src->GetLength()*m_src->GetSampleRate();
-		int64_t incounter = 0;
-		while (incounter < srclenframes)
+		MediaItem_Take* take = GetActiveTake(GetSelectedMediaItem(nullptr, i));
+		if (take == nullptr || is_source_audio(GetMediaItemTake_Source(take)).empty() == false)
+			continue;
+		// Reaper objects have to be created in the main thread
+		auto job = std::make_shared<normalize_job>();
+		job->m_src = GetMediaItemTake_Source(take)->Duplicate();
+		job->m_nch = job->m_src->GetNumChannels();
+		job->m_sr = job->m_src->GetSampleRate();
+		char cfg[] = { 'e','v','a','w', 32, 0 };
+		std::string outfn = std::string(projpath) + "/normalized_" + std::to_string(i) + ".wav";
+		job->m_sink = PCM_Sink_Create(outfn.c_str(), cfg, sizeof(cfg), job->m_nch, (int)job->m_sr, false);
+		if (job->m_sink == nullptr)
+			continue;
+		int decode = graph->add_task([job](IParallelTask& task)
 		{
-			ReaSample* shifter_in_buf = m_shifter->GetBuffer(m_bufsize*prate);
-			PCM_source_transfer_t transfer = { 0 };
-			transfer.length = m_bufsize*prate;
-			transfer.nch = m_src->GetNumChannels();
-			transfer.time_s = (double)incounter / m_src->GetSampleRate();
-			transfer.samplerate = m_src->GetSampleRate();
-			transfer.samples = shifter_in_buf;
-			m_src->GetSamples(&transfer);
-			int shifted_output = 0;
-			int sanity = 0;
-			while (shifted_output < m_bufsize)
+			const int bufsize = 65536;
+			int64_t lenframes = (int64_t)(job->m_src->GetLength()*job->m_sr);
+			job->m_audio.resize(lenframes*job->m_nch);
+			for (int64_t pos = 0; pos < lenframes; pos += bufsize)
 			{
-				
-				m_shifter->BufferDone(m_bufsize*prate);
-				shifted_output += m_shifter->GetSamples(m_bufsize, m_shifteroutbuf.data());
-				
-				++sanity;
-				if (sanity > 100)
-				{
-					//readbg() << "sanity failed";
-					break;
-				}
+				if (task.is_cancelled() == true)
+					return;
+				PCM_source_transfer_t transfer = { 0 };
+				transfer.time_s = pos / job->m_sr;
+				transfer.samplerate = job->m_sr;
+				transfer.nch = job->m_nch;
+				transfer.length = (int)std::min<int64_t>(bufsize, lenframes - pos);
+				transfer.samples = &job->m_audio[pos*job->m_nch];
+				job->m_src->GetSamples(&transfer);
+				task.set_progress((double)pos / lenframes);
 			}
-			int nch = m_src->GetNumChannels();
-			for (int i = 0; i < m_bufsize; ++i)
+		});
+		int analyze = graph->add_task([job](IParallelTask&)
+		{
+			for (double x : job->m_audio)
+				job->m_peak = std::max(job->m_peak, fabs(x));
+		}, { decode });
+		int transform = graph->add_task([job](IParallelTask&)
+		{
+			if (job->m_peak <= 0.0)
+				return;
+			double gain = 0.9 / job->m_peak;
+			for (double& x : job->m_audio)
+				x *= gain;
+		}, { analyze });
+		graph->add_task([job](IParallelTask& task)
+		{
+			const int bufsize = 65536;
+			std::vector<double> deinterleaved(bufsize*job->m_nch);
+			std::vector<double*> pointers(job->m_nch);
+			for (int i = 0; i < job->m_nch; ++i)
+				pointers[i] = &deinterleaved[i*bufsize];
+			int64_t lenframes = job->m_audio.size() / job->m_nch;
+			for (int64_t pos = 0; pos < lenframes; pos += bufsize)
 			{
-				for (int j = 0; j < nch; ++j)
-				{
-					m_sinkbufpointers[j][i] = m_shifteroutbuf[i*nch + j];
-				}
+				if (task.is_cancelled() == true)
+					return;
+				int n = (int)std::min<int64_t>(bufsize, lenframes - pos);
+				for (int i = 0; i < n; ++i)
+					for (int j = 0; j < job->m_nch; ++j)
+						pointers[j][i] = job->m_audio[(pos + i)*job->m_nch + j];
+				job->m_sink->WriteDoubles(pointers.data(), n, job->m_nch, 0, 1);
+				task.set_progress((double)pos / lenframes);
 			}
-			m_sink->WriteDoubles(m_sinkbufpointers.data(), m_bufsize, m_src->GetNumChannels(), 0, 1);
-			incounter += m_bufsize*prate;
-		}
+		}, { transform });
 	}
-	MediaItem* m_item = nullptr;
-	IReaperPitchShift* m_shifter = nullptr;
-	PCM_source* m_src = nullptr;
-	PCM_sink* m_sink = nullptr;
-	int m_bufsize = 16384;
-	std::vector<double> m_shifteroutbuf;
-	std::vector<double> m_sinkbuf;
-	std::vector<double*> m_sinkbufpointers;
-	int m_id = 0;
-};
+	if (graph->get_num_tasks() == 0)
+		return;
+	double t0 = time_precise();
+	graph->set_completion_callback([t0](task_graph& g)
+	{
+		int numskipped = 0;
+		for (int i = 0; i < g.get_num_tasks(); ++i)
+			if (g.get_task_state(i) == task_graph::task_state::Skipped)
+				++numskipped;
+		readbg() << g.get_num_tasks() / 4 << " items normalized in " << time_precise() - t0 << " seconds, "
+			<< numskipped << " tasks skipped\n";
+	});
+	g_normalize_graph = graph;
+	graph->start();
+}
 
-void test_irp_render(bool multithreaded)
+void cancel_task_graph_normalize()
 {
-	int numselitems = CountSelectedMediaItems(nullptr);
-	if (numselitems < 1)
+	auto graph = g_normalize_graph.lock();
+	if (graph == nullptr)
 		return;
-	std::vector<std::shared_ptr<IParallelTask>> tasks;
-	for (int i = 0; i < numselitems; ++i)
-	{
-		MediaItem* item = GetSelectedMediaItem(nullptr, i);
-		auto task = std::make_shared<irp_task>(item,i);
-		tasks.push_back(task);
-	}
-	double t0 = time_precise();
-	execute_parallel_tasks(tasks, multithreaded);
-	double t1 = time_precise();
-	readbg() << "all done in " << t1 - t0 << " seconds\n";
+	readbg() << "Cancelling normalize task graph at " << graph->get_progress()*100.0 << "% progress\n";
+	graph->cancel();
 }
 
 void test_netlib()
@@ -352,6 +384,55 @@ extern "C"
 				test_pcm_source(0);
 			});
 
+			add_action("MRP : Toggle audio callback timing window", "MRP_SHOW_CALLBACKTIMING", ToggleOff, [](action_entry&)
+			{
+				toggle_callback_timing_window(g_parent);
+			});
+
+			add_action("MRP : Preview selected item with prefetching", "MRP_PREFETCH_PREVIEW", CannotToggle, [](action_entry&)
+			{
+				toggle_prefetched_take_preview();
+			});
+
+			add_action("MRP : Insert generated audio item", "MRP_INSERT_GENERATED_ITEM", CannotToggle, [](action_entry&)
+			{
+				insert_generated_source_item([]() { return std::make_shared<MyTestAudioDSP>(); });
+			});
+
+			add_action("MRP : Insert generated audio item (DSP graph)", "MRP_INSERT_GENERATED_GRAPH_ITEM", CannotToggle, [](action_entry&)
+			{
+				insert_generated_source_item([]() { return make_test_dsp_graph(); });
+			});
+
+			add_action("MRP : Insert generated audio item (parallel layers)", "MRP_INSERT_GENERATED_LAYERS_ITEM", CannotToggle, [](action_entry&)
+			{
+				insert_generated_source_item([]()
+				{
+					std::vector<std::shared_ptr<MRP_AudioDSP>> layers;
+					for (int i = 0; i < 16; ++i)
+						layers.push_back(make_test_dsp_graph(110.0*(i + 1)));
+					auto result = std::make_shared<MRP_LayeredDSP>(layers);
+					result->set_gain(1.0 / layers.size());
+					return result;
+				});
+			});
+
+			add_action("MRP : Insert generated audio item (oscillator bank)", "MRP_INSERT_GENERATED_OSCBANK_ITEM", CannotToggle, [](action_entry&)
+			{
+				insert_generated_source_item([]() { return make_test_oscillator_bank(2000); });
+			});
+
+			add_action("MRP : Benchmark oscillator bank", "MRP_BENCHMARK_OSCBANK", CannotToggle, [](action_entry&)
+			{
+				benchmark_oscillator_bank();
+			});
+
+			add_action("MRP : Benchmark resampler modes", "MRP_BENCHMARK_RESAMPLERS", CannotToggle, [](action_entry&)
+			{
+				readbg() << "Benchmarking resamplers, this takes a while...\n";
+				print_resampler_benchmark(benchmark_resamplers(get_resampler_benchmark_configs()));
+			});
+
 			add_action("MRP : Test track range class", "MRP_TESTTRACKRANGE", CannotToggle, [](action_entry&)
 			{
 				test_track_range();
@@ -360,13 +441,81 @@ extern "C"
 			add_action("MRP : Render selected items with IReaperPitchShift (single threaded)", 
 				"MRP_TESTRENDER_IRP_SINGLETHREADED", CannotToggle, [](action_entry&)
 			{
-				test_irp_render(false);
+				render_selected_items_with_pitch_shifter(0.5, 1.0, 1);
 			});
 
 			add_action("MRP : Render selected items with IReaperPitchShift (multi threaded)",
 				"MRP_TESTRENDER_IRP_MULTITHREADED", CannotToggle, [](action_entry&)
 			{
-				test_irp_render(true);
+				render_selected_items_with_pitch_shifter(0.5, 1.0, 0);
+			});
+
+			add_action("MRP : Benchmark IReaperPitchShift render of selected items (serial vs thread pool)",
+				"MRP_BENCHMARK_IRP_RENDER", CannotToggle, [](action_entry&)
+			{
+				benchmark_irp_render();
+			});
+
+			add_action("MRP : Configure background render disk I/O", "MRP_CONFIGURE_RENDER_IO", CannotToggle, [](action_entry&)
+			{
+				render_io_settings settings = render_io_settings::load();
+				char buf[256];
+				sprintf(buf, "%d,%d,%d", settings.m_writer_threads, settings.m_max_open_sinks, settings.m_write_chunk_frames);
+				if (GetUserInputs("Background render disk I/O", 3, "Writer threads,Max open files,Frames per write", buf, sizeof(buf)) == false)
+					return;
+				int writers = 0, opensinks = 0, chunkframes = 0;
+				if (sscanf(buf, "%d,%d,%d", &writers, &opensinks, &chunkframes) != 3)
+					return;
+				settings.m_writer_threads = bound_value(1, writers, 16);
+				settings.m_max_open_sinks = bound_value(1, opensinks, 256);
+				settings.m_write_chunk_frames = bound_value(1024, chunkframes, 1 << 22);
+				settings.save();
+				shutdown_shared_render_io_scheduler();
+			});
+
+			add_action("MRP : Show audio buffer pool statistics", "MRP_AUDIO_BUFFER_POOL_STATS", CannotToggle, [](action_entry&)
+			{
+				audio_buffer_pool_stats stats = get_audio_buffer_pool().get_stats();
+				readbg() << "Buffers acquired " << stats.m_num_acquires << ", allocated " << stats.m_num_allocations
+					<< ", freed " << stats.m_num_frees << "\n";
+				readbg() << "In use " << stats.m_bytes_in_use / 1024 << " kB, peak " << stats.m_peak_bytes_in_use / 1024
+					<< " kB, cached " << stats.m_bytes_cached / 1024 << " kB\n";
+			});
+
+			add_action("MRP : Configure out-of-process render worker", "MRP_CONFIGURE_RENDER_WORKER", CannotToggle, [](action_entry&)
+			{
+				render_worker_settings settings = get_render_worker_client().get_settings();
+				char buf[4096];
+				sprintf(buf, "%d,%d,%d,%s", settings.m_enabled == true ? 1 : 0, settings.m_max_restarts,
+					settings.m_timeout_seconds, settings.m_worker_path.c_str());
+				if (GetUserInputs("Out-of-process render worker", 4,
+					"Use worker process (0/1),Max restarts per render,Timeout seconds,Worker path (empty : default),extrawidth=200",
+					buf, sizeof(buf)) == false)
+					return;
+				int enabled = 0, restarts = 0, timeout = 0, pathstart = 0;
+				if (sscanf(buf, "%d,%d,%d,%n", &enabled, &restarts, &timeout, &pathstart) != 3 || pathstart == 0)
+					return;
+				settings.m_enabled = enabled != 0;
+				settings.m_max_restarts = bound_value(0, restarts, 100);
+				settings.m_timeout_seconds = bound_value(1, timeout, 600);
+				settings.m_worker_path = buf + pathstart;
+				settings.save();
+				get_render_worker_client().set_settings(settings);
+			});
+
+			add_action("MRP : Test out-of-process render worker", "MRP_TEST_RENDER_WORKER", CannotToggle, [](action_entry&)
+			{
+				test_render_worker();
+			});
+
+			add_action("MRP : Normalize selected items to files with a task graph", "MRP_TASKGRAPH_NORMALIZE", CannotToggle, [](action_entry&)
+			{
+				test_task_graph_normalize();
+			});
+
+			add_action("MRP : Cancel normalizing selected items", "MRP_TASKGRAPH_NORMALIZE_CANCEL", CannotToggle, [](action_entry&)
+			{
+				cancel_task_graph_normalize();
 			});
 
 				// Add functions
@@ -374,6 +523,11 @@ extern "C"
 			func(MRP_DoublePointer);
 			func(MRP_IntPointer);
 			func(MRP_CalculateEnvelopeHash);
+			func(MRP_CreateEnvelopeChangeTracker);
+			func(MRP_DestroyEnvelopeChangeTracker);
+			func(MRP_EnvelopeChangeTrackerAdd);
+			func(MRP_GetChangedEnvelopes);
+			func(MRP_GetSourceTimingStats);
 			func(MRP_DoublePointerAsInt);
 			func(MRP_CastDoubleToInt);
 			func(MRP_ReturnMediaItem);
@@ -413,9 +567,8 @@ extern "C"
 			func(MRP_MultiplyArrays);
 			func(MRP_SetArrayValue);
 			func(MRP_GetArrayValue);
-#ifdef WIN32
 			func(MRP_MultiplyArraysMT);
-#endif
+			func(MRP_GenerateSineMT);
 #undef func
 
 			if (!rec->Register("hookcommand2", (void*)hookCommandProcEx)) { 
@@ -438,10 +591,16 @@ extern "C"
 				}
 			}		
 			start_or_stop_main_thread_executor(false);
+			start_or_stop_pcm_source_preparation(false);
 			return 1; // our plugin registered, return success
 		}
 		else {
+			start_or_stop_pcm_source_preparation(true);
 			test_pcm_source(1);
+			shutdown_render_worker_client();
+			shutdown_shared_render_io_scheduler();
+			stop_prefetched_take_preview();
+			shutdown_shared_work_stealing_pool();
 			start_or_stop_main_thread_executor(true);
 			return 0;
 		}
@@ -7,7 +7,20 @@
 #include "utilfuncs.h"
 #include "lice_control.h"
 #include "mrp_pcm_source.h"
+#include "mrp_dsp_graph.h"
+#include "mrp_layered_dsp.h"
+#include "mrp_prefetch_source.h"
+#include "mrp_oscillator_bank.h"
+#include "work_stealing_pool.h"
+#include "task_graph.h"
+#include "pitch_render_engine.h"
+#include "pitch_bend_renderer.h"
+#include "resampler_benchmark.h"
+#include "render_io_scheduler.h"
+#include "audio_buffer_pool.h"
+#include "render_worker_client.h"
 #include "xendynamicsprocessor.h"
 #include "mrp_audioaccessor.h"
+#include "envelope_change_tracker.h"
 #include "WDL/WDL/jnetlib/httpget.h"
 
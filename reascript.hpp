@@ -1,8 +1,6 @@
 #include "utilfuncs.h"
 #include <unordered_set>
-#ifdef WIN32
-#include <ppl.h>
-#endif
+#include "work_stealing_pool.h"
 struct in { // Convenience struct to cast void** to supported parameter types
 	void* v;
 
@@ -111,6 +109,25 @@ function_entry MRP_GenerateSine("void", "MRP_Array*,double,double", "array,sampl
 "Generate a sine wave into a MRP_Array"
 );
 
+function_entry MRP_GenerateSineMT("void", "MRP_Array*,double,double", "array,samplerate,frequency", [](params) {
+	if (g_active_mrp_arrays.count(arg[0]) == 0)
+	{
+		ReaScriptError("MRP_GenerateSineMT : passed in invalid MRP_Array");
+		return (void*)nullptr;
+	}
+	std::vector<double>& vecref = *(std::vector<double>*)arg[0];
+	double sr = bound_value(1.0, *(double*)arg[1], 1000000.0);
+	double hz = bound_value(0.0001, *(double*)arg[2], sr / 2.0);
+	parallel_for(0, vecref.size(), 0, [&vecref, sr, hz](int64_t start, int64_t end)
+	{
+		for (int64_t i = start; i < end; ++i)
+			vecref[i] = sin(2 * 3.141592653 / sr*hz*i);
+	});
+	return (void*)nullptr;
+},
+"Generate a sine wave into a MRP_Array. Uses multiple threads."
+);
+
 function_entry MRP_MultiplyArrays("void", "MRP_Array*,MRP_Array*,MRP_Array*", "array1, array2, array3", [](params) {
 	if (g_active_mrp_arrays.count(arg[0]) == 0 || g_active_mrp_arrays.count(arg[1]) == 0
 		|| g_active_mrp_arrays.count(arg[2]) == 0)
@@ -132,7 +149,7 @@ function_entry MRP_MultiplyArrays("void", "MRP_Array*,MRP_Array*,MRP_Array*", "a
 },
 "Multiply 2 MRP_Arrays of same length. Result is written to 3rd array."
 );
-#ifdef WIN32
+
 function_entry MRP_MultiplyArraysMT("void", "MRP_Array*,MRP_Array*,MRP_Array*", "array1, array2,array3", [](params) {
 	if (g_active_mrp_arrays.count(arg[0]) == 0 || g_active_mrp_arrays.count(arg[1]) == 0
 		|| g_active_mrp_arrays.count(arg[2]) == 0)
@@ -148,17 +165,20 @@ function_entry MRP_MultiplyArraysMT("void", "MRP_Array*,MRP_Array*,MRP_Array*",
 		ReaScriptError("MRP_MultiplyArraysMT : incompatible array lengths");
 		return (void*)nullptr;
 	}
-	Concurrency::parallel_for((size_t)0, vecref0.size(), (size_t)1, [&vecref0, &vecref1, &vecref2](size_t index) 
+	// Contiguous chunks keep the inner loop vectorizable and the per task overhead small
+	parallel_for(0, vecref0.size(), 0, [&vecref0, &vecref1, &vecref2](int64_t start, int64_t end)
 	{
-		vecref2[index] = vecref0[index] * vecref1[index];
+		const double* src0 = vecref0.data();
+		const double* src1 = vecref1.data();
+		double* dest = vecref2.data();
+		for (int64_t i = start; i < end; ++i)
+			dest[i] = src0[i] * src1[i];
 	});
 	return (void*)nullptr;
 },
 "Multiply 2 MRP_Arrays of same length. Result is written to 3rd array. Uses multiple threads."
 );
-#else
 
-#endif
 function_entry MRP_SetArrayValue("void", "MRP_Array*,int,double", "array, index, value", [](params) {
 	std::vector<double>& vecref0 = *(std::vector<double>*)arg[0];
 	int index = (in)arg[1];
@@ -230,6 +250,120 @@ function_entry MRP_CalculateEnvelopeHash("int", "TrackEnvelope*", "env", [](para
 "architectures."
 );
 
+std::unordered_set<void*> g_active_envelope_trackers;
+
+function_entry MRP_CreateEnvelopeChangeTracker("MRP_EnvelopeTracker*", "", "", [](params)
+{
+	envelope_change_tracker* tracker = new envelope_change_tracker;
+	g_active_envelope_trackers.insert((void*)tracker);
+	return_obj(tracker);
+},
+"Create an object that tracks changes in envelopes. Note that these will leak memory if they are not later destroyed with MRP_DestroyEnvelopeChangeTracker!"
+);
+
+function_entry MRP_DestroyEnvelopeChangeTracker("void", "MRP_EnvelopeTracker*", "tracker", [](params)
+{
+	if (g_active_envelope_trackers.count(arg[0]) == 0)
+	{
+		ReaScriptError("MRP_DestroyEnvelopeChangeTracker : passed in invalid MRP_EnvelopeTracker");
+		return_null;
+	}
+	delete (envelope_change_tracker*)arg[0];
+	g_active_envelope_trackers.erase(arg[0]);
+	return_null;
+},
+"Destroy a previously created MRP_EnvelopeTracker"
+);
+
+function_entry MRP_EnvelopeChangeTrackerAdd("int", "MRP_EnvelopeTracker*,TrackEnvelope*", "tracker,envelope", [](params)
+{
+	if (g_active_envelope_trackers.count(arg[0]) == 0)
+	{
+		ReaScriptError("MRP_EnvelopeChangeTrackerAdd : passed in invalid MRP_EnvelopeTracker");
+		return_int(-1);
+	}
+	envelope_change_tracker* tracker = (envelope_change_tracker*)arg[0];
+	TrackEnvelope* env = (TrackEnvelope*)arg[1];
+	if (env == nullptr)
+	{
+		ReaScriptError("MRP_EnvelopeChangeTrackerAdd : passed in null envelope");
+		return_int(-1);
+	}
+	return_int(tracker->add_envelope(env));
+},
+"Add an envelope to be tracked for changes. Returns the index of the envelope in the tracker, "
+"which is also its index in the array filled by MRP_GetChangedEnvelopes."
+);
+
+function_entry MRP_GetChangedEnvelopes("int", "MRP_EnvelopeTracker*,int,int,MRP_Array*", "tracker,token,pointsbudget,result", [](params)
+{
+	if (g_active_envelope_trackers.count(arg[0]) == 0)
+	{
+		ReaScriptError("MRP_GetChangedEnvelopes : passed in invalid MRP_EnvelopeTracker");
+		return_int(0);
+	}
+	if (g_active_mrp_arrays.count(arg[3]) == 0)
+	{
+		ReaScriptError("MRP_GetChangedEnvelopes : passed in invalid MRP_Array");
+		return_int(0);
+	}
+	envelope_change_tracker* tracker = (envelope_change_tracker*)arg[0];
+	int token = (in)arg[1];
+	int budget = (in)arg[2];
+	std::vector<double>& result = *(std::vector<double>*)arg[3];
+	int newtoken = tracker->poll(budget);
+	result.resize(tracker->get_num_envelopes());
+	for (int i = 0; i < tracker->get_num_envelopes(); ++i)
+	{
+		if (tracker->has_changed_since(i, token) == true)
+			result[i] = 1.0;
+		else result[i] = 0.0;
+	}
+	return_int(newtoken);
+},
+"Check all the envelopes of the tracker for changes. The result array is resized to the number of tracked envelopes "
+"and element i is set to 1 if envelope i has changed since token, otherwise 0. Returns the new token to pass in on the next call. "
+"Pass 0 as the token to get the changes since the envelopes were added. "
+"Pointsbudget limits how many envelope points are rehashed per call, so that very large envelopes are checked over several calls. "
+"Added and removed points are always detected immediately. Use 0 to check all the points on every call."
+);
+
+function_entry MRP_GetSourceTimingStats("int", "MediaItem_Take*,bool,MRP_Array*", "take,reset,result", [](params)
+{
+	if (g_active_mrp_arrays.count(arg[2]) == 0)
+	{
+		ReaScriptError("MRP_GetSourceTimingStats : passed in invalid MRP_Array");
+		return_int(0);
+	}
+	MRP_PCMSource* src = nullptr;
+	if (arg[0] == nullptr)
+		src = get_test_pcm_source();
+	else src = get_take_mrp_pcm_source((MediaItem_Take*)arg[0]);
+	if (src == nullptr)
+	{
+		ReaScriptError("MRP_GetSourceTimingStats : take doesn't have a MRP source or the preview source hasn't been played");
+		return_int(0);
+	}
+	int reset = in(arg[1]);
+	std::vector<double>& result = *(std::vector<double>*)arg[2];
+	callback_timing_stats stats = src->get_timing()->get_stats();
+	result.resize(4 + callback_timing_stats::num_histogram_bins);
+	result[0] = stats.mean_load;
+	result[1] = stats.worst_load;
+	result[2] = stats.worst_ms;
+	result[3] = stats.num_overruns;
+	for (int i = 0; i < callback_timing_stats::num_histogram_bins; ++i)
+		result[4 + i] = stats.histogram[i];
+	if (reset != 0)
+		src->get_timing()->reset();
+	return_int(stats.num_callbacks);
+},
+"Get the timing statistics of the latest audio callbacks (at most 4096) of the MRP source of a take, or of the preview source "
+"if take is null. Returns the number of callbacks. The result array is set to mean load percentage, worst load percentage, "
+"worst callback time in milliseconds, number of overruns (callbacks that took longer than the audio they produced), followed by "
+"a histogram of the loads in 21 bins 5% wide, the last one counting the overruns. If reset is true, the statistics start over after the call."
+);
+
 function_entry MRP_CreateWindow("MRP_Window*", "const char*", "title", [](params)
 {
 	const char* wtitle = (const char*)arg[0];
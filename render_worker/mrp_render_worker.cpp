@@ -0,0 +1,108 @@
+// The render worker process. The plugin starts it with the name of a WDL_SHM_Connection and it does the
+// render jobs sent over the connection, until it's told to quit or the connection is lost.
+// Built as a console program from this file, source/render_worker_jobs.cpp and
+// library/WDL/WDL/shm_connection.cpp, with header and library in the include path, and installed
+// into the UserPlugins folder as mrp_render_worker (mrp_render_worker.exe on Windows).
+// It doesn't use the Reaper API, so only jobs that are plain DSP can be done here.
+
+#include "render_worker_protocol.h"
+#include "render_worker_jobs.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <thread>
+// Last, because the Windows and SWELL headers define min and max macros
+#include "WDL/WDL/shm_connection.h"
+
+static void send_error(WDL_Queue& q, int job, const std::string& text)
+{
+	void* dest = render_worker_add_message(q, render_worker_message::error, job, (int)text.size() + 1);
+	memcpy(dest, text.c_str(), text.size() + 1);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage : mrp_render_worker <connection name>\n");
+		return 1;
+	}
+	WDL_SHM_Connection connection(true, argv[1], render_worker_shm_size, 10);
+	int32_t version = render_worker_protocol_version;
+	memcpy(render_worker_add_message(connection.send_queue, render_worker_message::hello, 0, sizeof(version)),
+		&version, sizeof(version));
+	render_worker_job job;
+	int jobid = -1;
+	while (true)
+	{
+		// The plugin went away or couldn't be connected to
+		int r = connection.Run();
+		if (r < 0)
+			return 0;
+		bool didwork = false;
+		const char* payload = nullptr;
+		while (const render_worker_message_header* hdr = render_worker_peek_message(connection.recv_queue, payload))
+		{
+			const render_worker_message_header h = *hdr;
+			didwork = true;
+			if (h.m_type == (int32_t)render_worker_message::quit)
+				return 0;
+			if (h.m_type == (int32_t)render_worker_message::begin_job)
+			{
+				std::string err;
+				jobid = h.m_job;
+				if (job.read_header(payload, h.m_size, err) == false)
+				{
+					send_error(connection.send_queue, h.m_job, err);
+					jobid = -1;
+				}
+			}
+			else if (h.m_type == (int32_t)render_worker_message::block && h.m_job == jobid)
+			{
+				render_worker_block_header bh;
+				if (h.m_size >= (int)sizeof(bh))
+					memcpy(&bh, payload, sizeof(bh));
+				if (h.m_size < (int)sizeof(bh) || bh.m_frames < 0 || (int64_t)sizeof(bh) + (int64_t)bh.m_frames*job.m_nch*(int64_t)sizeof(double) > h.m_size)
+				{
+					send_error(connection.send_queue, h.m_job, "Invalid block");
+					jobid = -1;
+				}
+				else
+				{
+					// The input is processed where it was received and the output is written straight into the send queue
+					const size_t bytes = (size_t)bh.m_frames*job.m_nch*sizeof(double);
+					char* dest = (char*)render_worker_add_message(connection.send_queue, render_worker_message::block,
+						jobid, (int)(sizeof(bh) + bytes));
+					render_worker_block_stats stats;
+					process_render_worker_block(job, bh.m_start_frame, (const double*)(payload + sizeof(bh)),
+						(double*)(dest + sizeof(bh)), bh.m_frames, stats);
+					bh.m_num_clipped = (int32_t)stats.m_num_clipped;
+					bh.m_max_clipped = stats.m_max_clipped;
+					memcpy(dest, &bh, sizeof(bh));
+				}
+			}
+			else if (h.m_type == (int32_t)render_worker_message::end_job && h.m_job == jobid)
+			{
+				render_worker_add_message(connection.send_queue, render_worker_message::end_job, jobid, 0);
+				jobid = -1;
+			}
+			// Keep alives and the blocks of refused jobs are skipped
+			connection.recv_queue.Advance(sizeof(h) + h.m_size);
+			// Sends the processed blocks while the next ones are being received
+			if (connection.send_queue.Available() >= render_worker_shm_size / 2)
+				connection.Run();
+		}
+		connection.recv_queue.Compact();
+		if (connection.WantSendKeepAlive() == true)
+			render_worker_add_message(connection.send_queue, render_worker_message::keep_alive, 0, 0);
+		if (r == 0 && didwork == false)
+		{
+#ifdef _WIN32
+			WaitForSingleObject(connection.GetWaitEvent(), 10);
+#else
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+		}
+	}
+}
@@ -0,0 +1,242 @@
+#include "audio_buffer_pool.h"
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+#ifdef WIN32
+#include <malloc.h>
+#endif
+
+static double* allocate_aligned(size_t numdoubles)
+{
+	size_t bytes = std::max<size_t>(1, numdoubles) * sizeof(double);
+#ifdef WIN32
+	return (double*)_aligned_malloc(bytes, audio_buffer_pool::alignment);
+#else
+	void* result = nullptr;
+	if (posix_memalign(&result, audio_buffer_pool::alignment, bytes) != 0)
+		return nullptr;
+	return (double*)result;
+#endif
+}
+
+static void free_aligned(double* data)
+{
+#ifdef WIN32
+	_aligned_free(data);
+#else
+	free(data);
+#endif
+}
+
+// Sizes are counted in units of 64 doubles. Class 4*e+s holds (4+s)*2^e units, s being 0..3.
+static int size_class_of(size_t numdoubles, size_t& capacity)
+{
+	size_t units = std::max<size_t>(4, (numdoubles + 63) / 64);
+	int e = 0;
+	while ((units >> e) >= 8)
+		++e;
+	size_t s = (units + ((size_t)1 << e) - 1) >> e;
+	if (s == 8)
+	{
+		++e;
+		s = 4;
+	}
+	capacity = (s << e) * 64;
+	return e * 4 + (int)(s - 4);
+}
+
+static size_t size_class_capacity(int sizeclass)
+{
+	return ((size_t)(4 + sizeclass % 4) << (sizeclass / 4)) * 64;
+}
+
+pooled_buffer & pooled_buffer::operator=(pooled_buffer && other) noexcept
+{
+	if (this != &other)
+	{
+		reset();
+		m_pool = other.m_pool;
+		m_data = other.m_data;
+		m_size = other.m_size;
+		m_capacity = other.m_capacity;
+		m_size_class = other.m_size_class;
+		other.m_pool = nullptr;
+		other.m_data = nullptr;
+		other.m_size = 0;
+		other.m_capacity = 0;
+		other.m_size_class = -1;
+	}
+	return *this;
+}
+
+void pooled_buffer::resize(size_t size)
+{
+	if (size <= m_capacity)
+	{
+		m_size = size;
+		return;
+	}
+	audio_buffer_pool* pool = m_pool != nullptr ? m_pool : &get_audio_buffer_pool();
+	*this = pool->acquire(size);
+}
+
+void pooled_buffer::reset()
+{
+	if (m_data != nullptr)
+		m_pool->release(m_data, m_capacity, m_size_class);
+	m_data = nullptr;
+	m_size = 0;
+	m_capacity = 0;
+	m_size_class = -1;
+}
+
+audio_buffer_pool::audio_buffer_pool(size_t maxcachedbytes) :
+	m_classes(new size_class[num_size_classes]), m_max_cached_bytes(maxcachedbytes)
+{
+}
+
+audio_buffer_pool::~audio_buffer_pool()
+{
+	trim();
+}
+
+pooled_buffer audio_buffer_pool::acquire(size_t size)
+{
+	pooled_buffer result;
+	size_t capacity = 0;
+	int sizeclass = size_class_of(size, capacity);
+	double* data = nullptr;
+	if (sizeclass < num_size_classes)
+	{
+		size_class& c = m_classes[sizeclass];
+		std::lock_guard<std::mutex> locker(c.m_mutex);
+		if (c.m_free.empty() == false)
+		{
+			data = c.m_free.back();
+			c.m_free.pop_back();
+			m_bytes_cached -= capacity * sizeof(double);
+		}
+	}
+	else
+	{
+		sizeclass = -1;
+		capacity = size;
+	}
+	if (data == nullptr)
+	{
+		data = allocate_aligned(capacity);
+		if (data == nullptr)
+			throw std::bad_alloc();
+		++m_num_allocations;
+	}
+	++m_num_acquires;
+	int64_t inuse = m_bytes_in_use.fetch_add(capacity * sizeof(double)) + capacity * sizeof(double);
+	int64_t peak = m_peak_bytes_in_use.load();
+	while (inuse > peak && m_peak_bytes_in_use.compare_exchange_weak(peak, inuse) == false)
+		;
+	result.m_pool = this;
+	result.m_data = data;
+	result.m_size = size;
+	result.m_capacity = capacity;
+	result.m_size_class = sizeclass;
+	return result;
+}
+
+void audio_buffer_pool::release(double * data, size_t capacity, int sizeclass)
+{
+	const int64_t bytes = capacity * sizeof(double);
+	m_bytes_in_use -= bytes;
+	if (sizeclass >= 0 && m_bytes_cached.load() + bytes <= (int64_t)m_max_cached_bytes)
+	{
+		size_class& c = m_classes[sizeclass];
+		std::lock_guard<std::mutex> locker(c.m_mutex);
+		c.m_free.push_back(data);
+		m_bytes_cached += bytes;
+		return;
+	}
+	free_aligned(data);
+	++m_num_frees;
+}
+
+audio_buffer_pool_stats audio_buffer_pool::get_stats() const
+{
+	audio_buffer_pool_stats result;
+	result.m_num_acquires = m_num_acquires;
+	result.m_num_allocations = m_num_allocations;
+	result.m_num_frees = m_num_frees;
+	result.m_bytes_in_use = m_bytes_in_use;
+	result.m_peak_bytes_in_use = m_peak_bytes_in_use;
+	result.m_bytes_cached = m_bytes_cached;
+	return result;
+}
+
+void audio_buffer_pool::trim()
+{
+	for (int i = 0; i < num_size_classes; ++i)
+	{
+		size_class& c = m_classes[i];
+		std::lock_guard<std::mutex> locker(c.m_mutex);
+		for (double* data : c.m_free)
+		{
+			free_aligned(data);
+			m_bytes_cached -= size_class_capacity(i) * sizeof(double);
+			++m_num_frees;
+		}
+		c.m_free.clear();
+	}
+}
+
+audio_buffer_pool& get_audio_buffer_pool()
+{
+	static audio_buffer_pool pool;
+	return pool;
+}
+
+double** audio_arena::allocate_channels(int nch, size_t frames)
+{
+	double** pointers = allocate<double*>(nch);
+	// Each channel starts at a 64 byte boundary
+	size_t stride = (frames + 7) & ~(size_t)7;
+	double* data = allocate<double>(stride*nch);
+	for (int i = 0; i < nch; ++i)
+		pointers[i] = data + stride*i;
+	return pointers;
+}
+
+void audio_arena::reset()
+{
+	m_current_block = 0;
+	m_offset = 0;
+	m_bytes_allocated = 0;
+}
+
+void audio_arena::release()
+{
+	m_blocks.clear();
+	reset();
+}
+
+void* audio_arena::allocate_bytes(size_t bytes)
+{
+	bytes = (std::max<size_t>(1, bytes) + audio_buffer_pool::alignment - 1) & ~(audio_buffer_pool::alignment - 1);
+	while (m_current_block < m_blocks.size())
+	{
+		pooled_buffer& block = m_blocks[m_current_block];
+		if (m_offset + bytes <= block.capacity() * sizeof(double))
+		{
+			void* result = (char*)block.data() + m_offset;
+			m_offset += bytes;
+			m_bytes_allocated += bytes;
+			return result;
+		}
+		// The rest of this block is left unused until the next reset
+		++m_current_block;
+		m_offset = 0;
+	}
+	size_t doubles = std::max(m_block_size, bytes / sizeof(double));
+	m_blocks.push_back(m_pool.acquire(doubles));
+	m_current_block = m_blocks.size() - 1;
+	m_offset = bytes;
+	m_bytes_allocated += bytes;
+	return m_blocks.back().data();
+}
@@ -0,0 +1,68 @@
+#include "callback_timing.h"
+#include <cmath>
+
+// Entry layout : elapsed time in microseconds in the upper 24 bits, the time budget in microseconds
+// in the next 24 bits and the block size in the lowest 16 bits. The values are clamped to fit.
+static uint64_t pack_timing(uint64_t elapsed_us, uint64_t budget_us, uint64_t nframes)
+{
+	const uint64_t max24 = (1 << 24) - 1;
+	if (elapsed_us > max24)
+		elapsed_us = max24;
+	if (budget_us > max24)
+		budget_us = max24;
+	if (nframes > 65535)
+		nframes = 65535;
+	return (elapsed_us << 40) | (budget_us << 16) | nframes;
+}
+
+callback_timing_ring::callback_timing_ring()
+{
+	for (auto& e : m_entries)
+		e.store(0);
+}
+
+void callback_timing_ring::record(double elapsed_seconds, int nframes, double samplerate) noexcept
+{
+	if (nframes < 1 || samplerate <= 0.0)
+		return;
+	uint64_t elapsed_us = (uint64_t)(elapsed_seconds*1000000.0);
+	uint64_t budget_us = (uint64_t)(nframes / samplerate*1000000.0);
+	uint64_t pos = m_write_position.fetch_add(1, std::memory_order_acq_rel);
+	m_entries[pos % ring_size].store(pack_timing(elapsed_us, budget_us, nframes), std::memory_order_release);
+}
+
+callback_timing_stats callback_timing_ring::get_stats(int maxcallbacks) const
+{
+	callback_timing_stats result;
+	uint64_t end = m_write_position.load(std::memory_order_acquire);
+	uint64_t start = m_reset_position.load();
+	if (maxcallbacks > ring_size)
+		maxcallbacks = ring_size;
+	if (end - start > (uint64_t)maxcallbacks)
+		start = end - maxcallbacks;
+	double loadsum = 0.0;
+	for (uint64_t i = start; i < end; ++i)
+	{
+		uint64_t entry = m_entries[i % ring_size].load(std::memory_order_acquire);
+		double elapsed_us = (double)(entry >> 40);
+		double budget_us = (double)((entry >> 16) & 0xffffff);
+		if (budget_us <= 0.0)
+			continue;
+		double load = elapsed_us / budget_us*100.0;
+		loadsum += load;
+		++result.num_callbacks;
+		if (load > result.worst_load)
+			result.worst_load = load;
+		if (elapsed_us / 1000.0 > result.worst_ms)
+			result.worst_ms = elapsed_us / 1000.0;
+		if (load >= 100.0)
+			++result.num_overruns;
+		int bin = (int)(load / 5.0);
+		if (bin >= callback_timing_stats::num_histogram_bins)
+			bin = callback_timing_stats::num_histogram_bins - 1;
+		++result.histogram[bin];
+	}
+	if (result.num_callbacks > 0)
+		result.mean_load = loadsum / result.num_callbacks;
+	return result;
+}
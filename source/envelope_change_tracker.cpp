@@ -0,0 +1,200 @@
+#include "envelope_change_tracker.h"
+#include "utilfuncs.h"
+
+int envelope_change_tracker::add_envelope(TrackEnvelope* env)
+{
+	entry e;
+	e.m_reaper_env = env;
+	if (is_alive(e) == true)
+	{
+		e.m_num_points = count_points(e);
+		rehash_all(e);
+	}
+	m_entries.push_back(e);
+	return (int)m_entries.size() - 1;
+}
+
+int envelope_change_tracker::add_envelope(std::shared_ptr<breakpoint_envelope> env)
+{
+	entry e;
+	e.m_mrp_env = env;
+	e.m_is_mrp_env = true;
+	if (is_alive(e) == true)
+	{
+		e.m_num_points = count_points(e);
+		rehash_all(e);
+	}
+	m_entries.push_back(e);
+	return (int)m_entries.size() - 1;
+}
+
+int envelope_change_tracker::poll(int points_budget)
+{
+	int newgen = m_generation + 1;
+	bool anychanged = false;
+	// Point count checks are cheap, so those are always done for all envelopes
+	for (auto& e : m_entries)
+	{
+		bool changed = false;
+		if (is_alive(e) == false)
+		{
+			if (e.m_num_points != -1)
+			{
+				e.m_num_points = -1;
+				e.m_range_hashes.clear();
+				changed = true;
+			}
+		}
+		else
+		{
+			int numpoints = count_points(e);
+			if (numpoints != e.m_num_points)
+			{
+				e.m_num_points = numpoints;
+				rehash_all(e);
+				changed = true;
+			}
+			else if (points_budget <= 0)
+			{
+				for (int i = 0; i < e.m_range_hashes.size(); ++i)
+				{
+					if (revalidate_range(e, i) == true)
+						changed = true;
+				}
+			}
+		}
+		if (changed == true)
+		{
+			e.m_changed_at = newgen;
+			anychanged = true;
+		}
+	}
+	if (points_budget > 0 && m_entries.empty() == false)
+	{
+		int total_ranges = 0;
+		for (auto& e : m_entries)
+			total_ranges += (int)e.m_range_hashes.size();
+		// Ranges are hashed whole, so a budget below the range size still checks one range per poll,
+		// otherwise the revalidation would never advance
+		int ranges_to_check = std::min(total_ranges, std::max(1, points_budget / m_points_per_range));
+		int checked = 0;
+		int visited_entries = 0;
+		while (checked < ranges_to_check && visited_entries <= (int)m_entries.size())
+		{
+			if (m_next_entry >= m_entries.size())
+				m_next_entry = 0;
+			entry& e = m_entries[m_next_entry];
+			if (e.m_next_range >= e.m_range_hashes.size())
+			{
+				// This envelope has been gone through, move on to the next one
+				e.m_next_range = 0;
+				++m_next_entry;
+				++visited_entries;
+				continue;
+			}
+			visited_entries = 0;
+			if (revalidate_range(e, e.m_next_range) == true)
+			{
+				e.m_changed_at = newgen;
+				anychanged = true;
+			}
+			++e.m_next_range;
+			++checked;
+		}
+	}
+	if (anychanged == true)
+		m_generation = newgen;
+	return m_generation;
+}
+
+bool envelope_change_tracker::has_changed_since(int index, int token) const
+{
+	if (index < 0 || index >= m_entries.size())
+		return false;
+	return m_entries[index].m_changed_at > token;
+}
+
+uint64_t envelope_change_tracker::get_hash(int index) const
+{
+	if (index < 0 || index >= m_entries.size())
+		return 0;
+	// Combine the range hashes into one
+	const entry& e = m_entries[index];
+	uint64_t h = WDL_FNV64_IV;
+	for (auto& rh : e.m_range_hashes)
+		h = WDL_FNV64(h, (const unsigned char*)&rh, sizeof(uint64_t));
+	return h;
+}
+
+bool envelope_change_tracker::is_alive(entry& e) const
+{
+	if (e.m_is_mrp_env == true)
+		return e.m_mrp_env.expired() == false;
+	return e.m_reaper_env != nullptr && ValidatePtr(e.m_reaper_env, "TrackEnvelope*") == true;
+}
+
+int envelope_change_tracker::count_points(entry& e) const
+{
+	if (e.m_is_mrp_env == true)
+	{
+		auto env = e.m_mrp_env.lock();
+		if (env != nullptr)
+			return env->get_num_points();
+		return -1;
+	}
+	return CountEnvelopePoints(e.m_reaper_env);
+}
+
+uint64_t envelope_change_tracker::hash_range(entry& e, int range) const
+{
+	int startpoint = range*m_points_per_range;
+	int endpoint = std::min(startpoint + m_points_per_range, e.m_num_points);
+	uint64_t h = WDL_FNV64_IV;
+	if (e.m_is_mrp_env == true)
+	{
+		auto env = e.m_mrp_env.lock();
+		if (env == nullptr)
+			return h;
+		endpoint = std::min(endpoint, env->get_num_points());
+		for (int i = startpoint; i < endpoint; ++i)
+		{
+			const envbreakpoint& pt = env->get_point(i);
+			envelope_point_hash_data data;
+			data.time = pt.get_x();
+			data.value = pt.get_y();
+			data.tension = pt.get_param1();
+			data.shape = pt.get_shape();
+			h = hash_envelope_point(h, data);
+		}
+		return h;
+	}
+	for (int i = startpoint; i < endpoint; ++i)
+	{
+		envelope_point_hash_data data;
+		GetEnvelopePoint(e.m_reaper_env, i, &data.time, &data.value, &data.shape, &data.tension, nullptr);
+		h = hash_envelope_point(h, data);
+	}
+	return h;
+}
+
+bool envelope_change_tracker::revalidate_range(entry& e, int range)
+{
+	uint64_t h = hash_range(e, range);
+	if (h != e.m_range_hashes[range])
+	{
+		e.m_range_hashes[range] = h;
+		return true;
+	}
+	return false;
+}
+
+void envelope_change_tracker::rehash_all(entry& e)
+{
+	int numranges = 0;
+	if (e.m_num_points > 0)
+		numranges = (e.m_num_points + m_points_per_range - 1) / m_points_per_range;
+	e.m_range_hashes.resize(numranges);
+	for (int i = 0; i < numranges; ++i)
+		e.m_range_hashes[i] = hash_range(e, i);
+	e.m_next_range = 0;
+}
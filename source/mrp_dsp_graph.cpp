@@ -0,0 +1,271 @@
+#include "mrp_dsp_graph.h"
+#include "utilfuncs.h"
+#include <functional>
+
+int MRP_DSPGraph::add_node(std::shared_ptr<MRP_DSPNode> node)
+{
+	node_entry entry;
+	entry.m_node = node;
+	entry.m_inputs.resize(node->get_num_inputs());
+	m_nodes.push_back(entry);
+	return (int)m_nodes.size() - 1;
+}
+
+void MRP_DSPGraph::remove_node(int id)
+{
+	if (node_exists(id) == false)
+		return;
+	// Keep the ids of the other nodes unchanged
+	m_nodes[id] = node_entry();
+	for (auto& e : m_nodes)
+		for (auto& input : e.m_inputs)
+			if (input.m_node == id)
+				input = connection();
+	if (m_output.m_node == id)
+		m_output = connection();
+}
+
+bool MRP_DSPGraph::node_exists(int id) const
+{
+	return id >= 0 && id < (int)m_nodes.size() && m_nodes[id].m_node != nullptr;
+}
+
+bool MRP_DSPGraph::connect(int srcnode, int srcport, int destnode, int destport)
+{
+	if (node_exists(srcnode) == false || node_exists(destnode) == false)
+		return false;
+	MRP_DSPNode* src = m_nodes[srcnode].m_node.get();
+	MRP_DSPNode* dest = m_nodes[destnode].m_node.get();
+	if (srcport < 0 || srcport >= src->get_num_outputs() || destport < 0 || destport >= dest->get_num_inputs())
+		return false;
+	if (src->get_output_type(srcport) != dest->get_input_type(destport))
+		return false;
+	m_nodes[destnode].m_inputs[destport].m_node = srcnode;
+	m_nodes[destnode].m_inputs[destport].m_port = srcport;
+	return true;
+}
+
+void MRP_DSPGraph::disconnect(int destnode, int destport)
+{
+	if (node_exists(destnode) == false || destport < 0 || destport >= (int)m_nodes[destnode].m_inputs.size())
+		return;
+	m_nodes[destnode].m_inputs[destport] = connection();
+}
+
+bool MRP_DSPGraph::set_output(int node, int port)
+{
+	if (node_exists(node) == false || port < 0 || port >= m_nodes[node].m_node->get_num_outputs())
+		return false;
+	if (m_nodes[node].m_node->get_output_type(port) != MRP_PortType::Audio)
+		return false;
+	m_output.m_node = node;
+	m_output.m_port = port;
+	return true;
+}
+
+bool MRP_DSPGraph::commit()
+{
+	if (node_exists(m_output.m_node) == false)
+		return false;
+	// Order the nodes the output depends on so that each node comes after the nodes connected to its inputs
+	std::vector<int> order;
+	std::vector<int> state(m_nodes.size(), 0); // 0 not visited, 1 being visited, 2 done
+	bool has_cycle = false;
+	std::function<void(int)> visit = [&](int id)
+	{
+		if (state[id] == 2 || has_cycle == true)
+			return;
+		if (state[id] == 1)
+		{
+			has_cycle = true;
+			return;
+		}
+		state[id] = 1;
+		for (auto& input : m_nodes[id].m_inputs)
+			if (input.m_node >= 0)
+				visit(input.m_node);
+		state[id] = 2;
+		order.push_back(id);
+	};
+	visit(m_output.m_node);
+	if (has_cycle == true)
+		return false;
+	std::vector<int> step_of_node(m_nodes.size(), -1);
+	for (int i = 0; i < (int)order.size(); ++i)
+		step_of_node[order[i]] = i;
+	// Last step that reads each output port, -1 if nothing reads it
+	std::vector<std::vector<int>> last_use(m_nodes.size());
+	for (int id : order)
+		last_use[id].assign(m_nodes[id].m_node->get_num_outputs(), -1);
+	for (int id : order)
+		for (auto& input : m_nodes[id].m_inputs)
+			if (input.m_node >= 0)
+				last_use[input.m_node][input.m_port] = std::max(last_use[input.m_node][input.m_port], step_of_node[id]);
+	// Assign the scratch buffers. Outputs of a step are assigned before its inputs are released,
+	// so a node never gets the same buffer as input and output.
+	std::vector<std::vector<int>> buffer_of_port(m_nodes.size());
+	std::vector<int> free_buffers;
+	int num_buffers = 0;
+	auto get_buffer = [&]()
+	{
+		if (free_buffers.empty() == false)
+		{
+			int result = free_buffers.back();
+			free_buffers.pop_back();
+			return result;
+		}
+		return num_buffers++;
+	};
+	for (int i = 0; i < (int)order.size(); ++i)
+	{
+		int id = order[i];
+		int numouts = m_nodes[id].m_node->get_num_outputs();
+		buffer_of_port[id].resize(numouts);
+		for (int j = 0; j < numouts; ++j)
+			buffer_of_port[id][j] = get_buffer();
+		// An output can feed several inputs of the same node, so its last use is set to -2 when its buffer
+		// is released, to release it only once
+		for (auto& input : m_nodes[id].m_inputs)
+			if (input.m_node >= 0 && last_use[input.m_node][input.m_port] == i)
+			{
+				free_buffers.push_back(buffer_of_port[input.m_node][input.m_port]);
+				last_use[input.m_node][input.m_port] = -2;
+			}
+		for (int j = 0; j < numouts; ++j)
+			if (last_use[id][j] == -1 && (id != m_output.m_node || j != m_output.m_port))
+				free_buffers.push_back(buffer_of_port[id][j]);
+	}
+	const bool prepared = m_is_prepared.load();
+	int nch = prepared == true ? m_prepared_nch : m_num_channels;
+	int maxframes = prepared == true ? m_prepared_bufsize : 4096;
+	double sr = prepared == true ? m_prepared_sr : m_samplerate;
+	auto sched = std::make_shared<schedule>();
+	sched->m_nch = nch;
+	sched->m_sr = sr;
+	sched->m_maxframes = maxframes;
+	sched->m_buffers.resize(num_buffers);
+	for (auto& e : sched->m_buffers)
+		e.resize(nch*maxframes);
+	sched->m_silence.resize(nch*maxframes);
+	for (int id : order)
+	{
+		node_entry& entry = m_nodes[id];
+		if (entry.m_prepared_nch != nch || entry.m_prepared_sr != sr || entry.m_prepared_maxframes != maxframes)
+		{
+			entry.m_node->prepare(nch, sr, maxframes);
+			entry.m_prepared_nch = nch;
+			entry.m_prepared_sr = sr;
+			entry.m_prepared_maxframes = maxframes;
+		}
+		schedule::step step;
+		step.m_node = entry.m_node.get();
+		step.m_first_input = (int)sched->m_ports.size();
+		for (auto& input : entry.m_inputs)
+		{
+			if (input.m_node >= 0)
+				sched->m_ports.push_back(sched->m_buffers[buffer_of_port[input.m_node][input.m_port]].data());
+			else sched->m_ports.push_back(sched->m_silence.data());
+		}
+		step.m_first_output = (int)sched->m_ports.size();
+		for (int bufindex : buffer_of_port[id])
+			sched->m_ports.push_back(sched->m_buffers[bufindex].data());
+		sched->m_steps.push_back(step);
+		sched->m_nodes.push_back(entry.m_node);
+	}
+	sched->m_output = sched->m_buffers[buffer_of_port[m_output.m_node][m_output.m_port]].data();
+	m_num_scratch_buffers = num_buffers;
+	m_schedule.publish(sched);
+	return true;
+}
+
+void MRP_DSPGraph::prepare_audio(int numchans, double sr, int expected_max_bufsize)
+{
+	m_prepared_nch = numchans;
+	m_prepared_sr = sr;
+	m_prepared_bufsize = std::max(1, expected_max_bufsize);
+	m_is_prepared = true;
+}
+
+void MRP_DSPGraph::process_audio(double * buf, int nch, double sr, int nframes)
+{
+	schedule* sched = m_schedule.acquire();
+	// Not yet committed for this format
+	if (sched == nullptr || sched->m_nch != nch || sched->m_sr != sr)
+	{
+		for (int i = 0; i < nframes*nch; ++i)
+			buf[i] = 0.0;
+		return;
+	}
+	// Reaper's block may be larger than the scratch buffers, so process in pieces if needed
+	int done = 0;
+	while (done < nframes)
+	{
+		int n = std::min(nframes - done, sched->m_maxframes);
+		double** ports = sched->m_ports.data();
+		for (auto& step : sched->m_steps)
+			step.m_node->process(ports + step.m_first_input, ports + step.m_first_output, nch, sr, n);
+		for (int i = 0; i < n*nch; ++i)
+			buf[done*nch + i] = sched->m_output[i];
+		done += n;
+	}
+}
+
+void MRP_DSPGraph::release_audio()
+{
+	m_is_prepared = false;
+}
+
+void MRP_DSPGraph::seek(double seconds)
+{
+	schedule* sched = m_schedule.acquire();
+	if (sched == nullptr)
+		return;
+	for (auto& step : sched->m_steps)
+		step.m_node->seek(seconds);
+}
+
+void MRP_SineNode::process(const double * const * inputs, double * const * outputs, int nch, double sr, int nframes)
+{
+	double* out = outputs[0];
+	for (int i = 0; i < nframes; ++i)
+	{
+		double sample = sin(2 * 3.141592653*m_hz*m_pos);
+		for (int j = 0; j < nch; ++j)
+			out[i*nch + j] = sample;
+		m_pos += 1.0 / sr;
+	}
+}
+
+void MRP_EnvelopeNode::process(const double * const * inputs, double * const * outputs, int nch, double sr, int nframes)
+{
+	m_env.interpolate_block(m_pos, 1.0 / sr, outputs[0], nframes);
+	m_pos += nframes / sr;
+}
+
+void MRP_GainNode::process(const double * const * inputs, double * const * outputs, int nch, double sr, int nframes)
+{
+	const double* audio = inputs[0];
+	const double* gain = inputs[1];
+	double* out = outputs[0];
+	for (int i = 0; i < nframes; ++i)
+		for (int j = 0; j < nch; ++j)
+			out[i*nch + j] = audio[i*nch + j] * gain[i];
+}
+
+std::shared_ptr<MRP_DSPGraph> make_test_dsp_graph(double hz)
+{
+	auto graph = std::make_shared<MRP_DSPGraph>();
+	breakpoint_envelope env;
+	env.add_point({ 0.0,0.0 }, false);
+	env.add_point({ 0.1,0.2 }, false);
+	env.add_point({ 2.0,0.1 }, false);
+	env.add_point({ 3.0,0.0 }, false);
+	env.sort_points();
+	int osc = graph->add_node(std::make_shared<MRP_SineNode>(hz));
+	int envnode = graph->add_node(std::make_shared<MRP_EnvelopeNode>(env));
+	int gain = graph->add_node(std::make_shared<MRP_GainNode>());
+	graph->connect(osc, 0, gain, 0);
+	graph->connect(envnode, 0, gain, 1);
+	graph->set_output(gain, 0);
+	return graph;
+}
@@ -0,0 +1,135 @@
+#include "mrp_layered_dsp.h"
+#include "utilfuncs.h"
+
+MRP_LayeredDSP::MRP_LayeredDSP(std::vector<std::shared_ptr<MRP_AudioDSP>> layers,
+	std::shared_ptr<realtime_worker_pool> pool) : m_pool(pool)
+{
+	for (auto& e : layers)
+	{
+		layer l;
+		l.m_dsp = e;
+		m_layers.push_back(l);
+	}
+}
+
+void MRP_LayeredDSP::prepare_audio(int numchans, double sr, int expected_max_bufsize)
+{
+	m_nch = numchans;
+	m_maxframes = expected_max_bufsize;
+	for (auto& e : m_layers)
+	{
+		e.m_buffer.resize(numchans*expected_max_bufsize);
+		e.m_dsp->prepare_audio(numchans, sr, expected_max_bufsize);
+	}
+	m_serial_countdown = 0;
+	m_is_prepared = true;
+}
+
+void MRP_LayeredDSP::commit_format()
+{
+	for (auto& e : m_layers)
+		e.m_dsp->commit_format();
+}
+
+void MRP_LayeredDSP::render_layer(void * context, int index)
+{
+	MRP_LayeredDSP* self = (MRP_LayeredDSP*)context;
+	layer& l = self->m_layers[index];
+	int len = self->m_block_frames*self->m_nch;
+	for (int i = 0; i < len; ++i)
+		l.m_buffer[i] = 0.0;
+	if (l.m_dsp->is_prepared() == true)
+		l.m_dsp->process_audio(l.m_buffer.data(), self->m_nch, self->m_block_sr, self->m_block_frames);
+}
+
+void MRP_LayeredDSP::process_audio(double * buf, int nch, double sr, int nframes)
+{
+	if (nch != m_nch || m_maxframes < 1)
+		return;
+	int done = 0;
+	while (done < nframes)
+	{
+		m_block_frames = std::min(nframes - done, m_maxframes);
+		m_block_sr = sr;
+		if (m_pool != nullptr && m_serial_countdown == 0)
+		{
+			double t0 = time_precise();
+			m_pool->run((int)m_layers.size(), render_layer, this);
+			double elapsed = time_precise() - t0;
+			if (elapsed > m_deadline_fraction*m_block_frames / sr)
+			{
+				// About a second of serial rendering before trying again
+				m_serial_countdown = std::max(1, (int)(sr / m_block_frames));
+			}
+		}
+		else
+		{
+			for (int i = 0; i < (int)m_layers.size(); ++i)
+				render_layer(this, i);
+			if (m_serial_countdown > 0)
+			{
+				--m_serial_countdown;
+				++m_num_serial_blocks;
+			}
+		}
+		double* dest = &buf[done*nch];
+		int len = m_block_frames*nch;
+		for (auto& e : m_layers)
+		{
+			const double* src = e.m_buffer.data();
+			for (int i = 0; i < len; ++i)
+				dest[i] += src[i] * m_gain;
+		}
+		done += m_block_frames;
+	}
+}
+
+void MRP_LayeredDSP::release_audio()
+{
+	for (auto& e : m_layers)
+		e.m_dsp->release_audio();
+	m_is_prepared = false;
+}
+
+void MRP_LayeredDSP::seek(double seconds)
+{
+	for (auto& e : m_layers)
+		e.m_dsp->seek(seconds);
+}
+
+int MRP_LayeredDSP::get_num_channels()
+{
+	if (m_layers.empty() == true)
+		return 2;
+	return m_layers.front().m_dsp->get_num_channels();
+}
+
+double MRP_LayeredDSP::get_sample_rate()
+{
+	if (m_layers.empty() == true)
+		return 44100.0;
+	return m_layers.front().m_dsp->get_sample_rate();
+}
+
+double MRP_LayeredDSP::get_length()
+{
+	double result = 0.0;
+	for (auto& e : m_layers)
+		result = std::max(result, e.m_dsp->get_length());
+	return result;
+}
+
+uint64_t MRP_LayeredDSP::get_state_hash()
+{
+	uint64_t h = WDL_FNV64_IV;
+	for (auto& e : m_layers)
+	{
+		uint64_t layerhash = e.m_dsp->get_state_hash();
+		// Can't identify the sum if any of the layers can't be identified
+		if (layerhash == 0)
+			return 0;
+		h = WDL_FNV64(h, (const unsigned char*)&layerhash, sizeof(layerhash));
+	}
+	h = WDL_FNV64(h, (const unsigned char*)&m_gain, sizeof(m_gain));
+	return h;
+}
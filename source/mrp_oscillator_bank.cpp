@@ -0,0 +1,383 @@
+#include "mrp_oscillator_bank.h"
+#include "utilfuncs.h"
+#include "WDL/WDL/fnv64.h"
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MRP_OSCBANK_SSE2
+#include <emmintrin.h>
+#endif
+
+band_limited_wavetable::band_limited_wavetable(const std::vector<double>& harmonic_amplitudes)
+{
+	const double pi = 3.141592653589793;
+	std::vector<double> sintable(table_size);
+	for (int i = 0; i < table_size; ++i)
+		sintable[i] = sin(2.0*pi*i / table_size);
+	m_tables.resize(num_levels*(table_size + 1));
+	std::vector<double> level(table_size);
+	double scale = 1.0;
+	for (int k = 0; k < num_levels; ++k)
+	{
+		int numharmonics = std::min<int>(max_harmonics >> k, (int)harmonic_amplitudes.size());
+		for (int i = 0; i < table_size; ++i)
+		{
+			double sum = 0.0;
+			// The index of harmonic h at position i is h*i modulo the table size
+			for (int h = 0; h < numharmonics; ++h)
+				sum += harmonic_amplitudes[h] * sintable[((h + 1)*i) & (table_size - 1)];
+			level[i] = sum;
+		}
+		if (k == 0)
+		{
+			// All levels use the scaling that makes the full bandwidth table peak at 1.0
+			double peak = 0.0;
+			for (auto& e : level)
+				peak = std::max(peak, fabs(e));
+			if (peak > 0.0)
+				scale = 1.0 / peak;
+		}
+		float* dest = &m_tables[k*(table_size + 1)];
+		for (int i = 0; i < table_size; ++i)
+			dest[i] = (float)(level[i] * scale);
+		dest[table_size] = dest[0];
+	}
+	m_hash = WDL_FNV64(WDL_FNV64_IV, (const unsigned char*)harmonic_amplitudes.data(),
+		(int)(harmonic_amplitudes.size()*sizeof(double)));
+}
+
+int band_limited_wavetable::get_level(double cycles_per_sample) const
+{
+	int level = 0;
+	while (level < num_levels - 1 && (max_harmonics >> level)*cycles_per_sample > 0.5)
+		++level;
+	return level;
+}
+
+std::shared_ptr<band_limited_wavetable> band_limited_wavetable::make_sine()
+{
+	return std::make_shared<band_limited_wavetable>(std::vector<double>{ 1.0 });
+}
+
+std::shared_ptr<band_limited_wavetable> band_limited_wavetable::make_sawtooth()
+{
+	std::vector<double> amps(max_harmonics);
+	for (int i = 0; i < max_harmonics; ++i)
+		amps[i] = 1.0 / (i + 1);
+	return std::make_shared<band_limited_wavetable>(amps);
+}
+
+std::shared_ptr<band_limited_wavetable> band_limited_wavetable::make_square()
+{
+	std::vector<double> amps(max_harmonics);
+	for (int i = 0; i < max_harmonics; i += 2)
+		amps[i] = 1.0 / (i + 1);
+	return std::make_shared<band_limited_wavetable>(amps);
+}
+
+// Renders 4 voices, adding them to 4 lanes of sums per frame
+static void render_voice_group(const float* const* tables, uint32_t* phases, const uint32_t* increments,
+	const float* gainl, const float* gainr, const float* deltal, const float* deltar,
+	float* mixl, float* mixr, int nframes)
+{
+	const int fracbits = 32 - band_limited_wavetable::table_bits;
+	const float fracscale = 1.0f / (1 << fracbits);
+#ifdef MRP_OSCBANK_SSE2
+	__m128i phase = _mm_loadu_si128((const __m128i*)phases);
+	const __m128i inc = _mm_loadu_si128((const __m128i*)increments);
+	const __m128i fracmask = _mm_set1_epi32((1 << fracbits) - 1);
+	const __m128 vfracscale = _mm_set1_ps(fracscale);
+	__m128 gl = _mm_loadu_ps(gainl);
+	__m128 gr = _mm_loadu_ps(gainr);
+	const __m128 dl = _mm_loadu_ps(deltal);
+	const __m128 dr = _mm_loadu_ps(deltar);
+	alignas(16) int32_t index[4];
+	for (int i = 0; i < nframes; ++i)
+	{
+		gl = _mm_add_ps(gl, dl);
+		gr = _mm_add_ps(gr, dr);
+		_mm_store_si128((__m128i*)index, _mm_srli_epi32(phase, fracbits));
+		__m128 frac = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(phase, fracmask)), vfracscale);
+		// No gather in SSE2, the table reads are scalar
+		__m128 a = _mm_set_ps(tables[3][index[3]], tables[2][index[2]], tables[1][index[1]], tables[0][index[0]]);
+		__m128 b = _mm_set_ps(tables[3][index[3] + 1], tables[2][index[2] + 1], tables[1][index[1] + 1], tables[0][index[0] + 1]);
+		__m128 s = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), frac));
+		_mm_storeu_ps(mixl + i * 4, _mm_add_ps(_mm_loadu_ps(mixl + i * 4), _mm_mul_ps(s, gl)));
+		_mm_storeu_ps(mixr + i * 4, _mm_add_ps(_mm_loadu_ps(mixr + i * 4), _mm_mul_ps(s, gr)));
+		phase = _mm_add_epi32(phase, inc);
+	}
+	_mm_storeu_si128((__m128i*)phases, phase);
+#else
+	uint32_t phase[4];
+	float gl[4];
+	float gr[4];
+	for (int j = 0; j < 4; ++j)
+	{
+		phase[j] = phases[j];
+		gl[j] = gainl[j];
+		gr[j] = gainr[j];
+	}
+	for (int i = 0; i < nframes; ++i)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			gl[j] += deltal[j];
+			gr[j] += deltar[j];
+			uint32_t index = phase[j] >> fracbits;
+			float frac = (phase[j] & ((1 << fracbits) - 1))*fracscale;
+			float a = tables[j][index];
+			float s = a + (tables[j][index + 1] - a)*frac;
+			mixl[i * 4 + j] += s*gl[j];
+			mixr[i * 4 + j] += s*gr[j];
+			phase[j] += increments[j];
+		}
+	}
+	for (int j = 0; j < 4; ++j)
+		phases[j] = phase[j];
+#endif
+}
+
+MRP_OscillatorBankDSP::MRP_OscillatorBankDSP(std::shared_ptr<band_limited_wavetable> table, double length)
+	: m_table(table), m_length(length)
+{
+}
+
+int MRP_OscillatorBankDSP::add_voice(double hz, double gain, double pan, std::shared_ptr<const breakpoint_envelope> env)
+{
+	int envindex = -1;
+	if (env != nullptr)
+	{
+		for (int i = 0; i < (int)m_envelopes.size(); ++i)
+			if (m_envelopes[i] == env)
+				envindex = i;
+		if (envindex < 0)
+		{
+			m_envelopes.push_back(env);
+			envindex = (int)m_envelopes.size() - 1;
+		}
+	}
+	m_hz.push_back(hz);
+	m_amp.push_back(gain);
+	m_pan.push_back(bound_value(-1.0, pan, 1.0));
+	m_env_index.push_back(envindex);
+	++m_num_voices;
+	return m_num_voices - 1;
+}
+
+void MRP_OscillatorBankDSP::prepare_audio(int numchans, double sr, int expected_max_bufsize)
+{
+	const double pi = 3.141592653589793;
+	m_sr = sr;
+	int padded = (m_num_voices + 3) & ~3;
+	m_phase.assign(padded, 0);
+	m_start_phase.assign(padded, 0);
+	m_increment.assign(padded, 0);
+	m_tables.assign(padded, m_table->get_table(0));
+	m_amp_left.assign(padded, 0.0f);
+	m_amp_right.assign(padded, 0.0f);
+	m_gain_left.assign(padded, 0.0f);
+	m_gain_right.assign(padded, 0.0f);
+	m_delta_left.assign(padded, 0.0f);
+	m_delta_right.assign(padded, 0.0f);
+	m_env_values.assign(m_envelopes.size(), 1.0);
+	m_mix_left.assign(sub_block_size * 4, 0.0f);
+	m_mix_right.assign(sub_block_size * 4, 0.0f);
+	for (int i = 0; i < m_num_voices; ++i)
+	{
+		double cps = m_hz[i] / sr;
+		// Spread the start phases so that the partials don't all peak at the start
+		m_start_phase[i] = (uint32_t)i * 2654435769u;
+		if (cps <= 0.0 || cps >= 0.5)
+			continue;
+		m_increment[i] = (uint32_t)(cps*4294967296.0 + 0.5);
+		m_tables[i] = m_table->get_table(m_table->get_level(cps));
+		// Equal power panning
+		double angle = (m_pan[i] + 1.0)*pi*0.25;
+		m_amp_left[i] = (float)(m_amp[i] * cos(angle));
+		m_amp_right[i] = (float)(m_amp[i] * sin(angle));
+	}
+	m_is_prepared = true;
+	seek(0.0);
+}
+
+void MRP_OscillatorBankDSP::seek(double seconds)
+{
+	if (m_is_prepared == false)
+		return;
+	m_position = (int64_t)(seconds*m_sr + 0.5);
+	// The phase accumulation wraps around at 2^32, so the phase at any position is exact
+	for (size_t i = 0; i < m_phase.size(); ++i)
+		m_phase[i] = m_start_phase[i] + (uint32_t)((uint64_t)m_position*m_increment[i]);
+	update_gains(0);
+}
+
+void MRP_OscillatorBankDSP::update_gains(int nframes)
+{
+	double t = (m_position + nframes) / m_sr;
+	for (size_t i = 0; i < m_envelopes.size(); ++i)
+		m_env_values[i] = m_envelopes[i]->interpolate(t);
+	for (int i = 0; i < m_num_voices; ++i)
+	{
+		float env = 1.0f;
+		if (m_env_index[i] >= 0)
+			env = (float)m_env_values[m_env_index[i]];
+		float targetl = m_amp_left[i] * env;
+		float targetr = m_amp_right[i] * env;
+		if (nframes == 0)
+		{
+			m_gain_left[i] = targetl;
+			m_gain_right[i] = targetr;
+			m_delta_left[i] = 0.0f;
+			m_delta_right[i] = 0.0f;
+		}
+		else
+		{
+			m_delta_left[i] = (targetl - m_gain_left[i]) / nframes;
+			m_delta_right[i] = (targetr - m_gain_right[i]) / nframes;
+		}
+	}
+}
+
+void MRP_OscillatorBankDSP::process_audio(double * buf, int nch, double sr, int nframes)
+{
+	if (m_is_prepared == false)
+		return;
+	const int padded = (int)m_phase.size();
+	int done = 0;
+	while (done < nframes)
+	{
+		int n = std::min(sub_block_size, nframes - done);
+		update_gains(n);
+		for (int i = 0; i < n * 4; ++i)
+		{
+			m_mix_left[i] = 0.0f;
+			m_mix_right[i] = 0.0f;
+		}
+		for (int i = 0; i < padded; i += 4)
+		{
+			render_voice_group(&m_tables[i], &m_phase[i], &m_increment[i],
+				&m_gain_left[i], &m_gain_right[i], &m_delta_left[i], &m_delta_right[i],
+				m_mix_left.data(), m_mix_right.data(), n);
+		}
+		for (int i = 0; i < m_num_voices; ++i)
+		{
+			m_gain_left[i] += m_delta_left[i] * n;
+			m_gain_right[i] += m_delta_right[i] * n;
+		}
+		double* dest = &buf[done*nch];
+		for (int i = 0; i < n; ++i)
+		{
+			const float* l = &m_mix_left[i * 4];
+			const float* r = &m_mix_right[i * 4];
+			double left = (double)l[0] + l[1] + l[2] + l[3];
+			double right = (double)r[0] + r[1] + r[2] + r[3];
+			if (nch == 1)
+			{
+				dest[i] = (left + right)*0.5;
+				continue;
+			}
+			dest[i*nch] = left;
+			dest[i*nch + 1] = right;
+			for (int j = 2; j < nch; ++j)
+				dest[i*nch + j] = 0.0;
+		}
+		m_position += n;
+		done += n;
+	}
+}
+
+uint64_t MRP_OscillatorBankDSP::get_state_hash()
+{
+	uint64_t h = WDL_FNV64(WDL_FNV64_IV, (const unsigned char*)"MRP_OscillatorBankDSP", 21);
+	uint64_t tablehash = m_table->get_hash();
+	h = WDL_FNV64(h, (const unsigned char*)&tablehash, sizeof(tablehash));
+	h = WDL_FNV64(h, (const unsigned char*)&m_length, sizeof(double));
+	if (m_num_voices > 0)
+	{
+		h = WDL_FNV64(h, (const unsigned char*)m_hz.data(), m_num_voices * sizeof(double));
+		h = WDL_FNV64(h, (const unsigned char*)m_amp.data(), m_num_voices * sizeof(double));
+		h = WDL_FNV64(h, (const unsigned char*)m_pan.data(), m_num_voices * sizeof(double));
+		h = WDL_FNV64(h, (const unsigned char*)m_env_index.data(), m_num_voices * sizeof(int));
+	}
+	for (auto& env : m_envelopes)
+	{
+		// The point count separates the envelopes, so moving a point from one to the next changes the hash
+		int numpoints = env->get_num_points();
+		h = WDL_FNV64(h, (const unsigned char*)&numpoints, sizeof(numpoints));
+		h = hash_envelope_points(*env, h);
+	}
+	return h;
+}
+
+std::shared_ptr<MRP_OscillatorBankDSP> make_test_oscillator_bank(int numpartials)
+{
+	auto bank = std::make_shared<MRP_OscillatorBankDSP>(band_limited_wavetable::make_sine(), 5.0);
+	// A handful of decay envelopes shared by the partials, the higher partials decaying faster
+	const int numenvelopes = 8;
+	std::vector<std::shared_ptr<const breakpoint_envelope>> envelopes;
+	for (int i = 0; i < numenvelopes; ++i)
+	{
+		auto env = std::make_shared<breakpoint_envelope>();
+		double decay = 4.5 / (1.0 + i);
+		env->add_point({ 0.0,0.0 }, false);
+		env->add_point({ 0.005,1.0,envbreakpoint::Power,0.5 }, false);
+		env->add_point({ 0.005 + decay,0.0 }, false);
+		env->sort_points();
+		envelopes.push_back(env);
+	}
+	const double gain = 1.0 / sqrt((double)numpartials);
+	for (int i = 0; i < numpartials; ++i)
+	{
+		// Stretched partials with some deterministic jitter
+		double jitter = 1.0 + 0.01*sin(i*12.9898);
+		double hz = 110.0*(i + 1)*(1.0 + 0.0004*i)*jitter;
+		// Wrap the partials above the audible range back down so that the benchmark renders them all
+		while (hz > 16000.0)
+			hz *= 0.5;
+		double pan = sin(i*78.233);
+		bank->add_voice(hz, gain, pan, envelopes[(i * numenvelopes) / numpartials]);
+	}
+	return bank;
+}
+
+// Keeps the compiler from optimizing away the reference loop
+static volatile double g_benchmark_sink = 0.0;
+
+void benchmark_oscillator_bank()
+{
+	const double sr = 44100.0;
+	const int blocksize = 512;
+	const int numblocks = 2 * 44100 / blocksize;
+	std::vector<double> buf(blocksize * 2);
+	readbg() << "Oscillator bank benchmark, " << numblocks*blocksize / sr << " seconds of audio per run\n";
+	// Reference : the sin() per sample approach of MyTestAudioDSP
+	{
+		const int numvoices = 64;
+		double t0 = time_precise();
+		double phase = 0.0;
+		for (int i = 0; i < numblocks; ++i)
+		{
+			for (int j = 0; j < blocksize; ++j)
+			{
+				double sum = 0.0;
+				for (int k = 0; k < numvoices; ++k)
+					sum += sin(2 * 3.141592653 / sr * 110.0*(k + 1)*phase);
+				buf[j * 2] = buf[j * 2 + 1] = sum;
+				phase += 1.0;
+			}
+			g_benchmark_sink = buf[0];
+		}
+		double elapsed = time_precise() - t0;
+		readbg() << "sin() per sample : " << numvoices / elapsed*numblocks*blocksize / sr << " voices per core\n";
+	}
+	for (int numvoices : { 256, 1024, 4096, 16384 })
+	{
+		auto bank = make_test_oscillator_bank(numvoices);
+		bank->prepare_audio(2, sr, blocksize);
+		double t0 = time_precise();
+		for (int i = 0; i < numblocks; ++i)
+			bank->process_audio(buf.data(), 2, sr, blocksize);
+		double elapsed = time_precise() - t0;
+		double realtime = numblocks*blocksize / sr / elapsed;
+		readbg() << numvoices << " voices : " << realtime << " x realtime, " << numvoices*realtime << " voices per core\n";
+	}
+}
@@ -0,0 +1,227 @@
+#include "mrp_oversampling.h"
+#include "utilfuncs.h"
+#include "WDL/WDL/fnv64.h"
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MRP_HALFBAND_SSE2
+#include <emmintrin.h>
+#endif
+
+static inline double dot_product(const double* a, const double* b, int n)
+{
+#ifdef MRP_HALFBAND_SSE2
+	__m128d acc0 = _mm_setzero_pd();
+	__m128d acc1 = _mm_setzero_pd();
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+	}
+	acc0 = _mm_add_pd(acc0, acc1);
+	double result[2];
+	_mm_storeu_pd(result, acc0);
+	double sum = result[0] + result[1];
+	for (; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+#else
+	double sum = 0.0;
+	for (int i = 0; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+#endif
+}
+
+halfband_resampler::halfband_resampler()
+{
+	// Blackman windowed sinc with the cutoff at half of the Nyquist frequency.
+	// The full filter has 4*K-1 coefficients, of which the ones at even indices form the FIR branch.
+	const int len = branch_taps * 2 - 1;
+	const int center = (len - 1) / 2;
+	const double pi = 3.141592653589793;
+	double sum = 0.0;
+	for (int i = 0; i < branch_taps; ++i)
+	{
+		int k = i * 2;
+		double x = (k - center)*0.5;
+		double sinc = sin(pi*x) / (pi*x);
+		double w = 0.42 - 0.5*cos(2.0*pi*k / (len - 1)) + 0.08*cos(4.0*pi*k / (len - 1));
+		m_coeffs[branch_taps - 1 - i] = 0.5*sinc*w;
+		sum += m_coeffs[branch_taps - 1 - i];
+	}
+	// The branch should sum to 0.5, the other half of the unity DC gain comes from the center coefficient
+	for (auto& e : m_coeffs)
+		e *= 0.5 / sum;
+}
+
+void halfband_resampler::prepare(int maxframes)
+{
+	m_upbuf.resize(branch_taps - 1 + maxframes);
+	m_even.resize(branch_taps - 1 + maxframes);
+	m_odd.resize(branch_taps / 2 + maxframes);
+	reset();
+}
+
+void halfband_resampler::reset()
+{
+	for (auto& e : m_upbuf)
+		e = 0.0;
+	for (auto& e : m_even)
+		e = 0.0;
+	for (auto& e : m_odd)
+		e = 0.0;
+}
+
+void halfband_resampler::upsample(const double * in, double * out, int n)
+{
+	const int hist = branch_taps - 1;
+	const int delay = branch_taps / 2 - 1;
+	double* buf = m_upbuf.data();
+	for (int i = 0; i < n; ++i)
+		buf[hist + i] = in[i];
+	for (int i = 0; i < n; ++i)
+	{
+		out[i * 2] = 2.0*dot_product(m_coeffs, buf + i, branch_taps);
+		out[i * 2 + 1] = buf[hist + i - delay];
+	}
+	for (int i = 0; i < hist; ++i)
+		buf[i] = buf[n + i];
+}
+
+void halfband_resampler::downsample(const double * in, double * out, int n)
+{
+	const int evenhist = branch_taps - 1;
+	const int oddhist = branch_taps / 2;
+	double* even = m_even.data();
+	double* odd = m_odd.data();
+	for (int i = 0; i < n; ++i)
+	{
+		even[evenhist + i] = in[i * 2];
+		odd[oddhist + i] = in[i * 2 + 1];
+	}
+	for (int i = 0; i < n; ++i)
+		out[i] = dot_product(m_coeffs, even + i, branch_taps) + 0.5*odd[i];
+	for (int i = 0; i < evenhist; ++i)
+		even[i] = even[n + i];
+	for (int i = 0; i < oddhist; ++i)
+		odd[i] = odd[n + i];
+}
+
+MRP_OversamplingDSP::MRP_OversamplingDSP(std::shared_ptr<MRP_AudioDSP> dsp, int factor) : m_dsp(dsp)
+{
+	if (factor >= 8)
+		m_num_stages = 3;
+	else if (factor >= 4)
+		m_num_stages = 2;
+	else m_num_stages = 1;
+}
+
+double MRP_OversamplingDSP::get_latency_frames() const
+{
+	// Each stage delays by the filter latency at its higher rate when upsampling and again when downsampling,
+	// which makes the filter latency at its lower rate
+	double result = 0.0;
+	for (int i = 0; i < m_num_stages; ++i)
+		result += (double)halfband_resampler::latency / (1 << i);
+	return result;
+}
+
+double MRP_OversamplingDSP::get_generated_latency_frames() const
+{
+	// Only the downsampling half of the above
+	return get_latency_frames()*0.5;
+}
+
+void MRP_OversamplingDSP::prepare_audio(int numchans, double sr, int expected_max_bufsize)
+{
+	int factor = get_factor();
+	m_nch = numchans;
+	m_sr = sr;
+	m_maxframes = expected_max_bufsize;
+	m_up.assign(numchans, std::vector<halfband_resampler>(m_num_stages));
+	m_down.assign(numchans, std::vector<halfband_resampler>(m_num_stages));
+	for (int i = 0; i < numchans; ++i)
+	{
+		for (int j = 0; j < m_num_stages; ++j)
+		{
+			// Stage j runs from rate 2^j to 2^(j+1)
+			m_up[i][j].prepare(expected_max_bufsize << j);
+			m_down[i][j].prepare(expected_max_bufsize << j);
+		}
+	}
+	m_oversampled.resize(numchans*expected_max_bufsize*factor);
+	m_work0.resize(expected_max_bufsize*factor);
+	m_work1.resize(expected_max_bufsize*factor);
+	m_dsp->prepare_audio(numchans, sr*factor, expected_max_bufsize*factor);
+}
+
+void MRP_OversamplingDSP::process_audio(double * buf, int nch, double sr, int nframes)
+{
+	if (nch != m_nch || m_maxframes < 1)
+		return;
+	const int factor = get_factor();
+	int done = 0;
+	while (done < nframes)
+	{
+		int n = std::min(nframes - done, m_maxframes);
+		double* block = &buf[done*nch];
+		for (int ch = 0; ch < nch; ++ch)
+		{
+			double* src = m_work0.data();
+			double* dest = m_work1.data();
+			for (int i = 0; i < n; ++i)
+				src[i] = block[i*nch + ch];
+			int len = n;
+			for (int j = 0; j < m_num_stages; ++j)
+			{
+				m_up[ch][j].upsample(src, dest, len);
+				len *= 2;
+				std::swap(src, dest);
+			}
+			for (int i = 0; i < len; ++i)
+				m_oversampled[i*nch + ch] = src[i];
+		}
+		m_dsp->process_audio(m_oversampled.data(), nch, sr*factor, n*factor);
+		for (int ch = 0; ch < nch; ++ch)
+		{
+			double* src = m_work0.data();
+			double* dest = m_work1.data();
+			int len = n*factor;
+			for (int i = 0; i < len; ++i)
+				src[i] = m_oversampled[i*nch + ch];
+			for (int j = m_num_stages - 1; j >= 0; --j)
+			{
+				len /= 2;
+				m_down[ch][j].downsample(src, dest, len);
+				std::swap(src, dest);
+			}
+			for (int i = 0; i < n; ++i)
+				block[i*nch + ch] = src[i];
+		}
+		done += n;
+	}
+}
+
+void MRP_OversamplingDSP::seek(double seconds)
+{
+	for (auto& chanstages : m_up)
+		for (auto& e : chanstages)
+			e.reset();
+	for (auto& chanstages : m_down)
+		for (auto& e : chanstages)
+			e.reset();
+	double latency = 0.0;
+	if (m_sr > 0.0)
+		latency = get_generated_latency_frames() / m_sr;
+	m_dsp->seek(seconds + latency);
+}
+
+uint64_t MRP_OversamplingDSP::get_state_hash()
+{
+	uint64_t h = m_dsp->get_state_hash();
+	if (h == 0)
+		return 0;
+	int factor = get_factor();
+	return WDL_FNV64(h, (const unsigned char*)&factor, sizeof(factor));
+}
@@ -1,14 +1,123 @@
 #include "mrp_pcm_source.h"
 #include "utilfuncs.h"
+#include "mrp_peak_cache.h"
+#include <mutex>
+
+// The factory created sources, whose dsp objects the main thread prepares when their format changes
+static std::mutex g_factory_sources_mutex;
+static std::vector<MRP_PCMSource*> g_factory_sources;
+static UINT_PTR g_preparation_timer = 0;
+
+MRP_PCMSource::MRP_PCMSource(MRP_AudioDSPFactory factory) : MRP_PCMSource(factory, 0, 0.0)
+{
+}
+
+MRP_PCMSource::MRP_PCMSource(MRP_AudioDSPFactory factory, int nch, double sr) : m_dsp_factory(factory)
+{
+	auto dsp = m_dsp_factory();
+	if (dsp != nullptr)
+	{
+		update_format(dsp.get());
+		if (nch < 1)
+		{
+			nch = dsp->get_num_channels();
+			sr = dsp->get_sample_rate();
+		}
+		m_dsp.publish(prepare_dsp(dsp, nch, sr, 4096));
+	}
+	m_peaks = std::make_shared<MRP_PeakBuilder>(m_dsp_factory);
+	std::lock_guard<std::mutex> locker(g_factory_sources_mutex);
+	g_factory_sources.push_back(this);
+}
+
+MRP_PCMSource::~MRP_PCMSource()
+{
+	if (m_dsp_factory)
+	{
+		std::lock_guard<std::mutex> locker(g_factory_sources_mutex);
+		g_factory_sources.erase(std::remove(g_factory_sources.begin(), g_factory_sources.end(), this),
+			g_factory_sources.end());
+	}
+}
+
+void MRP_PCMSource::update_format(MRP_AudioDSP * dsp)
+{
+	if (dsp == nullptr)
+		return;
+	m_num_channels = dsp->get_num_channels();
+	m_samplerate = dsp->get_sample_rate();
+	m_length = dsp->get_length();
+}
+
+std::shared_ptr<MRP_PCMSource::prepared_dsp> MRP_PCMSource::prepare_dsp(std::shared_ptr<MRP_AudioDSP> dsp,
+	int nch, double sr, int bufsize)
+{
+	auto result = std::make_shared<prepared_dsp>(adapt_block_size(dsp));
+	result->m_dsp->prepare_audio(nch, sr, bufsize);
+	result->m_dsp->commit_format();
+	result->m_nch = nch;
+	result->m_sr = sr;
+	result->m_bufsize = bufsize;
+	m_prepared_nch = nch;
+	m_prepared_sr = sr;
+	return result;
+}
+
+void MRP_PCMSource::prepare_requested_format()
+{
+	m_dsp.collect_retired();
+	if (!m_dsp_factory || m_format_requested.exchange(false, std::memory_order_acquire) == false)
+		return;
+	int nch = m_requested_nch.load(std::memory_order_relaxed);
+	double sr = m_requested_sr.load(std::memory_order_relaxed);
+	// The audio thread keeps requesting until it picks up the object prepared for the format
+	auto latest = m_dsp.latest();
+	if (latest != nullptr && latest->m_nch == nch && latest->m_sr == sr)
+		return;
+	auto dsp = m_dsp_factory();
+	if (dsp != nullptr)
+		m_dsp.publish(prepare_dsp(dsp, nch, sr, latest != nullptr ? latest->m_bufsize : 4096));
+}
+
+static void CALLBACK preparation_timer_proc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime)
+{
+	if (idEvent != g_preparation_timer)
+		return;
+	std::lock_guard<std::mutex> locker(g_factory_sources_mutex);
+	for (MRP_PCMSource* src : g_factory_sources)
+		src->prepare_requested_format();
+}
+
+void start_or_stop_pcm_source_preparation(bool stop)
+{
+	if (stop == false)
+		g_preparation_timer = SetTimer(0, 1001, 20, preparation_timer_proc);
+	else if (g_preparation_timer != 0)
+	{
+		KillTimer(0, g_preparation_timer);
+		g_preparation_timer = 0;
+	}
+}
 
 PCM_source * MRP_PCMSource::Duplicate()
 {
+	// Without a factory the dsp object would have to be shared between the sources, which can't work
+	// when they are processed concurrently
+	if (m_dsp_factory)
+	{
+		// Prepared with the format this source plays with, so that the duplicate doesn't start silent
+		auto result = new MRP_PCMSource(m_dsp_factory, m_prepared_nch.load(), m_prepared_sr.load());
+		// The duplicate produces the same audio, so it can share the peaks
+		result->m_peaks = m_peaks;
+		result->m_timing = m_timing;
+		return result;
+	}
 	return nullptr;
 }
 
 bool MRP_PCMSource::IsAvailable()
 {
-	return m_dsp!=nullptr;
+	return m_dsp.has_latest();
 }
 
 const char * MRP_PCMSource::GetType()
@@ -23,18 +132,17 @@ bool MRP_PCMSource::SetFileName(const char * newfn)
 
 int MRP_PCMSource::GetNumChannels()
 {
-	return 2;
+	return m_num_channels;
 }
 
 double MRP_PCMSource::GetSampleRate()
 {
-	return 44100.0;
+	return m_samplerate;
 }
 
 double MRP_PCMSource::GetLength()
 {
-	// Have to return some length in seconds here
-	return 3.0;
+	return m_length;
 }
 
 int MRP_PCMSource::PropertiesWindow(HWND hwndParent)
@@ -44,36 +152,54 @@ int MRP_PCMSource::PropertiesWindow(HWND hwndParent)
 
 void MRP_PCMSource::GetSamples(PCM_source_transfer_t * block)
 {
-	std::lock_guard<std::mutex> locker(m_mutex);
+	double callback_start = time_precise();
+	prepared_dsp* current = m_dsp.acquire();
+	MRP_AudioDSP* dsp = current != nullptr ? current->m_dsp.get() : nullptr;
+	// Playback ended since the previous call. Factory created dsp objects stay prepared, since only the main
+	// thread could prepare them again.
+	if (m_release_pending.exchange(false) == true && dsp != nullptr && !m_dsp_factory)
+		dsp->release_audio();
 	// wasteful prezeroing if no problem, but meh for now...
 	for (int i = 0; i < block->length*block->nch; ++i)
 		block->samples[i] = 0.0;
 	
-	if (m_dsp != nullptr)
+	bool seeked = m_position.update(block->time_s, block->length, block->samplerate);
+	if (dsp != nullptr && m_dsp_factory && (block->nch != current->m_nch || block->samplerate != current->m_sr))
 	{
-		if (m_dsp->is_prepared() == true)
-		{
-			// Oddly enough, PCM_source doesn't have a Seek method that we could react to.
-			// So a hack like this is needed to detect a seek happened...
-			// This may not be completely correct but the fuzzy comparison should make it pretty close
-			double t0 = m_lastpos + ((double)block->length / block->samplerate);
-			if (fuzzy_compare(t0, block->time_s) == false)
-			{
-				// was probably seeked
-				//char buf[256];
-				//sprintf(buf, "pcm_source seeked %f %f %f", m_lastpos, t0, block->time_s);
-				//OutputDebugString(buf);
-				m_dsp->seek(block->time_s);
-			}
-			m_dsp->process_audio(block->samples, block->nch, block->samplerate, block->length);
-		}
+		// Preparing may allocate, so the main thread prepares a new dsp object for the format and
+		// the output stays silent until it's been picked up
+		m_requested_nch.store(block->nch, std::memory_order_relaxed);
+		m_requested_sr.store(block->samplerate, std::memory_order_relaxed);
+		m_format_requested.store(true, std::memory_order_release);
+		dsp = nullptr;
+	}
+	if (dsp != nullptr && dsp != m_processed_dsp)
+	{
+		m_processed_dsp = dsp;
+		seeked = true;
+	}
+	if (dsp != nullptr && dsp->is_prepared() == true)
+	{
+		if (seeked == true)
+			dsp->seek(block->time_s);
+		// Factory created dsp objects were prepared for blocks of at most m_bufsize frames
+		const int maxframes = current->m_bufsize > 0 ? current->m_bufsize : block->length;
+		for (int pos = 0; pos < block->length; pos += maxframes)
+			dsp->process_audio(block->samples + pos*block->nch, block->nch, block->samplerate,
+				std::min(maxframes, block->length - pos));
 	}
 	block->samples_out = block->length;
-	m_lastpos = block->time_s;
+	m_timing->record(time_precise() - callback_start, block->length, block->samplerate);
 }
 
 void MRP_PCMSource::GetPeakInfo(PCM_source_peaktransfer_t * block)
 {
+	if (m_peaks == nullptr)
+	{
+		block->peaks_out = 0;
+		return;
+	}
+	m_peaks->get_peaks(block);
 }
 
 void MRP_PCMSource::SaveState(ProjectStateContext * ctx)
@@ -87,20 +213,29 @@ int MRP_PCMSource::LoadState(const char * firstline, ProjectStateContext * ctx)
 
 void MRP_PCMSource::Peaks_Clear(bool deleteFile)
 {
+	if (m_peaks != nullptr)
+		m_peaks->clear(deleteFile);
 }
 
 int MRP_PCMSource::PeaksBuild_Begin()
 {
+	if (m_peaks != nullptr && m_peaks->start() == true)
+		return 1;
 	return 0;
 }
 
 int MRP_PCMSource::PeaksBuild_Run()
 {
+	// The peaks are built in another thread, so just give it some time to progress
+	if (m_peaks != nullptr && m_peaks->wait(20) == true)
+		return 1;
 	return 0;
 }
 
 void MRP_PCMSource::PeaksBuild_Finish()
 {
+	if (m_peaks != nullptr)
+		m_peaks->finish();
 }
 
 int MRP_PCMSource::Extended(int call, void *parm1, void *parm2, void *parm3)
@@ -108,7 +243,9 @@ int MRP_PCMSource::Extended(int call, void *parm1, void *parm2, void *parm3)
 	// not called with the Preview system
 	if (call == PCM_SOURCE_EXT_ENDPLAYNOTIFY)
 	{
-		m_dsp->release_audio();
+		// This may be called from a non-audio thread, which must not acquire the dsp object,
+		// so the release is left to the next GetSamples call
+		m_release_pending = true;
 		return 1;
 	}
 	return 0;
@@ -142,6 +279,7 @@ void test_pcm_source(int op)
 		if (g_is_playing == false)
 		{
 			g_test_source->get_dsp()->prepare_audio(2, 44100.0, 512);
+			g_test_source->get_dsp()->commit_format();
 			PlayPreview(&g_prev_reg);
 			g_is_playing = true;
 		}
@@ -149,6 +287,7 @@ void test_pcm_source(int op)
 		{
 			StopPreview(&g_prev_reg);
 			g_test_source->get_dsp()->release_audio();
+			g_test_source->collect_garbage();
 			g_is_playing = false;
 		}
 	}
@@ -164,3 +303,36 @@ void test_pcm_source(int op)
 #endif
 	}
 }
+
+void insert_generated_source_item(MRP_AudioDSPFactory factory)
+{
+	MediaTrack* track = GetSelectedTrack(nullptr, 0);
+	if (track == nullptr)
+		return;
+	auto src = new MRP_PCMSource(factory);
+	Undo_BeginBlock();
+	MediaItem* item = AddMediaItemToTrack(track);
+	MediaItem_Take* take = AddTakeToMediaItem(item);
+	GetSetMediaItemTakeInfo(take, "P_SOURCE", src);
+	SetMediaItemInfo_Value(item, "D_POSITION", GetCursorPosition());
+	SetMediaItemInfo_Value(item, "D_LENGTH", src->GetLength());
+	// The peaks build in the background and the arrange view is redrawn when they are done
+	src->PeaksBuild_Begin();
+	UpdateArrange();
+	Undo_EndBlock("Insert generated audio item", UNDO_STATE_ITEMS);
+}
+
+MRP_PCMSource* get_test_pcm_source()
+{
+	return g_test_source.get();
+}
+
+MRP_PCMSource* get_take_mrp_pcm_source(MediaItem_Take* take)
+{
+	if (take == nullptr)
+		return nullptr;
+	PCM_source* src = GetMediaItemTake_Source(take);
+	if (src == nullptr || strcmp(src->GetType(), "MRP_PCMSOURCE") != 0)
+		return nullptr;
+	return (MRP_PCMSource*)src;
+}
@@ -0,0 +1,355 @@
+#include "mrp_peak_cache.h"
+#include "utilfuncs.h"
+#include "WDL/WDL/fnv64.h"
+#include "audio_buffer_pool.h"
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+
+void MRP_PeakCache::init(int nch, double sr, int64_t numframes)
+{
+	m_nch = nch;
+	m_sr = sr;
+	m_num_frames = numframes;
+	m_frames_done = 0;
+	int64_t fpp = 16;
+	for (int i = 0; i < num_levels; ++i)
+	{
+		m_levels[i].m_frames_per_peak = fpp;
+		m_levels[i].m_minmax.clear();
+		m_levels[i].m_minmax.reserve((size_t)(numframes / fpp + 1) * nch * 2);
+		reset_accumulator(m_levels[i]);
+		fpp *= 16;
+	}
+}
+
+void MRP_PeakCache::clear()
+{
+	for (auto& lev : m_levels)
+	{
+		lev.m_minmax.clear();
+		lev.m_minmax.shrink_to_fit();
+		lev.m_acc.clear();
+		lev.m_acc_count = 0;
+	}
+	m_nch = 0;
+	m_sr = 0.0;
+	m_num_frames = 0;
+	m_frames_done = 0;
+}
+
+void MRP_PeakCache::reset_accumulator(level& lev)
+{
+	lev.m_acc.resize(m_nch * 2);
+	for (int i = 0; i < m_nch; ++i)
+	{
+		lev.m_acc[i * 2 + 0] = 1.0e30f;
+		lev.m_acc[i * 2 + 1] = -1.0e30f;
+	}
+	lev.m_acc_count = 0;
+}
+
+void MRP_PeakCache::accumulate(int levindex, const float* minmax)
+{
+	level& lev = m_levels[levindex];
+	for (int i = 0; i < m_nch; ++i)
+	{
+		if (minmax[i * 2 + 0] < lev.m_acc[i * 2 + 0])
+			lev.m_acc[i * 2 + 0] = minmax[i * 2 + 0];
+		if (minmax[i * 2 + 1] > lev.m_acc[i * 2 + 1])
+			lev.m_acc[i * 2 + 1] = minmax[i * 2 + 1];
+	}
+	++lev.m_acc_count;
+	if (lev.m_acc_count == 16)
+		flush(levindex);
+}
+
+void MRP_PeakCache::flush(int levindex)
+{
+	level& lev = m_levels[levindex];
+	if (lev.m_acc_count == 0)
+		return;
+	size_t offset = lev.m_minmax.size();
+	lev.m_minmax.insert(lev.m_minmax.end(), lev.m_acc.begin(), lev.m_acc.end());
+	reset_accumulator(lev);
+	if (levindex + 1 < num_levels)
+		accumulate(levindex + 1, &lev.m_minmax[offset]);
+}
+
+void MRP_PeakCache::add_samples(const double * buf, int nframes)
+{
+	if (m_nch == 0)
+		return;
+	std::vector<float> frame(m_nch * 2);
+	for (int i = 0; i < nframes && m_frames_done < m_num_frames; ++i)
+	{
+		for (int j = 0; j < m_nch; ++j)
+		{
+			frame[j * 2 + 0] = (float)buf[i*m_nch + j];
+			frame[j * 2 + 1] = (float)buf[i*m_nch + j];
+		}
+		accumulate(0, frame.data());
+		++m_frames_done;
+	}
+	if (m_frames_done >= m_num_frames)
+	{
+		// Lower levels flush into the higher levels, so they must be done first
+		for (int i = 0; i < num_levels; ++i)
+			flush(i);
+	}
+}
+
+void MRP_PeakCache::get_peaks(PCM_source_peaktransfer_t * block) const
+{
+	block->peaks_out = 0;
+	if (m_nch == 0 || block->peakrate <= 0.0 || block->nchpeaks < 1)
+		return;
+	// Use the coarsest level that still has at least the requested resolution
+	double frames_per_output = m_sr / block->peakrate;
+	int levindex = 0;
+	while (levindex + 1 < num_levels && m_levels[levindex + 1].m_frames_per_peak <= frames_per_output)
+		++levindex;
+	const level& lev = m_levels[levindex];
+	const int64_t avail = lev.num_peaks(m_nch);
+	const int nchpeaks = block->nchpeaks;
+	ReaSample* maxbuf = block->peaks;
+	ReaSample* minbuf = block->peaks + block->numpeak_points*nchpeaks;
+	if (block->peaks_minvals != nullptr)
+	{
+		minbuf = block->peaks_minvals;
+		block->peaks_minvals_used = 1;
+	}
+	const double peaks_per_second = m_sr / lev.m_frames_per_peak;
+	for (int i = 0; i < block->numpeak_points; ++i)
+	{
+		double t0 = block->start_time + i / block->peakrate;
+		double t1 = t0 + 1.0 / block->peakrate;
+		int64_t p0 = (int64_t)floor(t0*peaks_per_second);
+		int64_t p1 = (int64_t)floor(t1*peaks_per_second);
+		if (p0 >= avail)
+			break;
+		if (p1 <= p0)
+			p1 = p0 + 1;
+		if (p1 > avail)
+			p1 = avail;
+		for (int j = 0; j < nchpeaks; ++j)
+		{
+			float mn = 0.0f;
+			float mx = 0.0f;
+			if (p1 > 0)
+			{
+				if (p0 < 0)
+					p0 = 0;
+				mn = 1.0e30f;
+				mx = -1.0e30f;
+				// A mono request of multichannel audio combines all channels
+				int firstch = nchpeaks == 1 ? 0 : std::min(j, m_nch - 1);
+				int lastch = nchpeaks == 1 ? m_nch - 1 : firstch;
+				for (int64_t k = p0; k < p1; ++k)
+				{
+					const float* pk = &lev.m_minmax[k*m_nch * 2];
+					for (int ch = firstch; ch <= lastch; ++ch)
+					{
+						mn = std::min(mn, pk[ch * 2 + 0]);
+						mx = std::max(mx, pk[ch * 2 + 1]);
+					}
+				}
+			}
+			maxbuf[i*nchpeaks + j] = mx;
+			minbuf[i*nchpeaks + j] = mn;
+		}
+		++block->peaks_out;
+	}
+}
+
+static const char g_peakfile_magic[8] = { 'M','R','P','P','E','A','K','1' };
+
+bool MRP_PeakCache::save_to_file(const std::string & fn, uint64_t hash) const
+{
+	if (is_complete() == false)
+		return false;
+	std::ofstream file(fn, std::ios::binary);
+	if (file.is_open() == false)
+		return false;
+	file.write(g_peakfile_magic, 8);
+	file.write((const char*)&hash, sizeof(hash));
+	file.write((const char*)&m_nch, sizeof(m_nch));
+	file.write((const char*)&m_sr, sizeof(m_sr));
+	file.write((const char*)&m_num_frames, sizeof(m_num_frames));
+	for (auto& lev : m_levels)
+	{
+		int64_t sz = (int64_t)lev.m_minmax.size();
+		file.write((const char*)&sz, sizeof(sz));
+		file.write((const char*)lev.m_minmax.data(), sizeof(float)*sz);
+	}
+	return file.good();
+}
+
+bool MRP_PeakCache::load_from_file(const std::string & fn, uint64_t hash)
+{
+	std::ifstream file(fn, std::ios::binary);
+	if (file.is_open() == false)
+		return false;
+	char magic[8];
+	uint64_t filehash = 0;
+	int nch = 0;
+	double sr = 0.0;
+	int64_t numframes = 0;
+	file.read(magic, 8);
+	file.read((char*)&filehash, sizeof(filehash));
+	file.read((char*)&nch, sizeof(nch));
+	file.read((char*)&sr, sizeof(sr));
+	file.read((char*)&numframes, sizeof(numframes));
+	if (file.good() == false || memcmp(magic, g_peakfile_magic, 8) != 0 || filehash != hash || nch < 1 || sr <= 0.0)
+		return false;
+	init(nch, sr, numframes);
+	for (auto& lev : m_levels)
+	{
+		int64_t sz = 0;
+		file.read((char*)&sz, sizeof(sz));
+		if (file.good() == false || sz < 0 || sz != (numframes + lev.m_frames_per_peak - 1) / lev.m_frames_per_peak * nch * 2)
+		{
+			clear();
+			return false;
+		}
+		lev.m_minmax.resize((size_t)sz);
+		file.read((char*)lev.m_minmax.data(), sizeof(float)*sz);
+	}
+	if (file.good() == false)
+	{
+		clear();
+		return false;
+	}
+	m_frames_done = numframes;
+	return true;
+}
+
+MRP_PeakBuilder::~MRP_PeakBuilder()
+{
+	m_cancel = true;
+	finish();
+}
+
+bool MRP_PeakBuilder::start()
+{
+	if (m_building == true)
+		return false;
+	finish();
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if (m_cache.is_complete() == true)
+			return false;
+	}
+	auto dsp = m_factory();
+	if (dsp == nullptr)
+		return false;
+	int nch = dsp->get_num_channels();
+	double sr = dsp->get_sample_rate();
+	int64_t numframes = (int64_t)(dsp->get_length()*sr);
+	if (nch < 1 || sr <= 0.0 || numframes < 1)
+		return false;
+	m_hash = dsp->get_state_hash();
+	m_filename.clear();
+	if (m_hash != 0)
+	{
+		// The output format is as much part of the content as the dsp state
+		m_hash = WDL_FNV64(m_hash, (const unsigned char*)&nch, sizeof(nch));
+		m_hash = WDL_FNV64(m_hash, (const unsigned char*)&sr, sizeof(sr));
+		m_hash = WDL_FNV64(m_hash, (const unsigned char*)&numframes, sizeof(numframes));
+		char ppbuf[2048];
+		GetProjectPath(ppbuf, 2048);
+		char namebuf[64];
+		sprintf(namebuf, "/MRP_%016llx.mrppeaks", (unsigned long long)m_hash);
+		m_filename = std::string(ppbuf) + namebuf;
+		std::lock_guard<std::mutex> locker(m_mutex);
+		if (m_cache.load_from_file(m_filename, m_hash) == true)
+			return false;
+	}
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_cache.init(nch, sr, numframes);
+	}
+	m_cancel = false;
+	m_building = true;
+	m_thread = std::thread([this, dsp]() { build(dsp); });
+	return true;
+}
+
+bool MRP_PeakBuilder::wait(int timeoutms)
+{
+	double t0 = time_precise();
+	while (m_building == true && (time_precise() - t0)*1000.0 < timeoutms)
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	return m_building;
+}
+
+void MRP_PeakBuilder::finish()
+{
+	if (m_thread.joinable() == true)
+		m_thread.join();
+}
+
+void MRP_PeakBuilder::clear(bool deletefile)
+{
+	m_cancel = true;
+	finish();
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_cache.clear();
+	if (deletefile == true && m_filename.empty() == false)
+		remove(m_filename.c_str());
+}
+
+void MRP_PeakBuilder::get_peaks(PCM_source_peaktransfer_t * block)
+{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	m_cache.get_peaks(block);
+}
+
+double MRP_PeakBuilder::get_progress()
+{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	if (m_cache.is_complete() == true)
+		return 1.0;
+	if (m_building == false)
+		return 0.0;
+	return (double)m_cache.get_num_frames_done() / m_cache.get_num_frames();
+}
+
+void MRP_PeakBuilder::build(std::shared_ptr<MRP_AudioDSP> dsp)
+{
+	int bufsize = 4096;
+	if (dsp->get_preferred_block_size() > 0)
+		bufsize = dsp->get_preferred_block_size();
+	int nch = dsp->get_num_channels();
+	double sr = dsp->get_sample_rate();
+	int64_t numframes = (int64_t)(dsp->get_length()*sr);
+	pooled_buffer buf = get_audio_buffer_pool().acquire(bufsize*nch);
+	dsp->prepare_audio(nch, sr, bufsize);
+	dsp->commit_format();
+	dsp->seek(0.0);
+	int64_t pos = 0;
+	while (pos < numframes && m_cancel == false)
+	{
+		int n = (int)std::min<int64_t>(bufsize, numframes - pos);
+		for (auto& e : buf)
+			e = 0.0;
+		// DSPs with a preferred block size are always given full blocks, only the first n frames are used
+		dsp->process_audio(buf.data(), nch, sr, bufsize);
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_cache.add_samples(buf.data(), n);
+		pos += n;
+	}
+	dsp->release_audio();
+	if (m_cancel == false)
+	{
+		if (m_filename.empty() == false)
+		{
+			std::lock_guard<std::mutex> locker(m_mutex);
+			m_cache.save_to_file(m_filename, m_hash);
+		}
+		// Get the arrange view redrawn with the new peaks
+		execute_in_main_thread([]() { UpdateArrange(); });
+	}
+	m_building = false;
+}
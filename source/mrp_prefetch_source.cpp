@@ -0,0 +1,193 @@
+#include "mrp_prefetch_source.h"
+#include <cmath>
+#include <chrono>
+
+MRP_PrefetchSource::MRP_PrefetchSource(PCM_source * src, double ringseconds)
+	: m_src(src), m_ringseconds(ringseconds)
+{
+	m_src_nch = m_src->GetNumChannels();
+	if (m_src_nch < 1)
+		m_src_nch = 1;
+	m_thread = std::thread([this]() { reader_proc(); });
+}
+
+MRP_PrefetchSource::~MRP_PrefetchSource()
+{
+	m_quit = true;
+	{
+		std::lock_guard<std::mutex> locker(m_wake_mutex);
+		m_wake_cv.notify_all();
+	}
+	m_thread.join();
+}
+
+PCM_source * MRP_PrefetchSource::Duplicate()
+{
+	PCM_source* dup = m_src->Duplicate();
+	if (dup == nullptr)
+		return nullptr;
+	return new MRP_PrefetchSource(dup, m_ringseconds);
+}
+
+void MRP_PrefetchSource::GetSamples(PCM_source_transfer_t * block)
+{
+	const int nch = block->nch;
+	for (int i = 0; i < block->length*nch; ++i)
+		block->samples[i] = 0.0;
+	block->samples_out = block->length;
+	if (m_position.update(block->time_s, block->length, block->samplerate) == true)
+	{
+		m_seek_frame.store((int64_t)floor(block->time_s*block->samplerate + 0.5), std::memory_order_relaxed);
+		m_seek_samplerate.store(block->samplerate, std::memory_order_relaxed);
+		m_ring_ready = false;
+		++m_requested_generation;
+		m_seek_generation.store(m_requested_generation, std::memory_order_release);
+		m_wake_cv.notify_one();
+	}
+	if (m_ring_ready == false)
+	{
+		if (m_ack_generation.load(std::memory_order_acquire) != m_requested_generation)
+		{
+			++m_num_underruns;
+			return;
+		}
+		m_read_index.store(m_ack_index.load(std::memory_order_relaxed), std::memory_order_release);
+		m_ring_frame = m_seek_frame.load(std::memory_order_relaxed);
+		m_ring_ready = true;
+	}
+	int64_t wanted = (int64_t)floor(block->time_s*block->samplerate + 0.5);
+	int64_t readindex = m_read_index.load(std::memory_order_relaxed);
+	int64_t available = m_write_index.load(std::memory_order_acquire) - readindex;
+	if (m_ring_frame < wanted)
+	{
+		// Catch up with the play position after the silence while waiting for the reader
+		int64_t skip = std::min(available, wanted - m_ring_frame);
+		readindex += skip;
+		available -= skip;
+		m_ring_frame += skip;
+	}
+	int n = (int)std::min<int64_t>(available, block->length);
+	for (int i = 0; i < n; ++i)
+	{
+		const ReaSample* src = &m_ring[((readindex + i) % m_capacity)*m_src_nch];
+		for (int j = 0; j < nch; ++j)
+			block->samples[i*nch + j] = src[std::min(j, m_src_nch - 1)];
+	}
+	readindex += n;
+	m_ring_frame += n;
+	m_read_index.store(readindex, std::memory_order_release);
+	if (n < block->length)
+		++m_num_underruns;
+}
+
+void MRP_PrefetchSource::reader_proc()
+{
+	const int chunk = 4096;
+	std::vector<ReaSample> chunkbuf(chunk*m_src_nch);
+	int generation = 0;
+	int64_t pos = 0;
+	double sr = 0.0;
+	auto wait = [this](int ms)
+	{
+		std::unique_lock<std::mutex> locker(m_wake_mutex);
+		m_wake_cv.wait_for(locker, std::chrono::milliseconds(ms));
+	};
+	while (m_quit == false)
+	{
+		int newgeneration = m_seek_generation.load(std::memory_order_acquire);
+		if (newgeneration != generation)
+		{
+			generation = newgeneration;
+			pos = m_seek_frame.load(std::memory_order_relaxed);
+			sr = m_seek_samplerate.load(std::memory_order_relaxed);
+			// The audio thread doesn't touch the ring before the acknowledgement, so it can be reallocated here
+			int64_t capacity = std::max<int64_t>(chunk * 2, (int64_t)(m_ringseconds*sr));
+			if (capacity != m_capacity)
+			{
+				m_ring.assign(capacity*m_src_nch, 0.0);
+				m_capacity = capacity;
+			}
+			m_ack_index.store(m_write_index.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			m_ack_generation.store(generation, std::memory_order_release);
+		}
+		if (sr <= 0.0)
+		{
+			wait(20);
+			continue;
+		}
+		int64_t writeindex = m_write_index.load(std::memory_order_relaxed);
+		int64_t used = writeindex - m_read_index.load(std::memory_order_acquire);
+		if (m_capacity - used < chunk)
+		{
+			wait(5);
+			continue;
+		}
+		PCM_source_transfer_t transfer = { 0 };
+		transfer.time_s = pos / sr;
+		transfer.samplerate = sr;
+		transfer.nch = m_src_nch;
+		transfer.length = chunk;
+		transfer.samples = chunkbuf.data();
+		m_src->GetSamples(&transfer);
+		for (int i = transfer.samples_out*m_src_nch; i < chunk*m_src_nch; ++i)
+			chunkbuf[i] = 0.0;
+		// Don't bother writing audio the audio thread no longer wants
+		if (m_seek_generation.load(std::memory_order_acquire) != generation)
+			continue;
+		for (int i = 0; i < chunk; ++i)
+		{
+			ReaSample* dest = &m_ring[((writeindex + i) % m_capacity)*m_src_nch];
+			for (int j = 0; j < m_src_nch; ++j)
+				dest[j] = chunkbuf[i*m_src_nch + j];
+		}
+		m_write_index.store(writeindex + chunk, std::memory_order_release);
+		pos += chunk;
+	}
+}
+
+static std::unique_ptr<MRP_PrefetchSource> g_prefetch_preview_source;
+static preview_register_t g_prefetch_prev_reg = { 0 };
+
+void stop_prefetched_take_preview()
+{
+	if (g_prefetch_preview_source == nullptr)
+		return;
+	StopPreview(&g_prefetch_prev_reg);
+	g_prefetch_preview_source.reset();
+#ifdef WIN32
+	DeleteCriticalSection(&g_prefetch_prev_reg.cs);
+#else
+	pthread_mutex_destroy(&g_prefetch_prev_reg.mutex);
+#endif
+}
+
+void toggle_prefetched_take_preview()
+{
+	if (g_prefetch_preview_source != nullptr)
+	{
+		stop_prefetched_take_preview();
+		return;
+	}
+	if (CountSelectedMediaItems(nullptr) == 0)
+		return;
+	MediaItem_Take* take = GetActiveTake(GetSelectedMediaItem(nullptr, 0));
+	if (take == nullptr || GetMediaItemTake_Source(take) == nullptr)
+		return;
+	PCM_source* dup = GetMediaItemTake_Source(take)->Duplicate();
+	if (dup == nullptr)
+		return;
+	g_prefetch_preview_source = std::unique_ptr<MRP_PrefetchSource>(new MRP_PrefetchSource(dup));
+	g_prefetch_prev_reg = preview_register_t{ 0 };
+	g_prefetch_prev_reg.src = g_prefetch_preview_source.get();
+	g_prefetch_prev_reg.volume = 1.0;
+	g_prefetch_prev_reg.loop = true;
+#ifdef WIN32
+	InitializeCriticalSection(&g_prefetch_prev_reg.cs);
+#else
+	pthread_mutexattr_t mta;
+	pthread_mutexattr_init(&mta);
+	pthread_mutexattr_settype(&mta, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&g_prefetch_prev_reg.mutex, &mta);
+#endif
+	PlayPreview(&g_prefetch_prev_reg);
+}
@@ -1,4 +1,5 @@
 #include "mrpexamplewindows.h"
+#include "mrp_pcm_source.h"
 #include <random>
 
 SimpleExampleWindow* g_simple_example_window=nullptr;
@@ -567,6 +568,56 @@ void TestMRPModalWindow::init_modal_dialog()
 }
 
 
+CallbackTimingWindow* g_callback_timing_window = nullptr;
+
+HWND toggle_callback_timing_window(HWND parent)
+{
+	if (is_valid_mrp_window(g_callback_timing_window) == false)
+		g_callback_timing_window = nullptr;
+	if (g_callback_timing_window == nullptr)
+	{
+		g_callback_timing_window = new CallbackTimingWindow(parent);
+		// Currently, if this isn't set to true, crash on Reaper quit
+		g_callback_timing_window->setDestroyOnClose(true);
+	}
+	g_callback_timing_window->setVisible(true);
+	return g_callback_timing_window->getWindowHandle();
+}
+
+CallbackTimingWindow::CallbackTimingWindow(HWND parent) : MRPWindow(parent, "MRP audio callback timing")
+{
+	m_timingcontrol = std::make_shared<CallbackTimingControl>(this);
+	add_control(m_timingcontrol);
+	m_resetbutton = std::make_shared<WinButton>(this, "Reset");
+	m_resetbutton->GenericNotifyCallback = [this](GenericNotifications)
+	{
+		if (m_timingcontrol->getTimingRing() != nullptr)
+			m_timingcontrol->getTimingRing()->reset();
+	};
+	add_control(m_resetbutton);
+	setSize(500, 250);
+	onRefreshTimer();
+}
+
+void CallbackTimingWindow::resized()
+{
+	MRP::Size sz = getSize();
+	m_resetbutton->setBounds({ 5, 5, 100, 20 });
+	m_timingcontrol->setBounds({ 5, 30, sz.getWidth() - 10, sz.getHeight() - 35 });
+}
+
+void CallbackTimingWindow::onRefreshTimer()
+{
+	MRP_PCMSource* src = nullptr;
+	if (CountSelectedMediaItems(nullptr) > 0)
+		src = get_take_mrp_pcm_source(GetActiveTake(GetSelectedMediaItem(nullptr, 0)));
+	if (src == nullptr)
+		src = get_test_pcm_source();
+	if (src != nullptr)
+		m_timingcontrol->setTimingRing(src->get_timing());
+	else m_timingcontrol->setTimingRing(nullptr);
+}
+
 HWND open_win_controls_window(HWND parent)
 {
 	static int counter = 1;
@@ -1,6 +1,8 @@
 
 #include "mylicecontrols.h"
 #include "utilfuncs.h"
+#include "pitch_bend_renderer.h"
+#include "audio_buffer_pool.h"
 #include "WDL/WDL/lice/lice.h"
 #include "WDL/WDL/lineparse.h"
 #include "reaper_plugin/reaper_plugin_functions.h"
@@ -513,7 +515,7 @@ void WaveformControl::setAudioAccessor(std::shared_ptr<AudioAccessor> accessor)
 	int blocksize = 16384;
 	int sr = 44100;
 	int numchans = 2;
-	std::vector<double> buffer(blocksize*numchans);
+	pooled_buffer buffer = get_audio_buffer_pool().acquire(blocksize*numchans);
 	while (time < endtime)
 	{
 		GetAudioAccessorSamples(m_accessor.get(), sr, numchans, time, blocksize, buffer.data());
@@ -1034,6 +1036,17 @@ void EnvelopeControl::set_waveformpainter(std::shared_ptr<WaveformPainter> paint
 	repaint();
 }
 
+PitchBenderEnvelopeControl::~PitchBenderEnvelopeControl()
+{
+	// The render may outlive the control, so it must not call back into it
+	if (m_renderer != nullptr)
+	{
+		m_renderer->set_job_callback(nullptr);
+		m_renderer->set_completion_callback(nullptr);
+		m_renderer->cancel();
+	}
+}
+
 bool PitchBenderEnvelopeControl::keyPressed(const ModifierKeys& modkeys, int keycode)
 {
 	if (keycode >= '1' && keycode <= '4')
@@ -1059,14 +1072,40 @@ bool PitchBenderEnvelopeControl::keyPressed(const ModifierKeys& modkeys, int key
 			m_active_envelope = 0;
 		repaint();
 	}
-	if (keycode == 'R' && m_envs.empty()==false)
+	if (keycode == 'R' && m_envs.size() >= 2)
 	{
-		std::string err = pitch_bend_selected_item(m_envs[0],m_envs[1], m_resampler_mode);
-		if (err.empty() == false)
+		if (m_renderer != nullptr && m_renderer->is_finished() == false)
+		{
+			m_renderer->cancel();
+			m_text = "Cancelling pitch bend...";
+			repaint();
+			return true;
+		}
+		std::string err;
+		m_renderer = pitch_bend_selected_items(*m_envs[0], *m_envs[1], m_resampler_mode, err);
+		if (m_renderer == nullptr)
 		{
 			m_text = std::string("Render error : ")+err;
+			repaint();
+			return true;
 		}
-		else m_text = "Pitch bend OK!";
+		m_renderer->set_job_callback([this](int, bool, const std::string&)
+		{
+			m_text = "Pitch bending " + std::to_string(m_renderer->get_num_finished()) + "/" +
+				std::to_string(m_renderer->get_num_jobs()) + " items";
+			repaint();
+		});
+		m_renderer->set_completion_callback([this](pitch_bend_renderer& r)
+		{
+			if (r.is_cancelled() == true)
+				m_text = "Pitch bend cancelled";
+			else if (r.get_num_failed() > 0)
+				m_text = "Render error : " + std::to_string(r.get_num_failed()) + " items failed";
+			else m_text = "Pitch bend OK!";
+			repaint();
+		});
+		m_text = "Pitch bending " + std::to_string(m_renderer->get_num_jobs()) + " items";
+		m_renderer->start();
 		repaint();
 		return true;
 	}
@@ -1127,76 +1166,6 @@ void PitchBenderEnvelopeControl::mousePressed(const MouseEvent & ev)
 	}
 }
 
-std::string pitch_bend_selected_item(std::shared_ptr<breakpoint_envelope> pchenv, 
-	std::shared_ptr<breakpoint_envelope> volenv,int rsmode)
-{
-	if (CountSelectedMediaItems(nullptr) == 0)
-		return "No item selected";
-	MediaItem* item = GetSelectedMediaItem(nullptr, 0);
-	MediaItem_Take* take = GetActiveTake(item);
-	if (take == nullptr)
-		return "Item has no active take";
-	PCM_source* src = GetMediaItemTake_Source(take);
-	std::string explanation = is_source_audio(src);
-	if (explanation.empty() == false)
-		return explanation;
-	REAPER_Resample_Interface* m_resampler = m_resampler = Resampler_Create();
-	m_resampler->Reset();
-	int bufsize = 128;
-	int numoutchans = src->GetNumChannels();
-	int outsamplerate = src->GetSampleRate();
-	std::vector<double> procbuf(bufsize * numoutchans);
-	std::vector<double> diskoutbuf(bufsize*numoutchans);
-	std::vector<double*> diskoutbufptrs(numoutchans);
-	for (int i = 0; i < numoutchans; ++i)
-		diskoutbufptrs[i] = &diskoutbuf[i*bufsize];
-	char cfg[] = { 'e','v','a','w', 32, 0 };
-	static int fncounter = 0;
-	char pathbuf[2048];
-	GetProjectPath(pathbuf, 2048);
-	std::string outfn = std::string(pathbuf)+ "/bendout_" + std::to_string(fncounter) + ".wav";
-	++fncounter;
-	PCM_sink* sink = PCM_Sink_Create(outfn.c_str(), cfg, sizeof(cfg), numoutchans, outsamplerate, true);
-	int mode = rsmode;
-	m_resampler->Extended(RESAMPLE_EXT_SETRSMODE, (void*)mode, 0, 0);
-	double counter = 0.0;
-	while (counter < src->GetLength())
-	{
-		double normpos = 1.0 / src->GetLength()*counter;
-		double semitones = -12.0 + 24.0*pchenv->interpolate(normpos);
-		double ratio = 1.0 / pow(1.05946309436, semitones);
-		m_resampler->SetRates(src->GetSampleRate(), src->GetSampleRate()*ratio);
-		double* resbuf = nullptr;
-		int wanted = m_resampler->ResamplePrepare(bufsize, numoutchans, &resbuf);
-		PCM_source_transfer_t transfer = { 0 };
-		transfer.time_s = counter;
-		transfer.length = wanted;
-		transfer.nch = numoutchans;
-		transfer.samplerate = outsamplerate;
-		transfer.samples = resbuf;
-		src->GetSamples(&transfer);
-		int resampled_out = m_resampler->ResampleOut(procbuf.data(), wanted, bufsize, numoutchans);
-		for (int j = 0; j < resampled_out; ++j)
-		{ 
-			// Interpolating per sample here seems to make things pretty slow on debug builds, 
-			// but release builds seem ok...
-			double gain = volenv->interpolate(normpos);
-			for (int i = 0; i < numoutchans; ++i)
-			{
-				diskoutbufptrs[i][j] = procbuf[j*numoutchans + i]*gain;
-			}
-		}
-		sink->WriteDoubles(diskoutbufptrs.data(), resampled_out, numoutchans, 0, 1);
-		counter += (double)wanted / outsamplerate;
-	}
-	delete sink;
-	delete m_resampler;
-	InsertMedia(outfn.c_str(), 3);
-	//if (m_adjust_item_length == true)
-		Main_OnCommand(40612, 0);
-	return std::string();
-}
-
 bool WaveformPainter::paint(LICE_IBitmap * bm, double starttime, double endtime, int x, int y, int w, int h)
 {
 	if (m_src == nullptr)
@@ -1236,37 +1205,58 @@ EnvelopeGeneratorEnvelopeControl::EnvelopeGeneratorEnvelopeControl(MRPWindow* pa
 	env->add_point({ 0.99,0.0 }, false);
 	env->sort_points();
 	add_envelope(env);
-	GenericNotifyCallback = [this,env](GenericNotifications reason)
+	m_write_timer.set_callback([this]()
+	{
+		if (m_write_pending == true)
+			write_to_reaper_envelope(false);
+		else m_write_timer.stop();
+	});
+	GenericNotifyCallback = [this](GenericNotifications reason)
 	{
-		TrackEnvelope* reaenv = GetSelectedEnvelope(nullptr);
-		if (reaenv != nullptr)
+		if (reason == GenericNotifications::ObjectMoved)
 		{
-			bool add_undo = true;
-			// We don't want to add Reaper undo entries while dragging the envelope points...
-			if (reason == GenericNotifications::ObjectMoved)
-				add_undo = false;
-			DeleteEnvelopePointRange(reaenv, 0.0, 10.0);
-			double last_time = 0.0;
-			for (int i = 0; i < 10; ++i)
+			// Dragging produces a notification per mouse move, coalesce those into timed writes.
+			// We also don't want to add Reaper undo entries while dragging the envelope points...
+			if (m_write_pending == false)
 			{
-				for (int j = 0; j < env->get_num_points(); ++j)
-				{
-					double pt_time = env->get_point(j).get_x();
-					double pt_value = env->get_point(j).get_y();
-					bool sort = false;
-					InsertEnvelopePoint(reaenv, i*1.0+pt_time, pt_value, 0, 0.0, false, &sort);
-				}
-				
+				m_write_pending = true;
+				m_write_timer.start(40);
 			}
-			Envelope_SortPoints(reaenv);
-			if (add_undo == true)
-				Undo_OnStateChangeEx("Generate envelope points", UNDO_STATE_TRACKCFG, - 1);
-			UpdateArrange();
+			return;
 		}
-		
+		write_to_reaper_envelope(true);
 	};
 }
 
+void EnvelopeGeneratorEnvelopeControl::write_to_reaper_envelope(bool addundo)
+{
+	m_write_pending = false;
+	TrackEnvelope* reaenv = GetSelectedEnvelope(nullptr);
+	if (reaenv == nullptr || m_envs.empty() == true)
+		return;
+	breakpoint_envelope* env = m_envs[0].get();
+	std::vector<reaper_envelope_point> points;
+	points.reserve(10 * env->get_num_points());
+	for (int i = 0; i < 10; ++i)
+	{
+		for (int j = 0; j < env->get_num_points(); ++j)
+		{
+			const envbreakpoint& pt = env->get_point(j);
+			points.emplace_back(i*1.0 + pt.get_x(), pt.get_y());
+		}
+	}
+	if (m_writer.write(reaenv, 0.0, 10.0, points) == true)
+	{
+		m_written_since_undo = true;
+		UpdateArrange();
+	}
+	if (addundo == true && m_written_since_undo == true)
+	{
+		Undo_OnStateChangeEx("Generate envelope points", UNDO_STATE_TRACKCFG, -1);
+		m_written_since_undo = false;
+	}
+}
+
 ZoomScrollBar::ZoomScrollBar(MRPWindow* parent) : LiceControl(parent)
 {
 
@@ -1423,3 +1413,58 @@ void ProgressControl::setProgressValue(double v)
 	v = bound_value(0.0, v, 1.0);
 	m_progress_val.store(v);
 }
+
+CallbackTimingControl::CallbackTimingControl(MRPWindow * parent) : LiceControl(parent)
+{
+	m_font.SetFromHFont(CreateFont(14, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE,
+		ANSI_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, DEFAULT_QUALITY, DEFAULT_PITCH, "Arial"));
+	m_font.SetTextColor(LICE_RGBA(255, 255, 255, 255));
+	m_timer.set_callback([this]() { repaint(); });
+	m_timer.start(200);
+}
+
+void CallbackTimingControl::setTimingRing(std::shared_ptr<callback_timing_ring> ring)
+{
+	if (ring == m_ring)
+		return;
+	m_ring = ring;
+	repaint();
+}
+
+void CallbackTimingControl::paint(PaintEvent & ev)
+{
+	LICE_FillRect(ev.bm, 0, 0, ev.bm->getWidth(), ev.bm->getHeight(), LICE_RGBA(0, 0, 0, 255));
+	if (m_ring == nullptr)
+	{
+		MRP_DrawTextHelper(ev.bm, &m_font, "No audio source", 2, 2, ev.bm->getWidth(), 20);
+		return;
+	}
+	callback_timing_stats stats = m_ring->get_stats();
+	char buf[256];
+	sprintf(buf, "%d callbacks, mean load %.1f%%, worst %.1f%% (%.2f ms), %d overruns",
+		stats.num_callbacks, stats.mean_load, stats.worst_load, stats.worst_ms, stats.num_overruns);
+	MRP_DrawTextHelper(ev.bm, &m_font, buf, 2, 2, ev.bm->getWidth(), 20);
+	int maxcount = 1;
+	for (int count : stats.histogram)
+		maxcount = std::max(maxcount, count);
+	const int numbins = callback_timing_stats::num_histogram_bins;
+	int top = 25;
+	int bottom = ev.bm->getHeight() - 18;
+	double binw = (double)ev.bm->getWidth() / numbins;
+	for (int i = 0; i < numbins; ++i)
+	{
+		int x0 = (int)(binw*i);
+		int x1 = (int)(binw*(i + 1)) - 1;
+		int barh = (int)((double)(bottom - top)*stats.histogram[i] / maxcount);
+		LICE_pixel color = LICE_RGBA(0, 200, 200, 255);
+		// Overruns
+		if (i == numbins - 1)
+			color = LICE_RGBA(255, 0, 0, 255);
+		LICE_FillRect(ev.bm, x0, bottom - barh, x1 - x0, barh, color);
+		if (i % 4 == 0)
+		{
+			sprintf(buf, "%d%%", i * 5);
+			MRP_DrawTextHelper(ev.bm, &m_font, buf, x0, bottom + 2, x0 + 40, ev.bm->getHeight());
+		}
+	}
+}
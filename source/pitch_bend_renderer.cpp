@@ -0,0 +1,342 @@
+#include "pitch_bend_renderer.h"
+#include <cstdio>
+#include <cmath>
+
+pitch_bend_renderer::pitch_bend_renderer(const breakpoint_envelope & pitchenv, const breakpoint_envelope & volenv,
+	int resamplermode, int maxinflight, work_stealing_pool & pool, std::shared_ptr<render_io_scheduler> io) :
+	m_pitch_env(pitchenv), m_vol_env(volenv), m_resampler_mode(resamplermode), m_pool(pool), m_io(std::move(io))
+{
+	m_pitch_env.sort_points();
+	m_vol_env.sort_points();
+	// Output frames per source frame for the envelope value
+	m_rate_table = envelope_integral_table(m_pitch_env, 0.0, 1.0, 4096, [](double v)
+	{
+		double semitones = -12.0 + 24.0*v;
+		return pow(2.0, -semitones / 12.0);
+	});
+	if (maxinflight <= 0)
+		maxinflight = pool.get_num_workers();
+	m_max_in_flight = std::max(1, maxinflight);
+}
+
+pitch_bend_renderer::~pitch_bend_renderer()
+{
+	for (auto& j : m_jobs)
+		release_job(*j);
+}
+
+int pitch_bend_renderer::add_item(MediaItem * item)
+{
+	if (m_started == true || item == nullptr)
+		return -1;
+	MediaItem_Take* take = GetActiveTake(item);
+	if (take == nullptr || is_source_audio(GetMediaItemTake_Source(take)).empty() == false)
+		return -1;
+	auto j = std::make_unique<job>();
+	j->m_item = item;
+	j->m_src_start = GetMediaItemTakeInfo_Value(take, "D_STARTOFFS");
+	j->m_src_length = GetMediaItemInfo_Value(item, "D_LENGTH")*GetMediaItemTakeInfo_Value(take, "D_PLAYRATE");
+	if (j->m_src_length <= 0.0)
+		return -1;
+	m_jobs.push_back(std::move(j));
+	return (int)m_jobs.size() - 1;
+}
+
+void pitch_bend_renderer::start()
+{
+	if (m_started == true)
+		return;
+	m_started = true;
+	m_self = shared_from_this();
+	launch_jobs();
+}
+
+double pitch_bend_renderer::get_progress() const
+{
+	if (m_jobs.empty() == true)
+		return 1.0;
+	double sum = 0.0;
+	for (auto& j : m_jobs)
+		sum += j->m_progress;
+	return sum / m_jobs.size();
+}
+
+bool pitch_bend_renderer::open_job(job & j)
+{
+	// The item may have been removed after it was added
+	if (ValidatePtr(j.m_item, "MediaItem*") == false)
+		return false;
+	MediaItem_Take* take = GetActiveTake(j.m_item);
+	if (take == nullptr || is_source_audio(GetMediaItemTake_Source(take)).empty() == false)
+		return false;
+	j.m_src = GetMediaItemTake_Source(take)->Duplicate();
+	j.m_resampler = Resampler_Create();
+	if (j.m_src == nullptr || j.m_resampler == nullptr)
+		return false;
+	j.m_resampler->Extended(RESAMPLE_EXT_SETRSMODE, (void*)(intptr_t)m_resampler_mode, 0, 0);
+	j.m_resampler->Reset();
+	j.m_nch = j.m_src->GetNumChannels();
+	j.m_sr = j.m_src->GetSampleRate();
+	j.m_read_pos = 0;
+	GUID guid;
+	genGuid(&guid);
+	char guidbuf[64];
+	guidToString(&guid, guidbuf);
+	char projpath[2048];
+	GetProjectPath(projpath, 2048);
+	j.m_outfn = std::string(projpath) + "/MRP_bend_" + guidbuf + ".wav";
+	char cfg[] = { 'e','v','a','w', 32, 0 };
+	j.m_sink = PCM_Sink_Create(j.m_outfn.c_str(), cfg, sizeof(cfg), j.m_nch, (int)j.m_sr, false);
+	if (j.m_sink == nullptr)
+		return false;
+	j.m_stream = m_io->open_stream(j.m_sink, j.m_nch);
+	if (j.m_stream == nullptr)
+		return false;
+	for (auto& b : m_buffers)
+	{
+		if (b->m_in_use == false)
+		{
+			j.m_buffers = b.get();
+			break;
+		}
+	}
+	if (j.m_buffers == nullptr)
+	{
+		m_buffers.push_back(std::make_unique<buffer_set>());
+		j.m_buffers = m_buffers.back().get();
+	}
+	buffer_set& b = *j.m_buffers;
+	b.m_in_use = true;
+	b.m_arena.reset();
+	b.m_source = b.m_arena.allocate<ReaSample>(block_size*j.m_nch);
+	b.m_resampled = b.m_arena.allocate<ReaSample>(block_size*j.m_nch);
+	b.m_gain = b.m_arena.allocate<double>(block_size);
+	b.m_planar_pointers = b.m_arena.allocate_channels(j.m_nch, block_size);
+	b.m_source_pos = 0;
+	b.m_source_avail = 0;
+	return true;
+}
+
+void pitch_bend_renderer::release_job(job & j)
+{
+	m_io->close_stream(j.m_stream);
+	j.m_stream = nullptr;
+	// Deleting the sink finishes the file
+	delete j.m_sink;
+	j.m_sink = nullptr;
+	delete j.m_resampler;
+	j.m_resampler = nullptr;
+	delete j.m_src;
+	j.m_src = nullptr;
+	if (j.m_buffers != nullptr)
+	{
+		j.m_buffers->m_in_use = false;
+		j.m_buffers = nullptr;
+	}
+}
+
+void pitch_bend_renderer::launch_jobs()
+{
+	while (m_in_flight < m_max_in_flight && m_io->can_open_stream() == true && m_next_job < (int)m_jobs.size())
+	{
+		int index = m_next_job;
+		++m_next_job;
+		job& j = *m_jobs[index];
+		if (is_cancelled() == true || open_job(j) == false)
+		{
+			finish_job(index);
+			continue;
+		}
+		++m_in_flight;
+		m_pool.submit([this, index]()
+		{
+			job& j = *m_jobs[index];
+			bool ok = render_job(j);
+			// The sink may only be deleted after the job's last chunk has been written
+			m_io->finish_stream(j.m_stream, [this, index, ok]()
+			{
+				execute_in_main_thread([this, index, ok]()
+				{
+					m_jobs[index]->m_ok = ok;
+					--m_in_flight;
+					finish_job(index);
+					launch_jobs();
+				});
+			});
+		});
+	}
+	// The scheduler is shared, so the other renders may have all the streams open. Without jobs in flight
+	// no job completion would call this again, so the scheduler calls it when a stream is closed.
+	if (m_in_flight == 0 && m_next_job < (int)m_jobs.size() && m_waiting_for_stream == false)
+	{
+		m_waiting_for_stream = true;
+		m_io->wait_for_stream([this]()
+		{
+			m_waiting_for_stream = false;
+			launch_jobs();
+		});
+	}
+	if (m_in_flight == 0 && m_next_job == (int)m_jobs.size() && m_self != nullptr)
+	{
+		// Released at the end of this scope, which may destroy the renderer
+		auto self = std::move(m_self);
+		if (m_completion_callback)
+			m_completion_callback(*this);
+	}
+}
+
+void pitch_bend_renderer::finish_job(int index)
+{
+	job& j = *m_jobs[index];
+	release_job(j);
+	if (j.m_ok == true && is_cancelled() == false)
+	{
+		if (ValidatePtr(j.m_item, "MediaItem*") == true)
+			insert_result(j);
+	}
+	else
+	{
+		j.m_ok = false;
+		if (j.m_outfn.empty() == false)
+			remove(j.m_outfn.c_str());
+		++m_num_failed;
+	}
+	j.m_progress = 1.0;
+	++m_num_finished;
+	if (m_job_callback)
+		m_job_callback(index, j.m_ok, j.m_outfn);
+}
+
+void pitch_bend_renderer::insert_result(job & j)
+{
+	Undo_BeginBlock();
+	MediaItem_Take* take = AddTakeToMediaItem(j.m_item);
+	PCM_source* src = PCM_Source_CreateFromFile(j.m_outfn.c_str());
+	SetMediaItemTake_Source(take, src);
+	SetActiveTake(take);
+	SetMediaItemInfo_Value(j.m_item, "D_LENGTH", j.m_src_length*get_length_ratio());
+	UpdateArrange();
+	Undo_EndBlock("Pitch bend item", UNDO_STATE_ITEMS);
+}
+
+void pitch_bend_renderer::read_source(job & j, int frames, ReaSample * dest)
+{
+	buffer_set& b = *j.m_buffers;
+	const int nch = j.m_nch;
+	const int64_t sectionframes = (int64_t)(j.m_src_length*j.m_sr);
+	while (frames > 0)
+	{
+		if (b.m_source_avail == 0)
+		{
+			// Past the end of the section the resampler gets silence, so that it can output its buffered tail
+			int n = (int)std::min<int64_t>(block_size, std::max<int64_t>(0, sectionframes - j.m_read_pos));
+			int got = 0;
+			if (n > 0)
+			{
+				PCM_source_transfer_t transfer = { 0 };
+				transfer.time_s = j.m_src_start + j.m_read_pos / j.m_sr;
+				transfer.samplerate = j.m_sr;
+				transfer.nch = nch;
+				transfer.length = n;
+				transfer.samples = b.m_source;
+				j.m_src->GetSamples(&transfer);
+				got = transfer.samples_out;
+			}
+			else n = block_size;
+			for (int i = got*nch; i < n*nch; ++i)
+				b.m_source[i] = 0.0;
+			j.m_read_pos += n;
+			b.m_source_pos = 0;
+			b.m_source_avail = n;
+		}
+		int n = std::min(frames, b.m_source_avail);
+		const ReaSample* src = &b.m_source[b.m_source_pos*nch];
+		for (int i = 0; i < n*nch; ++i)
+			dest[i] = src[i];
+		dest += n*nch;
+		b.m_source_pos += n;
+		b.m_source_avail -= n;
+		frames -= n;
+	}
+}
+
+bool pitch_bend_renderer::render_job(job & j)
+{
+	buffer_set& b = *j.m_buffers;
+	REAPER_Resample_Interface* rs = j.m_resampler;
+	const int nch = j.m_nch;
+	const double sr = j.m_sr;
+	const double seclen = j.m_src_length;
+	const int64_t totalout = (int64_t)(seclen*get_length_ratio()*sr);
+	// Position in the source section, in seconds, of an output frame
+	auto source_time = [this, sr, seclen](int64_t frame)
+	{
+		return seclen*m_rate_table.inverse_integral(frame / sr / seclen);
+	};
+	int64_t outpos = 0;
+	while (outpos < totalout)
+	{
+		if (m_cancel.is_cancelled() == true)
+			return false;
+		const int n = (int)std::min<int64_t>(block_size, totalout - outpos);
+		int filled = 0;
+		int stalls = 0;
+		while (filled < n)
+		{
+			// The ramp steps stay aligned to the output position even when the resampler returns fewer frames
+			int64_t f0 = outpos + filled;
+			int m = std::min(ramp_size - (int)(f0 % ramp_size), n - filled);
+			double s0 = source_time(f0);
+			double s1 = source_time(f0 + m);
+			double srcframesperframe = std::max(1.0e-3, (s1 - s0)*sr / m);
+			rs->SetRates(sr, sr / srcframesperframe);
+			ReaSample* rsbuf = nullptr;
+			int wanted = rs->ResamplePrepare(m, nch, &rsbuf);
+			read_source(j, wanted, rsbuf);
+			int got = rs->ResampleOut(&b.m_resampled[filled*nch], wanted, m, nch);
+			if (got > 0)
+			{
+				m_vol_env.interpolate_block(s0 / seclen, (s1 - s0) / seclen / m, &b.m_gain[filled], got);
+				filled += got;
+				stalls = 0;
+			}
+			else if (++stalls > 64)
+			{
+				// Should not happen, but a resampler that stopped producing must not hang the render
+				for (int i = filled; i < n; ++i)
+					b.m_gain[i] = 0.0;
+				filled = n;
+			}
+		}
+		for (int i = 0; i < n; ++i)
+		{
+			const double gain = b.m_gain[i];
+			for (int k = 0; k < nch; ++k)
+				b.m_planar_pointers[k][i] = b.m_resampled[i*nch + k] * gain;
+		}
+		m_io->write(j.m_stream, b.m_planar_pointers, n);
+		outpos += n;
+		j.m_progress = (double)outpos / totalout;
+	}
+	return true;
+}
+
+std::shared_ptr<pitch_bend_renderer> pitch_bend_selected_items(const breakpoint_envelope & pitchenv,
+	const breakpoint_envelope & volenv, int resamplermode, std::string & err)
+{
+	int numitems = CountSelectedMediaItems(nullptr);
+	if (numitems == 0)
+	{
+		err = "No item selected";
+		return nullptr;
+	}
+	auto renderer = std::make_shared<pitch_bend_renderer>(pitchenv, volenv, resamplermode);
+	for (int i = 0; i < numitems; ++i)
+		renderer->add_item(GetSelectedMediaItem(nullptr, i));
+	if (renderer->get_num_jobs() == 0)
+	{
+		err = "None of the selected items has an audio take";
+		return nullptr;
+	}
+	return renderer;
+}
@@ -0,0 +1,294 @@
+#include "pitch_render_engine.h"
+#include <cstdio>
+
+pitch_render_engine::pitch_render_engine(int maxinflight, work_stealing_pool & pool, std::shared_ptr<render_io_scheduler> io) :
+	m_pool(pool), m_io(std::move(io))
+{
+	if (maxinflight <= 0)
+		maxinflight = pool.get_num_workers();
+	m_max_in_flight = std::max(1, maxinflight);
+}
+
+pitch_render_engine::~pitch_render_engine()
+{
+	for (auto& j : m_jobs)
+		release_job(*j);
+}
+
+int pitch_render_engine::add_item(MediaItem * item, const pitch_render_params & renderparams)
+{
+	if (m_started == true || item == nullptr || renderparams.tempo <= 0.0 || renderparams.pitch <= 0.0)
+		return -1;
+	MediaItem_Take* take = GetActiveTake(item);
+	if (take == nullptr || is_source_audio(GetMediaItemTake_Source(take)).empty() == false)
+		return -1;
+	auto j = std::make_unique<job>();
+	j->m_item = item;
+	j->m_params = renderparams;
+	j->m_src_start = GetMediaItemTakeInfo_Value(take, "D_STARTOFFS");
+	j->m_src_length = GetMediaItemInfo_Value(item, "D_LENGTH")*GetMediaItemTakeInfo_Value(take, "D_PLAYRATE");
+	m_jobs.push_back(std::move(j));
+	return (int)m_jobs.size() - 1;
+}
+
+void pitch_render_engine::start()
+{
+	if (m_started == true)
+		return;
+	m_started = true;
+	m_self = shared_from_this();
+	launch_jobs();
+}
+
+double pitch_render_engine::get_progress() const
+{
+	if (m_jobs.empty() == true)
+		return 1.0;
+	double sum = 0.0;
+	for (auto& j : m_jobs)
+		sum += j->m_progress;
+	return sum / m_jobs.size();
+}
+
+bool pitch_render_engine::open_job(job & j)
+{
+	// The item may have been removed after it was added
+	if (ValidatePtr(j.m_item, "MediaItem*") == false)
+		return false;
+	MediaItem_Take* take = GetActiveTake(j.m_item);
+	if (take == nullptr || is_source_audio(GetMediaItemTake_Source(take)).empty() == false)
+		return false;
+	j.m_src = GetMediaItemTake_Source(take)->Duplicate();
+	j.m_shifter = ReaperGetPitchShiftAPI(REAPER_PITCHSHIFT_API_VER);
+	if (j.m_src == nullptr || j.m_shifter == nullptr)
+		return false;
+	j.m_nch = j.m_src->GetNumChannels();
+	j.m_sr = j.m_src->GetSampleRate();
+	GUID guid;
+	genGuid(&guid);
+	char guidbuf[64];
+	guidToString(&guid, guidbuf);
+	char projpath[2048];
+	GetProjectPath(projpath, 2048);
+	j.m_outfn = std::string(projpath) + "/MRP_render_" + guidbuf + ".wav";
+	char cfg[] = { 'e','v','a','w', 32, 0 };
+	j.m_sink = PCM_Sink_Create(j.m_outfn.c_str(), cfg, sizeof(cfg), j.m_nch, (int)j.m_sr, false);
+	if (j.m_sink == nullptr)
+		return false;
+	j.m_stream = m_io->open_stream(j.m_sink, j.m_nch);
+	if (j.m_stream == nullptr)
+		return false;
+	for (auto& b : m_buffers)
+	{
+		if (b->m_in_use == false)
+		{
+			j.m_buffers = b.get();
+			break;
+		}
+	}
+	if (j.m_buffers == nullptr)
+	{
+		m_buffers.push_back(std::make_unique<buffer_set>());
+		j.m_buffers = m_buffers.back().get();
+	}
+	buffer_set& b = *j.m_buffers;
+	b.m_in_use = true;
+	b.m_arena.reset();
+	b.m_interleaved = b.m_arena.allocate<ReaSample>(block_size*j.m_nch);
+	b.m_planar_pointers = b.m_arena.allocate_channels(j.m_nch, block_size);
+	return true;
+}
+
+void pitch_render_engine::release_job(job & j)
+{
+	m_io->close_stream(j.m_stream);
+	j.m_stream = nullptr;
+	// Deleting the sink finishes the file
+	delete j.m_sink;
+	j.m_sink = nullptr;
+	delete j.m_shifter;
+	j.m_shifter = nullptr;
+	delete j.m_src;
+	j.m_src = nullptr;
+	if (j.m_buffers != nullptr)
+	{
+		j.m_buffers->m_in_use = false;
+		j.m_buffers = nullptr;
+	}
+}
+
+void pitch_render_engine::launch_jobs()
+{
+	while (m_in_flight < m_max_in_flight && m_io->can_open_stream() == true && m_next_job < (int)m_jobs.size())
+	{
+		int index = m_next_job;
+		++m_next_job;
+		job& j = *m_jobs[index];
+		if (is_cancelled() == true || open_job(j) == false)
+		{
+			finish_job(index);
+			continue;
+		}
+		++m_in_flight;
+		m_pool.submit([this, index]()
+		{
+			job& j = *m_jobs[index];
+			bool ok = render_job(j, m_cancel, *m_io);
+			// The sink may only be deleted after the job's last chunk has been written
+			m_io->finish_stream(j.m_stream, [this, index, ok]()
+			{
+				execute_in_main_thread([this, index, ok]()
+				{
+					m_jobs[index]->m_ok = ok;
+					--m_in_flight;
+					finish_job(index);
+					launch_jobs();
+				});
+			});
+		});
+	}
+	// The scheduler is shared, so the other renders may have all the streams open. Without jobs in flight
+	// no job completion would call this again, so the scheduler calls it when a stream is closed.
+	if (m_in_flight == 0 && m_next_job < (int)m_jobs.size() && m_waiting_for_stream == false)
+	{
+		m_waiting_for_stream = true;
+		m_io->wait_for_stream([this]()
+		{
+			m_waiting_for_stream = false;
+			launch_jobs();
+		});
+	}
+	if (m_in_flight == 0 && m_next_job == (int)m_jobs.size() && m_self != nullptr)
+	{
+		// Released at the end of this scope, which may destroy the engine
+		auto self = std::move(m_self);
+		if (m_completion_callback)
+			m_completion_callback(*this);
+	}
+}
+
+void pitch_render_engine::finish_job(int index)
+{
+	job& j = *m_jobs[index];
+	release_job(j);
+	if (j.m_ok == true && is_cancelled() == false)
+	{
+		if (j.m_params.insert_take == true && ValidatePtr(j.m_item, "MediaItem*") == true)
+			insert_result(j);
+	}
+	else
+	{
+		j.m_ok = false;
+		if (j.m_outfn.empty() == false)
+			remove(j.m_outfn.c_str());
+		++m_num_failed;
+	}
+	j.m_progress = 1.0;
+	j.m_done = true;
+	++m_num_finished;
+	if (m_job_callback)
+		m_job_callback(index, j.m_ok, j.m_outfn);
+}
+
+void pitch_render_engine::insert_result(job & j)
+{
+	Undo_BeginBlock();
+	MediaItem_Take* take = AddTakeToMediaItem(j.m_item);
+	PCM_source* src = PCM_Source_CreateFromFile(j.m_outfn.c_str());
+	SetMediaItemTake_Source(take, src);
+	SetActiveTake(take);
+	SetMediaItemInfo_Value(j.m_item, "D_LENGTH", j.m_src_length / j.m_params.tempo);
+	UpdateArrange();
+	Undo_EndBlock("Insert pitch shifter render", UNDO_STATE_ITEMS);
+}
+
+bool pitch_render_engine::render_job(job & j, const cancellation_token & cancel, render_io_scheduler& io)
+{
+	IReaperPitchShift* shifter = j.m_shifter;
+	buffer_set& b = *j.m_buffers;
+	const int nch = j.m_nch;
+	shifter->set_srate(j.m_sr);
+	shifter->set_nch(nch);
+	shifter->set_tempo(j.m_params.tempo);
+	shifter->set_shift(j.m_params.pitch);
+	shifter->SetQualityParameter(j.m_params.quality);
+	shifter->Reset();
+	const int64_t totalin = (int64_t)(j.m_src_length*j.m_sr);
+	const int64_t totalout = (int64_t)(totalin / j.m_params.tempo);
+	int64_t inpos = 0;
+	int64_t outpos = 0;
+	// Writes frames from the interleaved buffer, never past the expected length
+	auto write_output = [&](int frames)
+	{
+		int n = (int)std::min<int64_t>(frames, totalout - outpos);
+		for (int i = 0; i < n; ++i)
+			for (int k = 0; k < nch; ++k)
+				b.m_planar_pointers[k][i] = b.m_interleaved[i*nch + k];
+		io.write(j.m_stream, b.m_planar_pointers, n);
+		outpos += n;
+	};
+	// Takes all output the shifter has available
+	auto drain = [&]()
+	{
+		while (outpos < totalout)
+		{
+			int got = shifter->GetSamples(block_size, b.m_interleaved);
+			if (got <= 0)
+				break;
+			write_output(got);
+		}
+	};
+	while (inpos < totalin)
+	{
+		if (cancel.is_cancelled() == true)
+			return false;
+		int n = (int)std::min<int64_t>(block_size, totalin - inpos);
+		ReaSample* inbuf = shifter->GetBuffer(n);
+		PCM_source_transfer_t transfer = { 0 };
+		transfer.time_s = j.m_src_start + inpos / j.m_sr;
+		transfer.samplerate = j.m_sr;
+		transfer.nch = nch;
+		transfer.length = n;
+		transfer.samples = inbuf;
+		j.m_src->GetSamples(&transfer);
+		for (int i = transfer.samples_out*nch; i < n*nch; ++i)
+			inbuf[i] = 0.0;
+		shifter->BufferDone(n);
+		inpos += n;
+		drain();
+		j.m_progress = (double)inpos / totalin;
+	}
+	shifter->FlushSamples();
+	drain();
+	// Whatever the shifter didn't produce is written as silence, so the result always has the expected length
+	while (outpos < totalout)
+	{
+		for (int i = 0; i < block_size*nch; ++i)
+			b.m_interleaved[i] = 0.0;
+		write_output(block_size);
+	}
+	return true;
+}
+
+void render_selected_items_with_pitch_shifter(double tempo, double pitch, int maxinflight,
+	std::function<void(double)> done)
+{
+	auto engine = std::make_shared<pitch_render_engine>(maxinflight);
+	pitch_render_params renderparams;
+	renderparams.tempo = tempo;
+	renderparams.pitch = pitch;
+	for (int i = 0; i < CountSelectedMediaItems(nullptr); ++i)
+		engine->add_item(GetSelectedMediaItem(nullptr, i), renderparams);
+	if (engine->get_num_jobs() == 0)
+		return;
+	double t0 = time_precise();
+	engine->set_completion_callback([t0, done](pitch_render_engine& e)
+	{
+		double elapsed = time_precise() - t0;
+		readbg() << e.get_num_jobs() - e.get_num_failed() << " of " << e.get_num_jobs() << " items rendered in "
+			<< elapsed << " seconds\n";
+		if (done)
+			done(elapsed);
+	});
+	engine->start();
+}
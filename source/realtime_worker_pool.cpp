@@ -0,0 +1,140 @@
+#include "realtime_worker_pool.h"
+#ifdef WIN32
+#include <windows.h>
+#endif
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
+#endif
+
+realtime_worker_pool::realtime_worker_pool(int numthreads)
+{
+	if (numthreads < 0)
+		numthreads = (int)std::thread::hardware_concurrency() - 1;
+	if (numthreads < 0)
+		numthreads = 0;
+	for (int i = 0; i < numthreads; ++i)
+	{
+		m_threads.emplace_back([this, i]() { worker_proc(i); });
+#ifdef WIN32
+		HANDLE h = m_threads.back().native_handle();
+		int numcores = (int)std::thread::hardware_concurrency();
+		// Leave the first core for the audio thread that is most likely running there
+		SetThreadAffinityMask(h, (DWORD_PTR)1 << ((i + 1) % numcores));
+		SetThreadPriority(h, THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+#ifdef __APPLE__
+		// OS X doesn't allow binding threads to cores, but different affinity tags
+		// ask for the threads to be kept on different cores
+		thread_affinity_policy_data_t policy = { i + 1 };
+		thread_policy_set(pthread_mach_thread_np(m_threads.back().native_handle()), THREAD_AFFINITY_POLICY,
+			(thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
+#endif
+	}
+}
+
+realtime_worker_pool::~realtime_worker_pool()
+{
+	m_quit = true;
+	{
+		std::lock_guard<std::mutex> locker(m_wake_mutex);
+		m_wake_cv.notify_all();
+	}
+	for (auto& t : m_threads)
+		t.join();
+}
+
+bool realtime_worker_pool::run_one_job(uint32_t generation)
+{
+	uint64_t claim = m_claim.load(std::memory_order_acquire);
+	while (true)
+	{
+		if ((uint32_t)(claim >> 32) != generation ||
+			(uint32_t)(claim & 0xffffffff) >= (uint32_t)m_num_jobs.load(std::memory_order_acquire))
+			return false;
+		if (m_claim.compare_exchange_weak(claim, claim + 1, std::memory_order_acq_rel) == true)
+			break;
+	}
+	// The batch can't end before this job is done, so the job function and the context stay valid
+	m_function(m_context, (int)(claim & 0xffffffff));
+	m_jobs_done.fetch_add(1, std::memory_order_acq_rel);
+	return true;
+}
+
+void realtime_worker_pool::run(int numjobs, job_function fn, void * context)
+{
+	if (numjobs < 1)
+		return;
+	if (m_threads.empty() == true || numjobs == 1 || m_busy.test_and_set(std::memory_order_acquire) == true)
+	{
+		for (int i = 0; i < numjobs; ++i)
+			fn(context, i);
+		return;
+	}
+	++m_generation;
+	// A worker still in run_one_job of the previous batch could otherwise see the new job count with its
+	// old claim still in place and run a job of this batch twice. An exhausted claim of the new generation
+	// makes its compare exchange fail once it can see anything of the new batch.
+	m_claim.store(((uint64_t)m_generation << 32) | 0xffffffff, std::memory_order_seq_cst);
+	m_function = fn;
+	m_context = context;
+	m_num_jobs.store(numjobs, std::memory_order_release);
+	m_jobs_done.store(0, std::memory_order_relaxed);
+	m_claim.store((uint64_t)m_generation << 32, std::memory_order_release);
+	// Not holding the mutex here, so a worker that is just going to sleep may miss this. It then sleeps
+	// until the next batch signals it, and the other threads do the work meanwhile.
+	if (m_num_sleeping.load() > 0)
+		m_wake_cv.notify_all();
+	while (run_one_job(m_generation) == true)
+		;
+	// Wait for the jobs the workers are still running
+	while (m_jobs_done.load(std::memory_order_acquire) < numjobs)
+		std::this_thread::yield();
+	m_busy.clear(std::memory_order_release);
+}
+
+void realtime_worker_pool::worker_proc(int index)
+{
+	uint32_t seen_generation = 0;
+	while (m_quit == false)
+	{
+		uint32_t generation = (uint32_t)(m_claim.load(std::memory_order_acquire) >> 32);
+		if (generation != seen_generation)
+		{
+			seen_generation = generation;
+			while (run_one_job(generation) == true)
+				;
+			// Spin a while for the next batch before going to sleep
+			for (int i = 0; i < 20000; ++i)
+			{
+				if ((uint32_t)(m_claim.load(std::memory_order_acquire) >> 32) != seen_generation || m_quit == true)
+					break;
+				if (i > 1000)
+					std::this_thread::yield();
+			}
+			continue;
+		}
+		std::unique_lock<std::mutex> locker(m_wake_mutex);
+		++m_num_sleeping;
+		m_wake_cv.wait(locker, [this, seen_generation]()
+		{
+			return m_quit == true || (uint32_t)(m_claim.load(std::memory_order_acquire) >> 32) != seen_generation;
+		});
+		--m_num_sleeping;
+	}
+}
+
+std::shared_ptr<realtime_worker_pool> get_shared_realtime_worker_pool()
+{
+	static std::mutex s_mutex;
+	static std::weak_ptr<realtime_worker_pool> s_pool;
+	std::lock_guard<std::mutex> locker(s_mutex);
+	auto result = s_pool.lock();
+	if (result == nullptr)
+	{
+		result = std::make_shared<realtime_worker_pool>();
+		s_pool = result;
+	}
+	return result;
+}
@@ -0,0 +1,77 @@
+#include "reaper_envelope_writer.h"
+#include "utilfuncs.h"
+
+bool reaper_envelope_writer::write(TrackEnvelope* env, double starttime, double endtime, 
+	const std::vector<reaper_envelope_point>& points)
+{
+	if (env == nullptr)
+		return false;
+	m_last_num_updated = 0;
+	if (can_update_in_place(env, starttime, endtime, points) == false)
+	{
+		rewrite_range(env, starttime, endtime, points);
+		m_last_num_updated = (int)points.size();
+		return true;
+	}
+	bool nosort = true;
+	for (int i = 0; i < points.size(); ++i)
+	{
+		reaper_envelope_point pt = points[i];
+		if (pt != m_written[i])
+		{
+			SetEnvelopePoint(env, m_first_index + i, &pt.time, &pt.value, &pt.shape, &pt.tension, nullptr, &nosort);
+			m_written[i] = pt;
+			++m_last_num_updated;
+		}
+	}
+	return m_last_num_updated > 0;
+}
+
+bool reaper_envelope_writer::can_update_in_place(TrackEnvelope* env, double starttime, double endtime,
+	const std::vector<reaper_envelope_point>& points)
+{
+	if (env != m_env || starttime != m_start_time || endtime != m_end_time)
+		return false;
+	if (points.size() != m_written.size() || points.empty() == true)
+		return false;
+	// In place updates with no sorting are only valid if the new points keep the order
+	for (int i = 1; i < points.size(); ++i)
+		if (points[i].time < points[i - 1].time)
+			return false;
+	if (points.front().time < starttime || points.back().time >= endtime)
+		return false;
+	// Check the envelope still looks like we left it, it could have been edited in Reaper meanwhile
+	if (CountEnvelopePoints(env) != m_expected_count)
+		return false;
+	double t0 = 0.0;
+	double t1 = 0.0;
+	GetEnvelopePoint(env, m_first_index, &t0, nullptr, nullptr, nullptr, nullptr);
+	GetEnvelopePoint(env, m_first_index + (int)m_written.size() - 1, &t1, nullptr, nullptr, nullptr, nullptr);
+	return t0 == m_written.front().time && t1 == m_written.back().time;
+}
+
+void reaper_envelope_writer::rewrite_range(TrackEnvelope* env, double starttime, double endtime,
+	const std::vector<reaper_envelope_point>& points)
+{
+	DeleteEnvelopePointRange(env, starttime, endtime);
+	bool nosort = true;
+	for (auto& pt : points)
+		InsertEnvelopePoint(env, pt.time, pt.value, pt.shape, pt.tension, false, &nosort);
+	Envelope_SortPoints(env);
+	// Find where our points ended up
+	int index = GetEnvelopePointByTime(env, starttime);
+	while (index >= 0)
+	{
+		double t = 0.0;
+		GetEnvelopePoint(env, index, &t, nullptr, nullptr, nullptr, nullptr);
+		if (t < starttime)
+			break;
+		--index;
+	}
+	m_first_index = index + 1;
+	m_expected_count = CountEnvelopePoints(env);
+	m_env = env;
+	m_start_time = starttime;
+	m_end_time = endtime;
+	m_written = points;
+}
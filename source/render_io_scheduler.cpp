@@ -0,0 +1,211 @@
+#include "render_io_scheduler.h"
+#include "utilfuncs.h"
+#include <cstdio>
+#include <cstdlib>
+
+static const char* g_render_io_section = "MRP_render_io";
+
+render_io_settings render_io_settings::load()
+{
+	render_io_settings result;
+	auto read_int = [](const char* key, int defaultvalue, int minvalue, int maxvalue)
+	{
+		if (HasExtState(g_render_io_section, key) == false)
+			return defaultvalue;
+		return bound_value(minvalue, atoi(GetExtState(g_render_io_section, key)), maxvalue);
+	};
+	result.m_writer_threads = read_int("writer_threads", result.m_writer_threads, 1, 16);
+	result.m_max_open_sinks = read_int("max_open_sinks", result.m_max_open_sinks, 1, 256);
+	result.m_write_chunk_frames = read_int("write_chunk_frames", result.m_write_chunk_frames, 1024, 1 << 22);
+	return result;
+}
+
+void render_io_settings::save() const
+{
+	char buf[32];
+	sprintf(buf, "%d", m_writer_threads);
+	SetExtState(g_render_io_section, "writer_threads", buf, true);
+	sprintf(buf, "%d", m_max_open_sinks);
+	SetExtState(g_render_io_section, "max_open_sinks", buf, true);
+	sprintf(buf, "%d", m_write_chunk_frames);
+	SetExtState(g_render_io_section, "write_chunk_frames", buf, true);
+}
+
+render_io_scheduler::render_io_scheduler(const render_io_settings& settings) : m_settings(settings)
+{
+	m_settings.m_writer_threads = std::max(1, m_settings.m_writer_threads);
+	m_settings.m_max_open_sinks = std::max(1, m_settings.m_max_open_sinks);
+	m_settings.m_write_chunk_frames = std::max(1024, m_settings.m_write_chunk_frames);
+	// A chunk being filled for each stream and one being written for each stream
+	m_max_chunks = 2 * m_settings.m_max_open_sinks;
+	for (int i = 0; i < m_settings.m_writer_threads; ++i)
+		m_writers.push_back(std::make_unique<writer>());
+	for (int i = 0; i < m_settings.m_writer_threads; ++i)
+		m_writers[i]->m_thread = std::thread([this, i]() { writer_proc(i); });
+}
+
+render_io_scheduler::~render_io_scheduler()
+{
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_quit = true;
+	}
+	m_cv.notify_all();
+	for (auto& w : m_writers)
+		w->m_thread.join();
+}
+
+render_io_scheduler::stream* render_io_scheduler::open_stream(PCM_sink * sink, int nch)
+{
+	if (sink == nullptr || nch < 1)
+		return nullptr;
+	stream* s = new stream;
+	s->m_sink = sink;
+	s->m_nch = nch;
+	s->m_writer = m_next_writer;
+	m_next_writer = (m_next_writer + 1) % (int)m_writers.size();
+	++m_num_open;
+	return s;
+}
+
+void render_io_scheduler::close_stream(stream * s)
+{
+	if (s == nullptr)
+		return;
+	if (s->m_chunk != nullptr)
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_free_chunks.push_back(std::move(s->m_chunk));
+	}
+	m_cv.notify_all();
+	delete s;
+	--m_num_open;
+	if (m_stream_waiters.empty() == false)
+	{
+		// Called later, so the waiting render doesn't open a stream in the middle of another render's cleanup
+		execute_in_main_thread(std::move(m_stream_waiters.front()));
+		m_stream_waiters.pop_front();
+	}
+}
+
+void render_io_scheduler::wait_for_stream(std::function<void()> f)
+{
+	m_stream_waiters.push_back(std::move(f));
+}
+
+std::unique_ptr<render_io_scheduler::chunk> render_io_scheduler::get_chunk(int nch)
+{
+	std::unique_ptr<chunk> c;
+	{
+		std::unique_lock<std::mutex> locker(m_mutex);
+		m_cv.wait(locker, [this]() { return m_free_chunks.empty() == false || m_num_chunks < m_max_chunks; });
+		if (m_free_chunks.empty() == false)
+		{
+			c = std::move(m_free_chunks.back());
+			m_free_chunks.pop_back();
+		}
+		else ++m_num_chunks;
+	}
+	if (c == nullptr)
+		c = std::make_unique<chunk>();
+	const int capacity = m_settings.m_write_chunk_frames;
+	c->m_data.resize((size_t)capacity*nch);
+	c->m_pointers.resize(nch);
+	for (int i = 0; i < nch; ++i)
+		c->m_pointers[i] = &c->m_data[(size_t)i*capacity];
+	c->m_nch = nch;
+	c->m_frames = 0;
+	return c;
+}
+
+void render_io_scheduler::queue(int writerindex, entry e)
+{
+	{
+		std::lock_guard<std::mutex> locker(m_mutex);
+		m_writers[writerindex]->m_queue.push_back(std::move(e));
+	}
+	m_cv.notify_all();
+}
+
+void render_io_scheduler::write(stream * s, double* const* data, int frames)
+{
+	const int capacity = m_settings.m_write_chunk_frames;
+	int pos = 0;
+	while (pos < frames)
+	{
+		if (s->m_chunk == nullptr)
+			s->m_chunk = get_chunk(s->m_nch);
+		chunk& c = *s->m_chunk;
+		int n = std::min(frames - pos, capacity - c.m_frames);
+		for (int ch = 0; ch < s->m_nch; ++ch)
+		{
+			const double* src = data[ch] + pos;
+			double* dest = c.m_pointers[ch] + c.m_frames;
+			for (int i = 0; i < n; ++i)
+				dest[i] = src[i];
+		}
+		c.m_frames += n;
+		pos += n;
+		if (c.m_frames == capacity)
+		{
+			entry e;
+			e.m_stream = s;
+			e.m_chunk = std::move(s->m_chunk);
+			queue(s->m_writer, std::move(e));
+		}
+	}
+}
+
+void render_io_scheduler::finish_stream(stream * s, std::function<void()> written)
+{
+	entry e;
+	e.m_stream = s;
+	if (s->m_chunk != nullptr && s->m_chunk->m_frames > 0)
+		e.m_chunk = std::move(s->m_chunk);
+	e.m_func = written;
+	queue(s->m_writer, std::move(e));
+}
+
+void render_io_scheduler::writer_proc(int index)
+{
+	writer& w = *m_writers[index];
+	while (true)
+	{
+		entry e;
+		{
+			std::unique_lock<std::mutex> locker(m_mutex);
+			m_cv.wait(locker, [this, &w]() { return m_quit == true || w.m_queue.empty() == false; });
+			// Quits only after everything queued has been written
+			if (w.m_queue.empty() == true)
+				return;
+			e = std::move(w.m_queue.front());
+			w.m_queue.pop_front();
+		}
+		if (e.m_chunk != nullptr)
+		{
+			chunk& c = *e.m_chunk;
+			e.m_stream->m_sink->WriteDoubles(c.m_pointers.data(), c.m_frames, c.m_nch, 0, 1);
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_free_chunks.push_back(std::move(e.m_chunk));
+			}
+			m_cv.notify_all();
+		}
+		if (e.m_func)
+			e.m_func();
+	}
+}
+
+static std::shared_ptr<render_io_scheduler> g_shared_scheduler;
+
+std::shared_ptr<render_io_scheduler> get_shared_render_io_scheduler()
+{
+	if (g_shared_scheduler == nullptr)
+		g_shared_scheduler = std::make_shared<render_io_scheduler>();
+	return g_shared_scheduler;
+}
+
+void shutdown_shared_render_io_scheduler()
+{
+	g_shared_scheduler.reset();
+}
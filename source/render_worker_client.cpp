@@ -0,0 +1,388 @@
+#include "render_worker_client.h"
+#include "utilfuncs.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#ifndef WIN32
+#include <spawn.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+static const char* g_render_worker_section = "MRP_render_worker";
+
+render_worker_settings render_worker_settings::load()
+{
+	render_worker_settings result;
+	auto read_int = [](const char* key, int defaultvalue, int minvalue, int maxvalue)
+	{
+		if (HasExtState(g_render_worker_section, key) == false)
+			return defaultvalue;
+		return bound_value(minvalue, atoi(GetExtState(g_render_worker_section, key)), maxvalue);
+	};
+	result.m_enabled = read_int("enabled", 0, 0, 1) == 1;
+	result.m_max_restarts = read_int("max_restarts", result.m_max_restarts, 0, 100);
+	result.m_timeout_seconds = read_int("timeout_seconds", result.m_timeout_seconds, 1, 600);
+	if (HasExtState(g_render_worker_section, "worker_path") == true)
+		result.m_worker_path = GetExtState(g_render_worker_section, "worker_path");
+	return result;
+}
+
+void render_worker_settings::save() const
+{
+	char buf[32];
+	SetExtState(g_render_worker_section, "enabled", m_enabled == true ? "1" : "0", true);
+	sprintf(buf, "%d", m_max_restarts);
+	SetExtState(g_render_worker_section, "max_restarts", buf, true);
+	sprintf(buf, "%d", m_timeout_seconds);
+	SetExtState(g_render_worker_section, "timeout_seconds", buf, true);
+	SetExtState(g_render_worker_section, "worker_path", m_worker_path.c_str(), true);
+}
+
+render_worker_client::render_worker_client(const render_worker_settings & settings) : m_settings(settings)
+{
+}
+
+render_worker_client::~render_worker_client()
+{
+	stop_worker(true);
+}
+
+void render_worker_client::set_settings(const render_worker_settings & settings)
+{
+	m_settings = settings;
+	if (m_settings.m_enabled == false)
+		stop_worker(true);
+}
+
+std::string render_worker_client::get_worker_path() const
+{
+	if (m_settings.m_worker_path.empty() == false)
+		return m_settings.m_worker_path;
+#ifdef WIN32
+	return std::string(GetResourcePath()) + "\\UserPlugins\\mrp_render_worker.exe";
+#else
+	return std::string(GetResourcePath()) + "/UserPlugins/mrp_render_worker";
+#endif
+}
+
+bool render_worker_client::start_worker()
+{
+	static int counter = 0;
+	char name[128];
+#ifdef WIN32
+	sprintf(name, "MRP_render_worker_%d_%d", (int)GetCurrentProcessId(), ++counter);
+#else
+	sprintf(name, "MRP_render_worker_%d_%d", (int)getpid(), ++counter);
+#endif
+	// Our end must exist before the worker connects to it
+	m_connection = std::make_unique<WDL_SHM_Connection>(false, name, render_worker_shm_size, m_settings.m_timeout_seconds);
+	std::string path = get_worker_path();
+#ifdef WIN32
+	std::string cmdline = "\"" + path + "\" " + name;
+	std::vector<char> cmdbuf(cmdline.begin(), cmdline.end());
+	cmdbuf.push_back(0);
+	STARTUPINFOA si = { 0 };
+	si.cb = sizeof(si);
+	PROCESS_INFORMATION pi = { 0 };
+	if (CreateProcessA(path.c_str(), cmdbuf.data(), nullptr, nullptr, FALSE, CREATE_NO_WINDOW,
+		nullptr, nullptr, &si, &pi) == FALSE)
+	{
+		m_last_error = "Could not start " + path;
+		m_connection.reset();
+		return false;
+	}
+	CloseHandle(pi.hThread);
+	m_process = pi.hProcess;
+#else
+	char* argv[] = { (char*)path.c_str(), name, nullptr };
+	pid_t pid = 0;
+	if (posix_spawn(&pid, path.c_str(), nullptr, nullptr, argv, environ) != 0)
+	{
+		m_last_error = "Could not start " + path;
+		m_connection.reset();
+		return false;
+	}
+	m_process = pid;
+#endif
+	// The worker says hello when it has connected
+	auto t0 = std::chrono::steady_clock::now();
+	while (true)
+	{
+		if (m_connection->Run() < 0)
+			break;
+		const char* payload = nullptr;
+		const render_worker_message_header* hdr = render_worker_peek_message(m_connection->recv_queue, payload);
+		if (hdr != nullptr && hdr->m_type == (int32_t)render_worker_message::hello)
+		{
+			int32_t version = 0;
+			if (hdr->m_size >= (int)sizeof(version))
+				memcpy(&version, payload, sizeof(version));
+			m_connection->recv_queue.Advance(sizeof(render_worker_message_header) + hdr->m_size);
+			m_connection->recv_queue.Compact();
+			if (version == render_worker_protocol_version)
+				return true;
+			m_last_error = "The render worker is from a different version of the plugin";
+			stop_worker(true);
+			return false;
+		}
+		if (is_process_alive() == false || std::chrono::steady_clock::now() - t0 > std::chrono::seconds(m_settings.m_timeout_seconds))
+			break;
+		wait_for_connection();
+	}
+	m_last_error = "The render worker " + path + " didn't connect";
+	stop_worker(false);
+	return false;
+}
+
+void render_worker_client::stop_worker(bool graceful)
+{
+	if (graceful == true && m_connection != nullptr && is_process_alive() == true)
+	{
+		render_worker_add_message(m_connection->send_queue, render_worker_message::quit, 0, 0);
+		auto t0 = std::chrono::steady_clock::now();
+		while (is_process_alive() == true && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(1))
+		{
+			if (m_connection->Run() < 0)
+				break;
+			wait_for_connection();
+		}
+	}
+#ifdef WIN32
+	if (m_process != nullptr)
+	{
+		if (WaitForSingleObject(m_process, 0) != WAIT_OBJECT_0)
+		{
+			TerminateProcess(m_process, 1);
+			WaitForSingleObject(m_process, 1000);
+		}
+		CloseHandle(m_process);
+		m_process = nullptr;
+	}
+#else
+	if (m_process > 0)
+	{
+		int status = 0;
+		if (waitpid(m_process, &status, WNOHANG) == 0)
+		{
+			kill(m_process, SIGKILL);
+			waitpid(m_process, &status, 0);
+		}
+		m_process = 0;
+	}
+#endif
+	m_connection.reset();
+}
+
+bool render_worker_client::is_process_alive()
+{
+#ifdef WIN32
+	return m_process != nullptr && WaitForSingleObject(m_process, 0) == WAIT_TIMEOUT;
+#else
+	if (m_process <= 0)
+		return false;
+	int status = 0;
+	if (waitpid(m_process, &status, WNOHANG) == 0)
+		return true;
+	// Exited and reaped
+	m_process = 0;
+	return false;
+#endif
+}
+
+void render_worker_client::wait_for_connection()
+{
+	HANDLE evt = m_connection != nullptr ? m_connection->GetWaitEvent() : nullptr;
+	if (evt != nullptr)
+		WaitForSingleObject(evt, 10);
+	else Sleep(10);
+}
+
+bool render_worker_client::process(const render_worker_job & job, const double * input, double * output,
+	int64_t frames, render_worker_block_stats & stats)
+{
+	int64_t done = 0;
+	bool allinworker = false;
+	if (m_settings.m_enabled == true)
+	{
+		int restarts = 0;
+		while (done < frames)
+		{
+			if (m_connection == nullptr && start_worker() == false)
+				break;
+			job_result result = run_job(job, input, output, frames, done, stats);
+			if (result == job_result::completed)
+				break;
+			// The worker refused the job, so another one would too
+			if (result == job_result::rejected)
+				break;
+			stop_worker(false);
+			++m_num_restarts;
+			if (++restarts > m_settings.m_max_restarts)
+				break;
+		}
+		allinworker = done == frames;
+	}
+	else m_last_error = "The render worker is disabled";
+	const int nch = job.m_nch;
+	while (done < frames)
+	{
+		int n = (int)std::min<int64_t>(65536, frames - done);
+		process_render_worker_block(job, done, input + done*nch, output + done*nch, n, stats);
+		done += n;
+	}
+	return allinworker;
+}
+
+render_worker_client::job_result render_worker_client::run_job(const render_worker_job & job, const double * input,
+	double * output, int64_t frames, int64_t & done, render_worker_block_stats & stats)
+{
+	const int nch = job.m_nch;
+	const int jobid = ++m_next_job_id;
+	// Blocks of a quarter of the connection buffer, with a few of them in flight
+	const int blockframes = std::max<int>(64, render_worker_shm_size / 4 / (nch*(int)sizeof(double)));
+	const int64_t maxinflight = 4 * (int64_t)blockframes;
+	WDL_Queue& sendq = m_connection->send_queue;
+	WDL_Queue& recvq = m_connection->recv_queue;
+	job.write_header(render_worker_add_message(sendq, render_worker_message::begin_job, jobid, job.get_header_size()));
+	int64_t sent = done;
+	bool endsent = false;
+	auto lastreceived = std::chrono::steady_clock::now();
+	while (true)
+	{
+		while (sent < frames && sent - done < maxinflight)
+		{
+			render_worker_block_header bh;
+			bh.m_start_frame = sent;
+			bh.m_frames = (int)std::min<int64_t>(blockframes, frames - sent);
+			const size_t bytes = (size_t)bh.m_frames*nch*sizeof(double);
+			char* dest = (char*)render_worker_add_message(sendq, render_worker_message::block, jobid, (int)(sizeof(bh) + bytes));
+			memcpy(dest, &bh, sizeof(bh));
+			memcpy(dest + sizeof(bh), input + sent*nch, bytes);
+			sent += bh.m_frames;
+		}
+		if (sent == frames && endsent == false)
+		{
+			render_worker_add_message(sendq, render_worker_message::end_job, jobid, 0);
+			endsent = true;
+		}
+		if (m_connection->WantSendKeepAlive() == true)
+			render_worker_add_message(sendq, render_worker_message::keep_alive, 0, 0);
+		int r = m_connection->Run();
+		if (r < 0)
+		{
+			m_last_error = "Lost the connection to the render worker";
+			return job_result::failed;
+		}
+		const char* payload = nullptr;
+		while (const render_worker_message_header* hdr = render_worker_peek_message(recvq, payload))
+		{
+			const render_worker_message_header h = *hdr;
+			lastreceived = std::chrono::steady_clock::now();
+			if (h.m_job == jobid && h.m_type == (int32_t)render_worker_message::block)
+			{
+				render_worker_block_header bh;
+				if (h.m_size < (int)sizeof(bh))
+				{
+					m_last_error = "The render worker returned a truncated block";
+					return job_result::failed;
+				}
+				memcpy(&bh, payload, sizeof(bh));
+				// The blocks come back in the order they were sent, and a block must fit in its message,
+				// so that a misbehaving worker can't make this read past it
+				if (bh.m_start_frame != done || bh.m_frames < 0 || done + bh.m_frames > sent ||
+					(int64_t)sizeof(bh) + (int64_t)bh.m_frames*nch*(int64_t)sizeof(double) > h.m_size)
+				{
+					m_last_error = "The render worker returned an unexpected block";
+					return job_result::failed;
+				}
+				memcpy(output + done*nch, payload + sizeof(bh), (size_t)bh.m_frames*nch*sizeof(double));
+				stats.m_num_clipped += bh.m_num_clipped;
+				stats.m_max_clipped = std::max(stats.m_max_clipped, bh.m_max_clipped);
+				done += bh.m_frames;
+			}
+			else if (h.m_job == jobid && h.m_type == (int32_t)render_worker_message::end_job)
+			{
+				recvq.Advance(sizeof(h) + h.m_size);
+				recvq.Compact();
+				return done == frames ? job_result::completed : job_result::failed;
+			}
+			else if (h.m_job == jobid && h.m_type == (int32_t)render_worker_message::error)
+			{
+				m_last_error = "Render worker : " + std::string(payload, strnlen(payload, h.m_size));
+				recvq.Advance(sizeof(h) + h.m_size);
+				recvq.Compact();
+				return job_result::rejected;
+			}
+			// Keep alives and anything else are skipped
+			recvq.Advance(sizeof(h) + h.m_size);
+		}
+		recvq.Compact();
+		if (is_process_alive() == false)
+		{
+			m_last_error = "The render worker process exited";
+			return job_result::failed;
+		}
+		if (std::chrono::steady_clock::now() - lastreceived > std::chrono::seconds(m_settings.m_timeout_seconds))
+		{
+			m_last_error = "The render worker stopped responding";
+			return job_result::failed;
+		}
+		if (r == 0)
+			wait_for_connection();
+	}
+}
+
+static std::unique_ptr<render_worker_client> g_render_worker_client;
+
+render_worker_client& get_render_worker_client()
+{
+	if (g_render_worker_client == nullptr)
+		g_render_worker_client = std::make_unique<render_worker_client>();
+	return *g_render_worker_client;
+}
+
+void shutdown_render_worker_client()
+{
+	g_render_worker_client.reset();
+}
+
+void test_render_worker()
+{
+	render_worker_job job;
+	job.m_nch = 2;
+	job.m_sr = 44100.0;
+	job.m_envelope.add_point({ 0.0, 0.0, envbreakpoint::Power, 0.7 }, false);
+	job.m_envelope.add_point({ 30.0, 2.0, envbreakpoint::Power, 0.3 }, false);
+	job.m_envelope.add_point({ 60.0, 0.5 }, true);
+	const int64_t frames = 60 * 44100;
+	std::vector<double> input(frames*job.m_nch);
+	for (auto& e : input)
+		e = -1.0 + 2.0*rand() / RAND_MAX;
+	std::vector<double> output0(input.size());
+	std::vector<double> output1(input.size());
+	render_worker_settings settings = get_render_worker_client().get_settings();
+	settings.m_enabled = true;
+	render_worker_client worker(settings);
+	render_worker_block_stats stats0;
+	render_worker_block_stats stats1;
+	double t0 = time_precise();
+	bool inworker = worker.process(job, input.data(), output0.data(), frames, stats0);
+	double t1 = time_precise();
+	for (int64_t i = 0; i < frames; i += 65536)
+	{
+		int n = (int)std::min<int64_t>(65536, frames - i);
+		process_render_worker_block(job, i, &input[i * 2], &output1[i * 2], n, stats1);
+	}
+	double t2 = time_precise();
+	if (inworker == false)
+		readbg() << worker.get_last_error() << "\n";
+	readbg() << "Worker " << (t1 - t0)*1000.0 << " ms, " << worker.get_num_restarts() << " restarts, in process "
+		<< (t2 - t1)*1000.0 << " ms\n";
+	readbg() << "Results " << (output0 == output1 && stats0.m_num_clipped == stats1.m_num_clipped ? "match" : "differ")
+		<< ", " << stats1.m_num_clipped << " samples clipped\n";
+}
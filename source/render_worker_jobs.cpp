@@ -0,0 +1,100 @@
+#include "render_worker_jobs.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+int render_worker_job::get_header_size() const
+{
+	return (int)(sizeof(render_worker_job_header) + m_envelope.get_num_points()*sizeof(render_worker_point));
+}
+
+void render_worker_job::write_header(void * dest) const
+{
+	render_worker_job_header hdr;
+	hdr.m_kind = (int32_t)m_kind;
+	hdr.m_nch = m_nch;
+	hdr.m_sr = m_sr;
+	hdr.m_clip_level = m_clip_level;
+	hdr.m_num_points = m_envelope.get_num_points();
+	memcpy(dest, &hdr, sizeof(hdr));
+	auto points = (render_worker_point*)((char*)dest + sizeof(hdr));
+	for (int i = 0; i < hdr.m_num_points; ++i)
+	{
+		const envbreakpoint& pt = m_envelope.get_point(i);
+		render_worker_point p;
+		p.m_x = pt.get_x();
+		p.m_y = pt.get_y();
+		p.m_p1 = pt.get_param1();
+		p.m_p2 = pt.get_param2();
+		p.m_shape = (int32_t)pt.get_shape();
+		memcpy(&points[i], &p, sizeof(p));
+	}
+}
+
+bool render_worker_job::read_header(const char * payload, int size, std::string & err)
+{
+	render_worker_job_header hdr;
+	if (size < (int)sizeof(hdr))
+	{
+		err = "Job header too short";
+		return false;
+	}
+	memcpy(&hdr, payload, sizeof(hdr));
+	if (hdr.m_kind != (int32_t)render_worker_job_kind::envelope_gain)
+	{
+		err = "Unknown job kind " + std::to_string(hdr.m_kind);
+		return false;
+	}
+	// The counts are checked against the space left before they are multiplied, so they can't overflow.
+	// 128 channels is the most a Reaper track has.
+	if (hdr.m_nch < 1 || hdr.m_nch > 128 || hdr.m_sr <= 0.0 || hdr.m_num_points < 0 ||
+		(size_t)hdr.m_num_points > (size - sizeof(hdr)) / sizeof(render_worker_point))
+	{
+		err = "Invalid job header";
+		return false;
+	}
+	m_kind = (render_worker_job_kind)hdr.m_kind;
+	m_nch = hdr.m_nch;
+	m_sr = hdr.m_sr;
+	m_clip_level = hdr.m_clip_level;
+	m_envelope.remove_all_points();
+	for (int i = 0; i < hdr.m_num_points; ++i)
+	{
+		render_worker_point p;
+		memcpy(&p, payload + sizeof(hdr) + i*sizeof(p), sizeof(p));
+		m_envelope.add_point({ p.m_x, p.m_y, (envbreakpoint::PointShape)p.m_shape, p.m_p1, p.m_p2 }, false);
+	}
+	m_envelope.sort_points();
+	return true;
+}
+
+void process_render_worker_block(const render_worker_job & job, int64_t startframe,
+	const double * input, double * output, int frames, render_worker_block_stats & stats)
+{
+	const int nch = job.m_nch;
+	const double clip = job.m_clip_level;
+	double gains[256];
+	int pos = 0;
+	while (pos < frames)
+	{
+		const int n = std::min(256, frames - pos);
+		job.m_envelope.interpolate_block((startframe + pos) / job.m_sr, 1.0 / job.m_sr, gains, n);
+		for (int i = 0; i < n; ++i)
+		{
+			const double gain = gains[i];
+			for (int j = 0; j < nch; ++j)
+			{
+				const int64_t index = (int64_t)(pos + i)*nch + j;
+				const double s = input[index] * gain;
+				const double abs_sample = fabs(s);
+				if (abs_sample > clip)
+				{
+					++stats.m_num_clipped;
+					stats.m_max_clipped = std::max(stats.m_max_clipped, abs_sample);
+				}
+				output[index] = std::max(-clip, std::min(s, clip));
+			}
+		}
+		pos += n;
+	}
+}
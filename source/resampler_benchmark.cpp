@@ -0,0 +1,215 @@
+#include "resampler_benchmark.h"
+#include "utilfuncs.h"
+#include "WDL/WDL/resample.h"
+#include <cmath>
+#include <cstdio>
+#include <type_traits>
+
+static_assert(std::is_same<ReaSample, WDL_ResampleSample>::value, "Reaper and WDL resamplers must use the same sample type");
+
+// WDL_Resampler behind Reaper's interface, so both can be measured the same way
+class wdl_resampler_adapter : public REAPER_Resample_Interface
+{
+public:
+	wdl_resampler_adapter(bool interp, int filtercnt, bool sinc, int sincsize = 64, int sincinterpsize = 32)
+	{
+		m_rs.SetMode(interp, filtercnt, sinc, sincsize, sincinterpsize);
+	}
+	void SetRates(double rate_in, double rate_out) override { m_rs.SetRates(rate_in, rate_out); }
+	void Reset() override { m_rs.Reset(); }
+	double GetCurrentLatency() override { return m_rs.GetCurrentLatency(); }
+	int ResamplePrepare(int out_samples, int nch, ReaSample** inbuffer) override
+	{
+		return m_rs.ResamplePrepare(out_samples, nch, inbuffer);
+	}
+	int ResampleOut(ReaSample* out, int nsamples_in, int nsamples_out, int nch) override
+	{
+		return m_rs.ResampleOut(out, nsamples_in, nsamples_out, nch);
+	}
+private:
+	WDL_Resampler m_rs;
+};
+
+std::vector<resampler_config> get_resampler_benchmark_configs()
+{
+	std::vector<resampler_config> result;
+	for (int i = 0; ; ++i)
+	{
+		const char* modename = Resample_EnumModes(i);
+		if (modename == nullptr)
+			break;
+		result.push_back({ modename, [i]()
+		{
+			std::unique_ptr<REAPER_Resample_Interface> rs(Resampler_Create());
+			if (rs != nullptr)
+				rs->Extended(RESAMPLE_EXT_SETRSMODE, (void*)(intptr_t)i, 0, 0);
+			return rs;
+		} });
+	}
+	auto add_wdl = [&result](const char* name, bool interp, int filtercnt, bool sinc, int sincsize)
+	{
+		result.push_back({ name, [=]()
+		{
+			return std::unique_ptr<REAPER_Resample_Interface>(new wdl_resampler_adapter(interp, filtercnt, sinc, sincsize));
+		} });
+	};
+	add_wdl("WDL point", false, 0, false, 0);
+	add_wdl("WDL linear", true, 0, false, 0);
+	add_wdl("WDL linear, 1 IIR", true, 1, false, 0);
+	add_wdl("WDL linear, 2 IIR", true, 2, false, 0);
+	add_wdl("WDL sinc 64", false, 0, true, 64);
+	add_wdl("WDL sinc 192", false, 0, true, 192);
+	add_wdl("WDL sinc 384", false, 0, true, 384);
+	return result;
+}
+
+// Resamples the interleaved input into outframes frames of output, the input is followed by silence if it runs out.
+// Returns the elapsed time.
+static double run_resampler(REAPER_Resample_Interface* rs, double insr, double outsr, int nch,
+	const std::vector<double>& in, std::vector<double>& out, int outframes)
+{
+	const int blocksize = 512;
+	const int64_t inframes = (int64_t)in.size() / nch;
+	out.assign((size_t)outframes*nch, 0.0);
+	rs->Reset();
+	rs->SetRates(insr, outsr);
+	int64_t inpos = 0;
+	int outpos = 0;
+	int stalls = 0;
+	double t0 = time_precise();
+	while (outpos < outframes && stalls < 16)
+	{
+		int n = std::min(blocksize, outframes - outpos);
+		ReaSample* inbuf = nullptr;
+		int wanted = rs->ResamplePrepare(n, nch, &inbuf);
+		int avail = (int)bound_value<int64_t>(0, inframes - inpos, wanted);
+		for (int i = 0; i < avail*nch; ++i)
+			inbuf[i] = in[(size_t)(inpos*nch + i)];
+		for (int i = avail*nch; i < wanted*nch; ++i)
+			inbuf[i] = 0.0;
+		inpos += wanted;
+		int got = rs->ResampleOut(&out[(size_t)outpos*nch], wanted, n, nch);
+		outpos += got;
+		if (got > 0)
+			stalls = 0;
+		else ++stalls;
+	}
+	return time_precise() - t0;
+}
+
+// Sine of freq Hz, with a different phase for each channel
+static std::vector<double> make_test_tone(double freq, double sr, int nch, int64_t frames)
+{
+	std::vector<double> result((size_t)(frames*nch));
+	const double twopi = 2.0*3.141592653589793;
+	for (int64_t i = 0; i < frames; ++i)
+		for (int ch = 0; ch < nch; ++ch)
+			result[(size_t)(i*nch + ch)] = 0.5*sin(twopi*freq / sr*i + ch*0.5);
+	return result;
+}
+
+// RMS of what remains of the mono signal after removing the least squares fit of a sine of freq Hz,
+// relative to refrms, in dB. With removetone false nothing is removed.
+static double residual_db(const double* sig, int len, double freq, double sr, bool removetone, double refrms)
+{
+	const double w = 2.0*3.141592653589793*freq / sr;
+	double a = 0.0;
+	double b = 0.0;
+	if (removetone == true)
+	{
+		double ss = 0.0, cc = 0.0, sc = 0.0, ys = 0.0, yc = 0.0;
+		for (int i = 0; i < len; ++i)
+		{
+			double s = sin(w*i);
+			double c = cos(w*i);
+			ss += s*s; cc += c*c; sc += s*c;
+			ys += sig[i] * s; yc += sig[i] * c;
+		}
+		double det = ss*cc - sc*sc;
+		if (det != 0.0)
+		{
+			a = (ys*cc - yc*sc) / det;
+			b = (yc*ss - ys*sc) / det;
+		}
+	}
+	double sum = 0.0;
+	for (int i = 0; i < len; ++i)
+	{
+		double r = sig[i] - a*sin(w*i) - b*cos(w*i);
+		sum += r*r;
+	}
+	double rms = sqrt(sum / std::max(1, len));
+	if (rms <= 0.0)
+		return -300.0;
+	return 20.0*log10(rms / refrms);
+}
+
+// Measures the mono quality figures of a resampler at a rate pair into the result
+static void measure_quality(REAPER_Resample_Interface* rs, double insr, double outsr, resampler_benchmark_result& result)
+{
+	const double seconds = 1.0;
+	const int outframes = (int)(outsr*seconds);
+	// The start and the end have the resampler's latency and settling, which are not measured
+	const int skip = (int)(outsr*0.1);
+	const int len = outframes - 2 * skip;
+	const double refrms = 0.5 / sqrt(2.0);
+	std::vector<double> out;
+	auto in = make_test_tone(997.0, insr, 1, (int64_t)(insr*(seconds + 0.5)));
+	run_resampler(rs, insr, outsr, 1, in, out, outframes);
+	result.m_thdn_db = residual_db(&out[skip], len, 997.0, outsr, true, refrms);
+	const double hffreq = 0.9*insr / 2.0;
+	in = make_test_tone(hffreq, insr, 1, (int64_t)(insr*(seconds + 0.5)));
+	run_resampler(rs, insr, outsr, 1, in, out, outframes);
+	result.m_hf_residual_db = residual_db(&out[skip], len, hffreq, outsr, hffreq < outsr / 2.0, refrms);
+}
+
+std::vector<resampler_benchmark_result> benchmark_resamplers(const std::vector<resampler_config>& configs, double seconds)
+{
+	const std::pair<double, double> rates[] = { { 44100.0, 48000.0 },{ 48000.0, 44100.0 },{ 44100.0, 88200.0 },{ 96000.0, 44100.0 } };
+	const int channelcounts[] = { 1, 2, 8 };
+	std::vector<resampler_benchmark_result> results;
+	std::vector<double> out;
+	for (auto& config : configs)
+	{
+		auto rs = config.m_create();
+		if (rs == nullptr)
+			continue;
+		for (auto& rate : rates)
+		{
+			resampler_benchmark_result quality;
+			measure_quality(rs.get(), rate.first, rate.second, quality);
+			for (int nch : channelcounts)
+			{
+				resampler_benchmark_result r = quality;
+				r.m_name = config.m_name;
+				r.m_in_sr = rate.first;
+				r.m_out_sr = rate.second;
+				r.m_nch = nch;
+				const int outframes = (int)(rate.second*seconds);
+				auto in = make_test_tone(997.0, rate.first, nch, (int64_t)(rate.first*(seconds + 0.5)));
+				double elapsed = run_resampler(rs.get(), rate.first, rate.second, nch, in, out, outframes);
+				elapsed = std::max(elapsed, 1.0e-9);
+				r.m_realtime = seconds / elapsed;
+				r.m_msamples_per_second = (double)outframes*nch / elapsed / 1.0e6;
+				results.push_back(r);
+			}
+		}
+	}
+	return results;
+}
+
+void print_resampler_benchmark(const std::vector<resampler_benchmark_result>& results)
+{
+	char buf[512];
+	snprintf(buf, sizeof(buf), "%-32s %-14s %4s %12s %10s %9s %9s\n", "Resampler", "Rates", "Chs", "x realtime",
+		"MSmp/s", "THD+N dB", "HF res dB");
+	readbg() << buf;
+	for (auto& r : results)
+	{
+		char rates[64];
+		snprintf(rates, sizeof(rates), "%g>%g", r.m_in_sr / 1000.0, r.m_out_sr / 1000.0);
+		snprintf(buf, sizeof(buf), "%-32.32s %-14s %4d %12.1f %10.1f %9.1f %9.1f\n", r.m_name.c_str(), rates, r.m_nch,
+			r.m_realtime, r.m_msamples_per_second, r.m_thdn_db, r.m_hf_residual_db);
+		readbg() << buf;
+	}
+}
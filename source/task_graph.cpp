@@ -0,0 +1,107 @@
+#include "task_graph.h"
+
+int task_graph::add_task(std::shared_ptr<IParallelTask> task, const std::vector<int>& dependencies)
+{
+	if (m_started == true || task == nullptr)
+		return -1;
+	int index = (int)m_nodes.size();
+	for (int dep : dependencies)
+		if (dep < 0 || dep >= index)
+			return -1;
+	auto n = std::make_unique<node>();
+	n->m_task = task;
+	n->m_num_dependencies = (int)dependencies.size();
+	task->set_cancellation_token(m_cancel);
+	for (int dep : dependencies)
+		m_nodes[dep]->m_dependents.push_back(index);
+	m_nodes.push_back(std::move(n));
+	return index;
+}
+
+int task_graph::add_task(std::function<void(IParallelTask&)> f, const std::vector<int>& dependencies)
+{
+	return add_task(std::make_shared<function_task>(f), dependencies);
+}
+
+void task_graph::start(work_stealing_pool & pool)
+{
+	if (m_started == true)
+		return;
+	m_started = true;
+	m_pool = &pool;
+	m_self = shared_from_this();
+	if (m_nodes.empty() == true)
+	{
+		execute_in_main_thread([this]()
+		{
+			auto self = std::move(m_self);
+			if (m_completion_callback)
+				m_completion_callback(*this);
+		});
+		return;
+	}
+	// All counts have to be set before the first task runs and starts decrementing them
+	std::vector<int> ready;
+	for (int i = 0; i < (int)m_nodes.size(); ++i)
+	{
+		m_nodes[i]->m_waiting_for = m_nodes[i]->m_num_dependencies;
+		if (m_nodes[i]->m_num_dependencies == 0)
+			ready.push_back(i);
+	}
+	for (int index : ready)
+		submit_node(index);
+}
+
+double task_graph::get_progress() const
+{
+	if (m_nodes.empty() == true)
+		return 1.0;
+	double sum = 0.0;
+	for (auto& n : m_nodes)
+	{
+		task_state state = n->m_state;
+		if (state == task_state::Finished || state == task_state::Skipped)
+			sum += 1.0;
+		else sum += bound_value(0.0, n->m_task->get_progress(), 1.0);
+	}
+	return sum / m_nodes.size();
+}
+
+void task_graph::submit_node(int index)
+{
+	m_pool->submit([this, index]() { run_node(index); });
+}
+
+void task_graph::run_node(int index)
+{
+	node& n = *m_nodes[index];
+	bool ran = false;
+	if (n.m_skip == false && m_cancel.is_cancelled() == false)
+	{
+		n.m_state = task_state::Running;
+		n.m_task->run();
+		n.m_state = task_state::Finished;
+		ran = true;
+	}
+	else n.m_state = task_state::Skipped;
+	for (int dependent : n.m_dependents)
+	{
+		if (ran == false)
+			m_nodes[dependent]->m_skip = true;
+		if (m_nodes[dependent]->m_waiting_for.fetch_sub(1) == 1)
+			submit_node(dependent);
+	}
+	if (m_task_callback)
+		execute_in_main_thread([this, index, ran]() { m_task_callback(index, ran); });
+	// The graph may be released as soon as the last task is counted done, so nothing can be touched after it
+	const int numtasks = (int)m_nodes.size();
+	if (m_num_done.fetch_add(1) + 1 == numtasks)
+	{
+		execute_in_main_thread([this]()
+		{
+			auto self = std::move(m_self);
+			if (m_completion_callback)
+				m_completion_callback(*this);
+		});
+	}
+}
@@ -1,6 +1,8 @@
 #include "utilfuncs.h"
 #include "WDL/WDL/lice/lice.h"
 #include "reaper_plugin/reaper_plugin_functions.h"
+#include "work_stealing_pool.h"
+#include <thread>
 
 readbg::~readbg()
 {
@@ -44,43 +46,109 @@ create_item_result create_item_with_take_and_source(MediaTrack * track, const ch
 	return result;
 }
 
+void execute_parallel_tasks(std::vector<std::shared_ptr<IParallelTask>> tasks, bool multithreaded)
+{
+	// No use in firing up the concurrency stuff if only one task
+	if (tasks.size() < 2)
+		multithreaded = false;
+	if (multithreaded == true)
+	{
+		std::vector<work_stealing_pool::task> pooltasks;
+		for (auto& e : tasks)
+			pooltasks.push_back([e]() { e->run(); });
+		get_shared_work_stealing_pool().run_and_wait(pooltasks);
+	}
+	else
+	{
+		for (auto& e : tasks)
+			e->run();
+	}
+}
+
 UINT_PTR g_main_thread_exec_timer = 0;
-std::mutex g_main_thread_exec_mutex;
-std::vector<std::function<void(void)>> g_main_thread_exec_tasks;
+std::thread::id g_main_thread_id;
 
-void CALLBACK mtetimerproc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime)
+// Queued functions as a lock-free stack. Any number of threads can push to it and the main thread takes
+// the whole stack at once, so nodes can't be reused while another thread is looking at them.
+struct main_thread_task_node
 {
-	if (idEvent == g_main_thread_exec_timer)
+	std::function<void(void)> m_f;
+	main_thread_task_node* m_next = nullptr;
+};
+std::atomic<main_thread_task_node*> g_main_thread_exec_tasks{ nullptr };
+
+static main_thread_task_node* take_main_thread_tasks()
+{
+	main_thread_task_node* stack = g_main_thread_exec_tasks.exchange(nullptr, std::memory_order_acquire);
+	// The stack has the newest function first, reverse it to run the functions in the order they were queued
+	main_thread_task_node* result = nullptr;
+	while (stack != nullptr)
+	{
+		main_thread_task_node* next = stack->m_next;
+		stack->m_next = result;
+		result = stack;
+		stack = next;
+	}
+	return result;
+}
+
+void run_main_thread_tasks()
+{
+	// Functions queued while these run are left for the next call
+	main_thread_task_node* task = take_main_thread_tasks();
+	while (task != nullptr)
 	{
-		g_main_thread_exec_mutex.lock();
-		for (auto& e : g_main_thread_exec_tasks)
-			e();
-		g_main_thread_exec_tasks.clear();
-		g_main_thread_exec_mutex.unlock();
+		main_thread_task_node* next = task->m_next;
+		task->m_f();
+		delete task;
+		task = next;
 	}
 }
 
+bool is_main_thread()
+{
+	return std::this_thread::get_id() == g_main_thread_id;
+}
+
+void CALLBACK mtetimerproc(HWND hwnd, UINT uMsg, UINT_PTR idEvent, DWORD dwTime)
+{
+	if (idEvent == g_main_thread_exec_timer)
+		run_main_thread_tasks();
+}
+
 void start_or_stop_main_thread_executor(bool stop)
 {
 	if (stop == false)
 	{
+		g_main_thread_id = std::this_thread::get_id();
 		g_main_thread_exec_timer = SetTimer(0, 1000, 10, mtetimerproc);
 	}
 	else
 	{
 		if (g_main_thread_exec_timer != 0)
 		{
-			g_main_thread_exec_mutex.lock();
-			g_main_thread_exec_tasks.clear();
 			KillTimer(0,g_main_thread_exec_timer);
-			g_main_thread_exec_mutex.unlock();
+			g_main_thread_exec_timer = 0;
+		}
+		// Dropping the functions breaks the promises of call_in_main_thread, so waiting threads get an exception
+		// instead of waiting forever
+		main_thread_task_node* task = take_main_thread_tasks();
+		while (task != nullptr)
+		{
+			main_thread_task_node* next = task->m_next;
+			delete task;
+			task = next;
 		}
 	}
 }
 
 void execute_in_main_thread(std::function<void(void)> f)
 {
-	g_main_thread_exec_mutex.lock();
-	g_main_thread_exec_tasks.push_back(f);
-	g_main_thread_exec_mutex.unlock();
+	main_thread_task_node* node = new main_thread_task_node;
+	node->m_f = std::move(f);
+	node->m_next = g_main_thread_exec_tasks.load(std::memory_order_relaxed);
+	while (g_main_thread_exec_tasks.compare_exchange_weak(node->m_next, node,
+		std::memory_order_release, std::memory_order_relaxed) == false)
+	{
+	}
 }
@@ -0,0 +1,203 @@
+#include "work_stealing_pool.h"
+#include <chrono>
+#include <algorithm>
+
+// Which pool and which worker of it the current thread is, so that submits from tasks go to the worker's own queue
+static thread_local work_stealing_pool* t_current_pool = nullptr;
+static thread_local int t_worker_index = -1;
+
+work_stealing_pool::work_stealing_pool(int numthreads)
+{
+	if (numthreads < 0)
+		numthreads = (int)std::thread::hardware_concurrency();
+	if (numthreads < 1)
+		numthreads = 1;
+	for (int i = 0; i < numthreads; ++i)
+		m_workers.push_back(std::make_unique<worker>());
+	for (int i = 0; i < numthreads; ++i)
+		m_threads.emplace_back([this, i]() { worker_proc(i); });
+}
+
+work_stealing_pool::~work_stealing_pool()
+{
+	m_quit = true;
+	{
+		std::lock_guard<std::mutex> locker(m_wake_mutex);
+		m_wake_cv.notify_all();
+	}
+	for (auto& t : m_threads)
+		t.join();
+}
+
+void work_stealing_pool::submit(task t)
+{
+	int index = 0;
+	if (t_current_pool == this)
+		index = t_worker_index;
+	else index = (int)(m_next_queue.fetch_add(1) % m_workers.size());
+	{
+		std::lock_guard<std::mutex> locker(m_workers[index]->m_mutex);
+		m_workers[index]->m_queue.push_back(std::move(t));
+	}
+	m_num_queued.fetch_add(1);
+	// Taking the mutex orders this with the sleeping workers' check of the queued count, so the wake up isn't lost
+	std::lock_guard<std::mutex> locker(m_wake_mutex);
+	m_wake_cv.notify_one();
+}
+
+bool work_stealing_pool::run_one_task(int ownindex)
+{
+	if (m_num_queued.load() == 0)
+		return false;
+	task t;
+	bool stolen = false;
+	if (ownindex >= 0)
+	{
+		std::lock_guard<std::mutex> locker(m_workers[ownindex]->m_mutex);
+		auto& queue = m_workers[ownindex]->m_queue;
+		if (queue.empty() == false)
+		{
+			t = std::move(queue.back());
+			queue.pop_back();
+		}
+	}
+	if (!t)
+	{
+		const int numworkers = (int)m_workers.size();
+		int start = ownindex >= 0 ? ownindex + 1 : 0;
+		for (int i = 0; i < numworkers; ++i)
+		{
+			int victim = (start + i) % numworkers;
+			if (victim == ownindex)
+				continue;
+			std::lock_guard<std::mutex> locker(m_workers[victim]->m_mutex);
+			auto& queue = m_workers[victim]->m_queue;
+			if (queue.empty() == false)
+			{
+				t = std::move(queue.front());
+				queue.pop_front();
+				stolen = true;
+				break;
+			}
+		}
+	}
+	if (!t)
+		return false;
+	m_num_queued.fetch_sub(1);
+	if (stolen == true)
+		++m_num_stolen;
+	else ++m_num_local;
+	t();
+	return true;
+}
+
+void work_stealing_pool::worker_proc(int index)
+{
+	t_current_pool = this;
+	t_worker_index = index;
+	while (m_quit == false)
+	{
+		if (run_one_task(index) == true)
+			continue;
+		std::unique_lock<std::mutex> locker(m_wake_mutex);
+		m_wake_cv.wait(locker, [this]() { return m_quit == true || m_num_queued.load() > 0; });
+	}
+}
+
+void work_stealing_pool::run_and_wait(std::vector<task>& tasks)
+{
+	if (tasks.empty() == true)
+		return;
+	// The queued entries don't each own a task, they claim the next unclaimed task of the batch. So the
+	// calling thread can run the batch's tasks itself without taking anything else from the queues, and
+	// entries that find the batch already claimed just return.
+	struct batch
+	{
+		std::vector<task>* m_tasks = nullptr;
+		int m_num_tasks = 0;
+		std::atomic<int> m_next{ 0 };
+		std::atomic<int> m_remaining{ 0 };
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		bool run_one()
+		{
+			int index = m_next.fetch_add(1);
+			if (index >= m_num_tasks)
+				return false;
+			// The caller waits for this task, so the tasks vector is still alive
+			(*m_tasks)[index]();
+			if (m_remaining.fetch_sub(1) == 1)
+			{
+				std::lock_guard<std::mutex> locker(m_mutex);
+				m_cv.notify_all();
+			}
+			return true;
+		}
+	};
+	auto b = std::make_shared<batch>();
+	b->m_tasks = &tasks;
+	b->m_num_tasks = (int)tasks.size();
+	b->m_remaining = (int)tasks.size();
+	for (size_t i = 1; i < tasks.size(); ++i)
+		submit([b]() { b->run_one(); });
+	while (b->run_one() == true)
+		;
+	// Workers waiting for their own batch help with the other queued tasks meanwhile, because those may be
+	// tasks their batch depends on. Other threads, like the GUI thread, only wait, so they are never held up
+	// by unrelated long tasks.
+	int ownindex = t_current_pool == this ? t_worker_index : -1;
+	while (b->m_remaining.load() > 0)
+	{
+		if (ownindex >= 0 && run_one_task(ownindex) == true)
+			continue;
+		// The remaining tasks are running in other threads
+		std::unique_lock<std::mutex> locker(b->m_mutex);
+		b->m_cv.wait_for(locker, std::chrono::milliseconds(1), [&b]() { return b->m_remaining.load() == 0; });
+	}
+}
+
+void work_stealing_pool::parallel_for(int64_t begin, int64_t end, int64_t grain, const std::function<void(int64_t, int64_t)>& fn)
+{
+	if (end <= begin)
+		return;
+	int64_t len = end - begin;
+	if (grain <= 0)
+	{
+		// Below this the task overhead would be a noticeable part of the work for simple kernels
+		const int64_t min_auto_grain = 4096;
+		grain = len / ((int64_t)m_workers.size() * 4);
+		grain = (grain + 63) & ~(int64_t)63;
+		if (grain < min_auto_grain)
+			grain = min_auto_grain;
+	}
+	if (len <= grain)
+	{
+		fn(begin, end);
+		return;
+	}
+	std::vector<task> tasks;
+	tasks.reserve((size_t)((len + grain - 1) / grain));
+	for (int64_t chunk = begin; chunk < end; chunk += grain)
+	{
+		int64_t chunkend = std::min(chunk + grain, end);
+		tasks.push_back([&fn, chunk, chunkend]() { fn(chunk, chunkend); });
+	}
+	run_and_wait(tasks);
+}
+
+static std::mutex g_shared_pool_mutex;
+static std::unique_ptr<work_stealing_pool> g_shared_pool;
+
+work_stealing_pool& get_shared_work_stealing_pool()
+{
+	std::lock_guard<std::mutex> locker(g_shared_pool_mutex);
+	if (g_shared_pool == nullptr)
+		g_shared_pool = std::make_unique<work_stealing_pool>();
+	return *g_shared_pool;
+}
+
+void shutdown_shared_work_stealing_pool()
+{
+	std::lock_guard<std::mutex> locker(g_shared_pool_mutex);
+	g_shared_pool.reset();
+}
@@ -1,4 +1,5 @@
 #include "xendynamicsprocessor.h"
+#include "render_worker_client.h"
 #include "WDL/WDL/db2val.h"
 #include "picojson/picojson.h"
 #include <fstream>
@@ -255,26 +256,19 @@ void DynamicsProcessorWindow::render_dynamics_transform()
 			}
 		}
 		env.sort_points();
-		int overcounter = 0;
-		double max_sample = 0.0;
-		for (int64_t i = 0; i < numframes; ++i)
-		{
-			double gain = env.interpolate((double)i / av.sampleRate());
-			for (int j = 0; j < numchans; ++j)
-			{
-				double s = av.getSample(j, i)*gain;
-				m_transformed_audio[i*numchans + j] = bound_value(-1.0,s,1.0);
-				double abs_sample = fabs(s);
-				if (abs_sample > 1.0)
-				{
-					++overcounter;
-					if (abs_sample > max_sample)
-						max_sample = abs_sample;
-				}
-			}
-		}
-		if (overcounter > 0)
-			readbg() << overcounter << " samples went over! " << max_sample << "\n";
+		render_worker_job job;
+		job.m_kind = render_worker_job_kind::envelope_gain;
+		job.m_nch = numchans;
+		job.m_sr = av.sampleRate();
+		job.m_clip_level = 1.0;
+		job.m_envelope = env;
+		render_worker_block_stats stats;
+		render_worker_client& worker = get_render_worker_client();
+		if (worker.process(job, av.getData(), m_transformed_audio.data(), numframes, stats) == false &&
+			worker.get_settings().m_enabled == true)
+			readbg() << worker.get_last_error() << ", rendered in Reaper's process instead\n";
+		if (stats.m_num_clipped > 0)
+			readbg() << stats.m_num_clipped << " samples went over! " << stats.m_max_clipped << "\n";
 		audiobuffer_view<double> taview(m_transformed_audio.data(), m_acc->numberOfFrames(),
 			m_acc->numberOfChannels(), m_acc->sampleRate());
 		m_analysiscontrol2->setAudioView(taview);
@@ -302,14 +296,12 @@ void DynamicsProcessorWindow::write_transformed_to_file()
 	if (sink != nullptr)
 	{
 		const int diskbufsize = 65536;
-		std::vector<double> sinkbuf(numchans*diskbufsize);
-		std::vector<double*> sinkbufptrs(taview.numberOfChannels());
-		for (int i = 0; i < numchans; ++i)
-			sinkbufptrs[i] = &sinkbuf[i*diskbufsize];
+		audio_arena arena;
+		double** sinkbufptrs = arena.allocate_channels(numchans, diskbufsize);
 		int64_t diskoutcounter = 0;
 		while (diskoutcounter < numframes)
 		{
-			int framestowrite = diskbufsize;
+			int framestowrite = (int)std::min<int64_t>(diskbufsize, numframes - diskoutcounter);
 			for (int i = 0; i < framestowrite; ++i)
 			{
 				for (int j = 0; j < numchans; ++j)
@@ -317,8 +309,8 @@ void DynamicsProcessorWindow::write_transformed_to_file()
 					sinkbufptrs[j][i] = taview.getSample(j, diskoutcounter+i);
 				}
 			}
-			sink->WriteDoubles(sinkbufptrs.data(), framestowrite, numchans, 0, 1);
-			diskoutcounter += diskbufsize;
+			sink->WriteDoubles(sinkbufptrs, framestowrite, numchans, 0, 1);
+			diskoutcounter += framestowrite;
 		}
 		delete sink;
 		InsertMedia(outfn.c_str(), 3);